@@ -1,9 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <optional>
 #include <ranges>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
 #include "octree.h"
+#include "ray_packet.h"
 
 namespace tracer
 {
@@ -61,6 +68,64 @@ public:
             octree.Insert(obj);
 
         topNode = buildFromNode(octree.GetTopNode());
+        builtArea = topNode ? calcInnerArea(topNode.get()) : 0.0f;
+    }
+    // as Build, but the eight octants of the objects' extent, the subtrees below the split of the octree's top node, are built
+    // concurrently: parallelFor(n, func) has to call func(0) ... func(n - 1) and return once all of them have returned
+    template <std::ranges::input_range Range, typename ParallelFor>
+        requires
+            std::is_same_v<
+                std::ranges::range_value_t<Range>,
+                T>
+    void Build(Range&& objects, const ParallelFor& parallelFor)
+    {
+        AABB extent = calcExtent(objects);
+        std::array<AABB, 8> octants = OctreeType::SplitExtent(extent);
+        std::array<std::vector<T>, 8> octantObjects;
+        size_t nObjects = 0;
+        for (const T& obj : objects)
+        {
+            // the first octant that holds the center, as in the octree
+            glm::vec3 center = boxFunc(obj).GetCenter();
+            auto octant = std::ranges::find_if(octants, [&](const AABB& box) { return box.IsInside(center); });
+            if (octant == octants.end())
+                throw std::runtime_error("obj is outside of the valid extent");
+            octantObjects[octant - octants.begin()].push_back(obj);
+            nObjects++;
+        }
+        // a leaf of the octree holds two objects, so with at most two the top node is never split
+        if (nObjects <= 2)
+        {
+            Build(objects);
+            return;
+        }
+
+        std::array<std::unique_ptr<Node>, 8> octantNodes;
+        parallelFor(8u, [&](uint32_t i)
+        {
+            if (octantObjects[i].empty())
+                return;
+            OctreeType octree(2, octants[i].GetMin(), octants[i].GetMax(), boxFunc);
+            for (const T& obj : octantObjects[i])
+                octree.Insert(obj);
+            octantNodes[i] = buildFromNode(octree.GetTopNode());
+        });
+
+        std::vector<std::unique_ptr<Node>> nodes;
+        for (std::unique_ptr<Node>& node : octantNodes)
+            if (node)
+                nodes.push_back(std::move(node));
+        topNode = nodes.size() == 1 ? std::move(nodes.front()) : groupNodes(std::make_move_iterator(nodes.begin()), nodes.size());
+        builtArea = calcInnerArea(topNode.get());
+    }
+    // recomputes the boxes of the nodes from the boxes of the objects, which may have moved since Build, and keeps the tree;
+    // returns false once the boxes of the inner nodes have grown to more than twice their area after Build, traversal has
+    // got slow enough then that the tree should be built anew
+    bool Refit()
+    {
+        if (!topNode)
+            return true;
+        return refitNode(topNode.get()) <= 2.0f * builtArea;
     }
     bool IsBuilt() const { return topNode != nullptr; }
     AABB GetBox() const
@@ -77,6 +142,8 @@ private:
         using type = OptionalType;
     };
 public:
+    // closest hit along the ray, distanceFunc has to return the ray parameter of a hit since subtrees
+    // whose box is entered further away than the closest hit so far are skipped
     template <typename IntersectionFunc, typename DistanceFunc,
         typename Result =
             optionalValueType<
@@ -99,40 +166,195 @@ public:
         const IntersectionFunc& intersectionFunc = {},
         const DistanceFunc& distanceFunc = {}) const
     {
-        auto result = intersectNode<IntersectionFunc, DistanceFunc, Result, Distance>(
-            topNode.get(), orig, dir, intersectionFunc, distanceFunc);
-        if (result)
-            return result.value().second;
-        return std::nullopt;
+        std::optional<Result> closest;
+        Distance closestDistance{};
+        if (topNode && calcEntryDistance(topNode.get(), orig, dir))
+            intersectNode<IntersectionFunc, DistanceFunc, Result, Distance>(
+                topNode.get(), orig, dir, intersectionFunc, distanceFunc, closest, closestDistance);
+        return closest;
+    }
+    // whether the ray hits anything closer than maxDistance, for shadow rays: returns at the first such hit whichever it is,
+    // occludedFunc(object, orig, dir, maxDistance) answers the same for a single object
+    template <typename OccludedFunc>
+        requires requires(OccludedFunc occludedFunc)
+        {
+            { occludedFunc(T(), glm::vec3(), glm::vec3(), float()) } -> std::convertible_to<bool>;
+        }
+    bool IntersectAny(const glm::vec3& orig, const glm::vec3& dir, float maxDistance, const OccludedFunc& occludedFunc) const
+    {
+        return topNode && isEnteredBefore(topNode.get(), orig, dir, maxDistance) &&
+            intersectAnyNode(topNode.get(), orig, dir, maxDistance, occludedFunc);
+    }
+    // closest hits of the lanes of a packet, leafFunc(object, laneMask, tMax) tests an object against the lanes in laneMask
+    // and lowers tMax of the lanes it hits closer; subtrees are skipped for the lanes that enter them beyond their tMax
+    template <typename LeafFunc>
+        requires requires(LeafFunc leafFunc, std::array<float, rayPacketSize>& tMax)
+        {
+            leafFunc(T(), uint32_t(), tMax);
+        }
+    void IntersectPacket(const RayPacket& packet, uint32_t laneMask, const LeafFunc& leafFunc, std::array<float, rayPacketSize>& tMax) const
+    {
+        if (!topNode)
+            return;
+        std::array<float, rayPacketSize> tEntry;
+        laneMask = intersectPacket(topNode->extent, packet, laneMask, tMax, tEntry);
+        if (laneMask)
+            intersectNodePacket(topNode.get(), packet, laneMask, leafFunc, tMax);
     }
 private:
+    static std::optional<float> calcEntryDistance(const Node* node, const glm::vec3& orig, const glm::vec3& dir)
+    {
+        if (node->extent.IsInside(orig))
+            return 0.0f;
+        return node->extent.Intersect(orig, dir);
+    }
+    static bool isEnteredBefore(const Node* node, const glm::vec3& orig, const glm::vec3& dir, float maxDistance)
+    {
+        std::optional<float> t = calcEntryDistance(node, orig, dir);
+        return t && t.value() < maxDistance;
+    }
+    template <typename OccludedFunc>
+    bool intersectAnyNode(const Node* cur, const glm::vec3& orig, const glm::vec3& dir, float maxDistance, const OccludedFunc& occludedFunc) const
+    {
+        if (!cur->childNodes)
+            return occludedFunc(cur->object, orig, dir, maxDistance);
+        const Node* left = getLeftNode(cur);
+        const Node* right = getRightNode(cur);
+        return (isEnteredBefore(left, orig, dir, maxDistance) && intersectAnyNode(left, orig, dir, maxDistance, occludedFunc)) ||
+            (isEnteredBefore(right, orig, dir, maxDistance) && intersectAnyNode(right, orig, dir, maxDistance, occludedFunc));
+    }
+    // the closest hit is updated in place, so nothing is copied back up the recursion
     template <typename IntersectionFunc, typename DistanceFunc, typename Result, typename Distance>
-    std::optional<std::pair<Distance, Result>> intersectNode(
+    void intersectNode(
         const Node* cur,
         const glm::vec3& orig, const glm::vec3& dir,
         const IntersectionFunc& intersectionFunc,
-        const DistanceFunc& distanceFunc) const
+        const DistanceFunc& distanceFunc,
+        std::optional<Result>& closest,
+        Distance& closestDistance) const
+    {
+        if (!cur->childNodes)
+        {
+            std::optional<Result> result = intersectionFunc(cur->object, orig, dir);
+            if (!result)
+                return;
+            Distance distance = distanceFunc(result.value());
+            if (!closest || distance < closestDistance)
+            {
+                closest = std::move(result);
+                closestDistance = distance;
+            }
+            return;
+        }
+
+        // front to back, so the far child is usually culled by the hit found in the near one
+        const Node* nearNode = getLeftNode(cur);
+        const Node* farNode = getRightNode(cur);
+        std::optional<float> tNear = calcEntryDistance(nearNode, orig, dir);
+        std::optional<float> tFar = calcEntryDistance(farNode, orig, dir);
+        if (tNear && tFar && tFar.value() < tNear.value())
+        {
+            std::swap(nearNode, farNode);
+            std::swap(tNear, tFar);
+        }
+        if (tNear && (!closest || tNear.value() <= closestDistance))
+            intersectNode<IntersectionFunc, DistanceFunc, Result, Distance>(
+                nearNode, orig, dir, intersectionFunc, distanceFunc, closest, closestDistance);
+        if (tFar && (!closest || tFar.value() <= closestDistance))
+            intersectNode<IntersectionFunc, DistanceFunc, Result, Distance>(
+                farNode, orig, dir, intersectionFunc, distanceFunc, closest, closestDistance);
+    }
+    // the lanes share one descent, so every node is fetched once for the whole packet
+    template <typename LeafFunc>
+    void intersectNodePacket(const Node* cur, const RayPacket& packet, uint32_t laneMask, const LeafFunc& leafFunc, std::array<float, rayPacketSize>& tMax) const
+    {
+        if (!cur->childNodes)
+        {
+            leafFunc(cur->object, laneMask, tMax);
+            return;
+        }
+
+        // the packet has lost its coherence, the last lane finishes the subtree on its own
+        if (std::has_single_bit(laneMask))
+        {
+            intersectNodeLane(cur, packet, static_cast<uint32_t>(std::countr_zero(laneMask)), leafFunc, tMax);
+            return;
+        }
+
+        const Node* nearNode = getLeftNode(cur);
+        const Node* farNode = getRightNode(cur);
+        std::array<float, rayPacketSize> tNear, tFar;
+        uint32_t nearMask = intersectPacket(nearNode->extent, packet, laneMask, tMax, tNear);
+        uint32_t farMask = intersectPacket(farNode->extent, packet, laneMask, tMax, tFar);
+
+        // the first lane that enters both children decides the order for the packet
+        if (uint32_t bothMask = nearMask & farMask)
+        {
+            uint32_t lane = static_cast<uint32_t>(std::countr_zero(bothMask));
+            if (tFar[lane] < tNear[lane])
+            {
+                std::swap(nearNode, farNode);
+                std::swap(nearMask, farMask);
+                std::swap(tNear, tFar);
+            }
+        }
+        if (nearMask)
+            intersectNodePacket(nearNode, packet, nearMask, leafFunc, tMax);
+
+        // drop the lanes that found a closer hit in the near child
+        for (uint32_t i = 0; i < rayPacketSize; i++)
+            if (tFar[i] > tMax[i])
+                farMask &= ~(1u << i);
+        if (farMask)
+            intersectNodePacket(farNode, packet, farMask, leafFunc, tMax);
+    }
+    template <typename LeafFunc>
+    void intersectNodeLane(const Node* cur, const RayPacket& packet, uint32_t lane, const LeafFunc& leafFunc, std::array<float, rayPacketSize>& tMax) const
+    {
+        if (!cur->childNodes)
+        {
+            leafFunc(cur->object, 1u << lane, tMax);
+            return;
+        }
+
+        glm::vec3 orig = packet.GetOrigin(lane);
+        glm::vec3 dir = packet.GetDirection(lane);
+        const Node* nearNode = getLeftNode(cur);
+        const Node* farNode = getRightNode(cur);
+        std::optional<float> tNear = calcEntryDistance(nearNode, orig, dir);
+        std::optional<float> tFar = calcEntryDistance(farNode, orig, dir);
+        if (tNear && tFar && tFar.value() < tNear.value())
+        {
+            std::swap(nearNode, farNode);
+            std::swap(tNear, tFar);
+        }
+        if (tNear && tNear.value() <= tMax[lane])
+            intersectNodeLane(nearNode, packet, lane, leafFunc, tMax);
+        if (tFar && tFar.value() <= tMax[lane])
+            intersectNodeLane(farNode, packet, lane, leafFunc, tMax);
+    }
+    static float calcArea(const AABB& box)
+    {
+        glm::vec3 size = box.GetSize();
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+    // sum of the box areas of the inner nodes of the subtree
+    static float calcInnerArea(const Node* cur)
+    {
+        if (!cur->childNodes)
+            return 0.0f;
+        return calcArea(cur->extent) + calcInnerArea(getLeftNode(cur)) + calcInnerArea(getRightNode(cur));
+    }
+    float refitNode(Node* cur)
     {
-        if (!cur->extent.IsInside(orig) && !cur->extent.Intersect(orig, dir))
-            return std::nullopt;
-        if (cur->childNodes)
+        if (!cur->childNodes)
         {
-            auto leftResult = intersectNode<IntersectionFunc, DistanceFunc, Result, Distance>(
-                getLeftNode(cur), orig, dir, intersectionFunc, distanceFunc);
-            auto rightResult = intersectNode<IntersectionFunc, DistanceFunc, Result, Distance>(
-                getRightNode(cur), orig, dir, intersectionFunc, distanceFunc);
-            if (!leftResult && !rightResult)
-                return std::nullopt;
-            if (leftResult && !rightResult)
-                return leftResult;
-            if (!leftResult && rightResult)
-                return rightResult;
-            return std::min(leftResult, rightResult, [](const auto& a, const auto& b) { return a.value().first < b.value().first; });
+            cur->extent = boxFunc(cur->object);
+            return 0.0f;
         }
-        std::optional<Result> result = intersectionFunc(cur->object, orig, dir);
-        if (!result)
-            return std::nullopt;
-        return std::optional<std::pair<Distance, Result>>(std::make_pair(distanceFunc(result.value()), result.value()));
+        float area = refitNode(getLeftNode(cur)) + refitNode(getRightNode(cur));
+        cur->extent = AABB(getLeftNode(cur)->extent, getRightNode(cur)->extent);
+        return area + calcArea(cur->extent);
     }
     AABB calcExtent(auto&& objects)
     {
@@ -267,6 +489,7 @@ private:
     }
 
     std::unique_ptr<Node> topNode;
+    float builtArea = 0.0f;
     BoxFunc boxFunc;
 };
 
@@ -51,11 +51,11 @@ public:
     }
     void SaveToPNG(std::string_view file) const;
 private:
-    size_t getDataSize() const { return width * height * channelCount; }
+    size_t getDataSize() const { return static_cast<size_t>(width) * height * channelCount; }
     size_t getIndex(uint32_t w, uint32_t h, uint32_t channel) const
     {
         assert(w < width && h < height);
-        return (h * width + w) * channelCount + channel;
+        return (static_cast<size_t>(h) * width + w) * channelCount + channel;
     }
     uint32_t width, height, channelCount;
     std::unique_ptr<uint8_t[]> data;
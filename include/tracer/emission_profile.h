@@ -1,24 +1,44 @@
 #pragma once
 
-#include <optional>
+#include <array>
+#include <cstdint>
+#include <limits>
 
 #include <glm/glm.hpp>
 
-#include "rng.h"
-
 namespace tracer
 {
 
+class Material;
+
+inline constexpr uint32_t invalidLightId = std::numeric_limits<uint32_t>::max();
+
 struct EmissionSample
 {
-    glm::vec3 sample;
+    glm::vec3 sample; // direction towards the light
+    float distance;
+    float pdf; // solid angle pdf
+    glm::vec3 emission;
+    uint32_t lightId;
+};
+
+struct EmissiveTriangle
+{
+    std::array<glm::vec3, 3> points;
+    std::array<glm::vec2, 3> texCoords;
+    glm::vec3 normal;
+    float area;
+    bool doubleFaced;
+    const Material* material;
 };
 
+// exposes the emissive triangles of an object, in the order of the light ids the object reports on hit
 class EmissionProfile
 {
 public:
-    virtual std::optional<EmissionSample> Sample(RNG& rng, const glm::vec3& orig, const glm::vec3& pNorm) const = 0;
-    virtual float GetPdf(const glm::vec3& orig, const glm::vec3& dir) const = 0;
+    virtual uint32_t GetTriangleCount() const = 0;
+    virtual EmissiveTriangle GetTriangle(uint32_t index) const = 0;
+    virtual ~EmissionProfile() {}
 };
 
 }
\ No newline at end of file
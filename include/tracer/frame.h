@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+namespace tracer
+{
+
+// orthonormal basis around a surface normal, built once per hit
+// local space is y-up like the sample generators: x is the tangent, y the normal and z the bitangent
+struct Frame
+{
+    glm::vec3 tangent;
+    glm::vec3 normal;
+    glm::vec3 bitangent;
+
+    Frame() = default;
+    // branchless construction from a unit normal (duff et al. 2017, "building an orthonormal basis, revisited")
+    explicit Frame(const glm::vec3& normal) : normal(normal)
+    {
+        using namespace glm;
+
+        float sign = std::copysign(1.0f, normal.z);
+        float a = -1.0f / (sign + normal.z);
+        float b = normal.x * normal.y * a;
+        bitangent = vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+        tangent = vec3(b, sign + normal.y * normal.y * a, -normal.y);
+    }
+    // the basis is orthonormal, so its inverse is its transpose
+    glm::vec3 ToLocal(const glm::vec3& v) const
+    {
+        return glm::vec3(glm::dot(v, tangent), glm::dot(v, normal), glm::dot(v, bitangent));
+    }
+    glm::vec3 ToWorld(const glm::vec3& v) const
+    {
+        return tangent * v.x + normal * v.y + bitangent * v.z;
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tracer
+{
+
+// layers the tracer writes, depth and sample count have one channel, the others three
+inline constexpr std::string_view beautyLayerName = "beauty";
+inline constexpr std::string_view albedoLayerName = "albedo";
+inline constexpr std::string_view normalLayerName = "normal";
+inline constexpr std::string_view emissionLayerName = "emission";
+inline constexpr std::string_view depthLayerName = "depth";
+inline constexpr std::string_view sampleCountLayerName = "sample-count";
+inline constexpr std::string_view denoisedLayerName = "denoised";
+
+// unclamped float image made of named layers (aovs), every layer stores its channels interleaved, row major from the top
+class Framebuffer
+{
+public:
+    struct Layer
+    {
+        std::string name;
+        uint32_t channelCount;
+        std::vector<float> data;
+    };
+
+    Framebuffer() = default;
+    Framebuffer(uint32_t width, uint32_t height)
+    {
+        SetSize(width, height);
+    }
+    // drops every layer
+    void SetSize(uint32_t width, uint32_t height)
+    {
+        this->width = width;
+        this->height = height;
+        layers.clear();
+    }
+    // adds a zeroed layer, or zeroes the layer of that name if it exists with the same channel count
+    std::span<float> AddLayer(std::string_view name, uint32_t channelCount);
+    bool HasLayer(std::string_view name) const { return findLayer(name) != nullptr; }
+    std::span<float> GetLayer(std::string_view name);
+    std::span<const float> GetLayer(std::string_view name) const;
+    uint32_t GetLayerChannelCount(std::string_view name) const;
+    std::span<const Layer> GetLayers() const { return layers; }
+    uint32_t GetWidth() const { return width; }
+    uint32_t GetHeight() const { return height; }
+    // portable float map of a single layer with one or three channels
+    void SaveToPFM(std::string_view file, std::string_view layer = beautyLayerName) const;
+    // uncompressed openexr scanline image holding every layer as 32-bit float channels, beauty as R, G, B,
+    // the other layers prefixed with their name (albedo.R, normal.X, ...) and single channel layers under their name
+    void SaveToEXR(std::string_view file) const;
+private:
+    const Layer* findLayer(std::string_view name) const;
+
+    uint32_t width = 0, height = 0;
+    std::vector<Layer> layers;
+};
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "emission_profile.h"
+#include "light_tree.h"
+#include "sampler.h"
+
+namespace tracer
+{
+
+// vose's alias method, draws an index in proportion to its weight in constant time
+class AliasTable
+{
+public:
+    AliasTable() = default;
+    AliasTable(std::span<const float> weights);
+    uint32_t Sample(float u, float& pmf) const;
+    float GetPmf(uint32_t index) const
+    {
+        return pmfs.at(index);
+    }
+    uint32_t GetSize() const
+    {
+        return static_cast<uint32_t>(pmfs.size());
+    }
+private:
+    struct Bin
+    {
+        float threshold;
+        uint32_t alias;
+    };
+    std::vector<Bin> bins;
+    std::vector<float> pmfs;
+};
+
+enum class LightSelection
+{
+    Power, // in proportion to area * emission, independent of the shading point
+    Tree // by the contribution estimated from the light tree at the shading point
+};
+
+// picks emissive triangles for next event estimation
+// a light id is the index of a triangle in the concatenation of all the profiles passed to Build
+class LightSampler
+{
+public:
+    void Build(std::span<const std::unique_ptr<EmissionProfile>> profiles);
+    bool IsEmpty() const
+    {
+        return triangles.empty();
+    }
+    const EmissiveTriangle& GetTriangle(uint32_t lightId) const
+    {
+        return triangles.at(lightId);
+    }
+    // samples a point on a light as seen from orig on a surface facing normal, returns false if nothing was found
+    bool Sample(Sampler& sampler, LightSelection selection, const glm::vec3& orig, const glm::vec3& normal, EmissionSample& emissionSample) const;
+    // solid angle pdf of Sample having picked the point at distance along dir on the given light
+    float GetPdf(LightSelection selection, uint32_t lightId, const glm::vec3& orig, const glm::vec3& normal, const glm::vec3& dir, float distance) const;
+private:
+    float getPmf(LightSelection selection, uint32_t lightId, const glm::vec3& orig, const glm::vec3& normal) const;
+
+    std::vector<EmissiveTriangle> triangles;
+    AliasTable aliasTable;
+    LightTree lightTree;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "aabb.h"
+#include "emission_profile.h"
+
+namespace tracer
+{
+
+// bounds the normals of a set of emitters, every normal is within acos(cosThetaO) of axis
+// and every emitter radiates up to acos(cosThetaE) away from its own normal
+struct LightCone
+{
+    glm::vec3 axis;
+    float cosThetaO;
+    float cosThetaE;
+};
+
+// bounding volume hierarchy over the emissive triangles with orientation cones
+// (estevez & kulla 2018, "importance sampling of many lights with adaptive tree splitting"),
+// traversed stochastically by the estimated contribution of each subtree to a shading point
+class LightTree
+{
+public:
+    void Build(std::span<const EmissiveTriangle> triangles, std::span<const float> powers);
+    bool IsEmpty() const
+    {
+        return nodes.empty();
+    }
+    // picks a light with the first random number, returns invalidLightId if nothing can contribute
+    uint32_t Sample(float u, const glm::vec3& point, const glm::vec3& normal, float& pmf) const;
+    // probability of Sample picking lightId at the shading point
+    float GetPmf(uint32_t lightId, const glm::vec3& point, const glm::vec3& normal) const;
+private:
+    struct Node
+    {
+        AABB bounds;
+        LightCone cone;
+        float power;
+        bool doubleFaced;
+        bool isLeaf;
+        uint32_t index; // light id for a leaf, second child for an interior node (the first one follows it)
+    };
+    struct BuildItem
+    {
+        uint32_t lightId;
+        AABB bounds;
+        LightCone cone;
+        float power;
+        bool doubleFaced;
+    };
+
+    uint32_t build(std::span<BuildItem> items, uint64_t bitTrail, uint32_t depth);
+    static float calcImportance(const Node& node, const glm::vec3& point, const glm::vec3& normal);
+
+    std::vector<Node> nodes;
+    std::vector<uint64_t> bitTrails; // path from the root to each light's leaf, one bit per level, lowest bit first
+};
+
+}
\ No newline at end of file
@@ -1,30 +1,92 @@
 #pragma once
 
-#include <functional>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <optional>
+#include <variant>
 
 #include <glm/glm.hpp>
 
-#include "rng.h"
+#include "frame.h"
 #include "sampler.h"
 #include "texture.h"
 
 namespace tracer
 {
 
+inline constexpr uint16_t invalidMaterialId = std::numeric_limits<uint16_t>::max();
+
+// plain copies of the built-in materials, see MaterialRecord
+struct SimpleDiffuseRecord
+{
+    TextureRecord albedo;
+};
+
+struct SimpleMirrorRecord
+{
+};
+
+struct SpecularCoatedRecord
+{
+    TextureRecord albedo;
+    TextureRecord alpha;
+    float ior;
+};
+
+struct PerfectSpecularCoatedRecord
+{
+    TextureRecord albedo;
+    float ior;
+};
+
+struct SimpleEmissiveRecord
+{
+    TextureRecord emissivity;
+    float multiplier;
+};
+
+struct ExposedMediumRecord
+{
+    float mediumIor;
+};
+
+// closed set of the built-in materials, kept by value in a mesh's material table and shaded with a switch
+// the alternatives are in the order of MaterialType
+using MaterialRecord = std::variant<
+    SimpleDiffuseRecord,
+    SimpleMirrorRecord,
+    SpecularCoatedRecord,
+    PerfectSpecularCoatedRecord,
+    SimpleEmissiveRecord,
+    ExposedMediumRecord>;
+
+enum class MaterialType : uint8_t
+{
+    SimpleDiffuse, SimpleMirror, SpecularCoated, PerfectSpecularCoated, SimpleEmissive, ExposedMedium
+};
+
+static_assert(std::variant_size_v<MaterialRecord> == static_cast<size_t>(MaterialType::ExposedMedium) + 1);
+
 class Material
 {
 public:
-    virtual bool Shade(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& wi, glm::vec3& attenuation, float& currentIor, bool& isInside) const = 0;
+    // samples the next direction wi and scales the attenuation by its weight
+    // pdf is the probability density of wi, or zero if wi was picked from a perfectly specular lobe
+    virtual bool Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const = 0;
+    // evaluates the non-specular part of the brdf and the pdf Shade would have sampled wi with, used for light sampling
+    // returns false if the material has no such part
+    virtual bool Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const { return false; }
     virtual glm::vec3 GetEmissivity(const std::optional<glm::vec2>& texCoords) const { return glm::vec3(0.0f); }
     virtual bool IsEmissive() const { return false; }
+    // materials without a record (or with a texture that has none) can only be shaded through the virtual interface
+    virtual std::optional<MaterialRecord> GetRecord() const { return std::nullopt; }
     virtual ~Material() {}
 };
 
 class DebugMaterial : public Material
 {
-    virtual bool Shade(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& wi, glm::vec3& attenuation, float& currentIor, bool& isInside) const override
+    virtual bool Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const override
     {
         return false;
     }
@@ -34,16 +96,19 @@ class DebugMaterial : public Material
 class ReflectiveMaterial : public Material
 {
 public:
-    virtual bool Shade(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& wi, glm::vec3& attenuation, float& currentIor, bool& isInside) const override;
+    virtual bool Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const override;
 protected:
-    virtual void SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const = 0;
+    // samples the local direction sample in the frame of the hit, wo is the local direction towards the viewer; false when
+    // the sample has no contribution (below the surface) and the path ends
+    virtual bool SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const = 0;
 };
 
 class ExposedMediumMaterial : public Material
 {
 public:
     ExposedMediumMaterial(float mediumIor) : mediumIor(mediumIor) {}
-    virtual bool Shade(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& wi, glm::vec3& attenuation, float& currentIor, bool& isInside) const override;
+    virtual bool Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const override;
+    virtual std::optional<MaterialRecord> GetRecord() const override;
 private:
     float mediumIor;
 };
@@ -57,7 +122,9 @@ public:
     }
     SimpleDiffuseMaterial(const glm::vec3& albedo) : SimpleDiffuseMaterial(std::make_shared<SimpleGradientTexture>(albedo))
     {}
-    virtual void SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const override;
+    virtual bool SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const override;
+    virtual bool Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const override;
+    virtual std::optional<MaterialRecord> GetRecord() const override;
 private:
     std::shared_ptr<Texture> texture;
 };
@@ -72,21 +139,23 @@ public:
     SimpleEmissiveMaterial(const glm::vec3& albedo, const glm::vec3& emissivity)
         : texture(std::make_shared<SimpleGradientTexture>(emissivity))
     {}
-    virtual bool Shade(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& wi, glm::vec3& attenuation, float& currentIor, bool& isInside) const override
+    virtual bool Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const override
     {
         return false;
     }
     virtual glm::vec3 GetEmissivity(const std::optional<glm::vec2>& texCoords) const override { return multiplier * texture->SampleOptional(texCoords); }
     virtual bool IsEmissive() const override { return true; }
+    virtual std::optional<MaterialRecord> GetRecord() const override;
 private:
     std::shared_ptr<Texture> texture;
-    float multiplier;
+    float multiplier = 1.0f;
 };
 
 class SimpleMirrorMaterial : public ReflectiveMaterial
 {
 public:
-    virtual void SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const override;
+    virtual bool SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const override;
+    virtual std::optional<MaterialRecord> GetRecord() const override;
 };
 
 class SpecularCoatedMaterial : public ReflectiveMaterial
@@ -98,7 +167,9 @@ public:
     SpecularCoatedMaterial(const glm::vec3& albedo, float alpha, float ior)
         : albedoTexture(std::make_shared<SimpleGradientTexture>(albedo)), alphaTexture(std::make_shared<SimpleGradientTexture>(glm::vec3(alpha))), ior(ior)
     {}
-    virtual void SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const override;
+    virtual bool SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const override;
+    virtual bool Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const override;
+    virtual std::optional<MaterialRecord> GetRecord() const override;
 private:
     std::shared_ptr<Texture> albedoTexture;
     std::shared_ptr<Texture> alphaTexture;
@@ -112,7 +183,9 @@ public:
         : albedoTexture(albedo), ior(ior) {}
     PerfectSpecularCoatedMaterial(const glm::vec3& albedo, float ior)
         : albedoTexture(std::make_shared<SimpleGradientTexture>(albedo)), ior{ior} {}
-    virtual void SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const override;
+    virtual bool SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const override;
+    virtual bool Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const override;
+    virtual std::optional<MaterialRecord> GetRecord() const override;
 private:
     std::shared_ptr<Texture> albedoTexture;
     float ior;
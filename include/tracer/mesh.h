@@ -26,6 +26,8 @@ struct Triad
 {
     std::array<Vertex, 3> vertices;
     const Material* material;
+    uint32_t lightIndex = invalidLightId; // index among the emissive triads of the mesh
+    uint16_t materialId = invalidMaterialId; // index into the material table of the mesh
 };
 
 struct TriadBoxFunc
@@ -40,7 +42,7 @@ struct TriadBoxFunc
 
 struct LightInfo
 {
-    std::unique_ptr<std::array<glm::vec3, 3>[]> triads;
+    std::unique_ptr<Triad[]> triads;
     uint32_t nTriads;
 };
 
@@ -52,34 +54,24 @@ enum class CullMode // front = clockwise, back = counter-clockwise
 class Mesh : public BoundedObject
 {
 public:
-    static std::unique_ptr<Mesh> Create(const void* jsonObj, const glm::mat4& transformation = {});
+    // with shareTextures the image textures come from ImageTexture::LoadShared
+    static std::unique_ptr<Mesh> Create(const void* jsonObj, const glm::mat4& transformation = {}, bool shareTextures = false);
     static std::unique_ptr<Mesh> Create(std::string_view path, const glm::mat4& transformation = {});
     static std::unique_ptr<Mesh> Create(const char* path, const glm::mat4& transformation = {})
     {
         return Create(std::string_view(path), transformation);
     }
+    // the mesh of the file, shared with everyone who loaded a file of the same content referencing images of the same
+    // content with the same transformation while it is in use; the images it references are shared the same way
+    static std::shared_ptr<const Mesh> CreateShared(std::string_view path, const glm::mat4& transformation);
     AABB GetBox() const override
     {
         return accelStruct.GetBox();
     }
-    void Transform(const glm::mat4& matrix)
-    {
-        for (Triad& triad : triads)
-            for (Vertex& vertex : triad.vertices)
-            {
-                glm::vec4 v = matrix * glm::vec4(vertex.pos, 1.0f);
-                vertex.pos = glm::vec3(v);
-            }
-        accelStruct.Build(triads);
-        for (LightInfo& lightInfo : lightInfos)
-            for (uint32_t i = 0; i < lightInfo.nTriads; i++)
-                for (uint32_t j = 0; j < 3; j++)
-                {
-                    glm::vec4 v = matrix * glm::vec4(lightInfo.triads[i][j], 1.0f);
-                    lightInfo.triads[i][j] = glm::vec3(v);
-                }
-    }
+    void Transform(const glm::mat4& matrix);
     virtual std::optional<float> Intersect(const glm::vec3& orig, const glm::vec3& dir, SurfaceData& surfaceData) const override;
+    virtual uint32_t IntersectPacket(const RayPacket& packet, uint32_t laneMask, std::array<float, rayPacketSize>& tMax, std::array<SurfaceData, rayPacketSize>& surfaceData) const override;
+    virtual bool Occluded(const glm::vec3& orig, const glm::vec3& dir, float maxDistance) const override;
     virtual void GetEmissionProfiles(std::back_insert_iterator<std::vector<std::unique_ptr<EmissionProfile>>> profilesInserter) const override;
 private:
     enum class PrimitiveType
@@ -90,6 +82,7 @@ private:
     Mesh() {}
 
     std::vector<std::unique_ptr<Material>> materialHolder;
+    std::vector<MaterialRecord> materialTable;
     std::vector<Triad> triads;
     BVH<Triad, TriadBoxFunc> accelStruct;
     CullMode cullMode;
@@ -1,14 +1,17 @@
 #pragma once
 
+#include <array>
 #include <memory>
 #include <optional>
 #include <unordered_map>
+#include <utility>
 
 #include <glm/glm.hpp>
 
 #include "aabb.h"
 #include "emission_profile.h"
 #include "material.h"
+#include "ray_packet.h"
 
 namespace tracer
 {
@@ -32,6 +35,8 @@ struct SurfaceData
     glm::vec3 normal;
     std::optional<glm::vec2> texCoords;
     const Material* material;
+    const MaterialRecord* materialRecord = nullptr; // entry of the material table, if the material has a record
+    uint32_t lightId = invalidLightId; // index into the scene's light sampler if the surface is an emissive triangle
 };
 
 class Object
@@ -58,11 +63,42 @@ public:
     //     return nullptr;
     // }
     virtual std::optional<float> Intersect(const glm::vec3& orig, const glm::vec3& dir, SurfaceData& surfaceData) const = 0;
+    // closest hits of the lanes in laneMask that lie before their tMax, tMax and surfaceData are updated for the lanes hit
+    // returns the lanes hit, the default tests the lanes one by one
+    virtual uint32_t IntersectPacket(const RayPacket& packet, uint32_t laneMask, std::array<float, rayPacketSize>& tMax, std::array<SurfaceData, rayPacketSize>& surfaceData) const
+    {
+        uint32_t hitMask = 0u;
+        for (uint32_t i = 0; i < rayPacketSize; i++)
+        {
+            if (!(laneMask & (1u << i)))
+                continue;
+            SurfaceData data;
+            std::optional<float> t = Intersect(packet.GetOrigin(i), packet.GetDirection(i), data);
+            if (!t || t.value() < 0.0f || t.value() >= tMax[i])
+                continue;
+            tMax[i] = t.value();
+            surfaceData[i] = data;
+            hitMask |= 1u << i;
+        }
+        return hitMask;
+    }
+    // whether the ray hits the object closer than maxDistance, without computing the surface data; the default finds the
+    // closest hit
+    virtual bool Occluded(const glm::vec3& orig, const glm::vec3& dir, float maxDistance) const
+    {
+        SurfaceData data;
+        std::optional<float> t = Intersect(orig, dir, data);
+        return t && t.value() >= 0.0f && t.value() < maxDistance;
+    }
     virtual void GetEmissionProfiles(std::back_insert_iterator<std::vector<std::unique_ptr<EmissionProfile>>> profilesInserter) const
     {
     }
+    // light ids reported on hit are offset by this, so they are unique across the scene
+    uint32_t GetLightIdOffset() const { return lightIdOffset; }
+    void SetLightIdOffset(uint32_t offset) { lightIdOffset = offset; }
     virtual ~Object() {}
 private:
+    uint32_t lightIdOffset{};
     // using void_unique_ptr = std::unique_ptr<void, void(*)(const void*)>;
     // std::unordered_map<AttributeType, void_unique_ptr> attributes;
 };
@@ -73,6 +109,34 @@ public:
     virtual AABB GetBox() const = 0;
 };
 
+// an object shared by several scenes (see Mesh::CreateShared), placed in a scene through an instance of its own
+// since the light ids of the object's emissive triangles depend on the scene, the shared object reports them from zero
+// an instance also moves its object without touching the object's geometry or bvh: rays are taken into the object's space
+class ObjectInstance : public BoundedObject
+{
+public:
+    explicit ObjectInstance(std::shared_ptr<const BoundedObject> object) : object(std::move(object))
+    {}
+    std::optional<float> Intersect(const glm::vec3& orig, const glm::vec3& dir, SurfaceData& surfaceData) const override;
+    uint32_t IntersectPacket(const RayPacket& packet, uint32_t laneMask, std::array<float, rayPacketSize>& tMax, std::array<SurfaceData, rayPacketSize>& surfaceData) const override;
+    bool Occluded(const glm::vec3& orig, const glm::vec3& dir, float maxDistance) const override;
+    void GetEmissionProfiles(std::back_insert_iterator<std::vector<std::unique_ptr<EmissionProfile>>> profilesInserter) const override;
+    AABB GetBox() const override
+    {
+        return isTransformed ? box : object->GetBox();
+    }
+    // applied on top of the object's own placement, the identity by default
+    void SetTransformation(const glm::mat4& transformation);
+    const glm::mat4& GetTransformation() const { return toWorld; }
+private:
+    std::shared_ptr<const BoundedObject> object;
+    bool isTransformed = false;
+    glm::mat4 toWorld{1.0f};
+    glm::mat4 toObject{1.0f};
+    glm::mat3 normalToWorld{1.0f};
+    AABB box;
+};
+
 class SimpleMaterialObject : virtual public Object
 {
 public:
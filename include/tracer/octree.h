@@ -57,6 +57,47 @@ public:
             },
             &callable);
     }
+    // the extents of the children of a node that is split, in the order of the children
+    static std::array<AABB, 8> SplitExtent(const AABB& box)
+    {
+        std::array<AABB, 8> octants;
+        glm::vec3 center = box.GetCenter();
+        glm::vec3 min = box.GetMin();
+        glm::vec3 max = box.GetMax();
+        {
+            glm::vec3 p = glm::vec3(min.x, min.y, min.z);
+            octants.at(0) = AABB(center, p);
+        }
+        {
+            glm::vec3 p = glm::vec3(max.x, min.y, min.z);
+            octants.at(1) = AABB(center, p);
+        }
+        {
+            glm::vec3 p = glm::vec3(max.x, min.y, max.z);
+            octants.at(2) = AABB(center, p);
+        }
+        {
+            glm::vec3 p = glm::vec3(min.x, min.y, max.z);
+            octants.at(3) = AABB(center, p);
+        }
+        {
+            glm::vec3 p = glm::vec3(min.x, max.y, max.z);
+            octants.at(4) = AABB(center, p);
+        }
+        {
+            glm::vec3 p = glm::vec3(max.x, max.y, max.z);
+            octants.at(5) = AABB(center, p);
+        }
+        {
+            glm::vec3 p = glm::vec3(max.x, max.y, min.z);
+            octants.at(6) = AABB(center, p);
+        }
+        {
+            glm::vec3 p = glm::vec3(min.x, max.y, min.z);
+            octants.at(7) = AABB(center, p);
+        }
+        return octants;
+    }
     Node* GetTopNode() { return &topNode; }
     const Node* GetTopNode() const { return &topNode; }
 private:
@@ -115,42 +156,9 @@ private:
     void splitNode(Node* node)
     {
         node->childNodes = std::make_unique<std::array<Node, 8>>();
-        const AABB& box = node->extent;
-        glm::vec3 center = box.GetCenter();
-        glm::vec3 min = box.GetMin();
-        glm::vec3 max = box.GetMax();
-        {
-            glm::vec3 p = glm::vec3(min.x, min.y, min.z);
-            node->childNodes->at(0).extent = AABB(center, p);
-        }
-        {
-            glm::vec3 p = glm::vec3(max.x, min.y, min.z);
-            node->childNodes->at(1).extent = AABB(center, p);
-        }
-        {
-            glm::vec3 p = glm::vec3(max.x, min.y, max.z);
-            node->childNodes->at(2).extent = AABB(center, p);
-        }
-        {
-            glm::vec3 p = glm::vec3(min.x, min.y, max.z);
-            node->childNodes->at(3).extent = AABB(center, p);
-        }
-        {
-            glm::vec3 p = glm::vec3(min.x, max.y, max.z);
-            node->childNodes->at(4).extent = AABB(center, p);
-        }
-        {
-            glm::vec3 p = glm::vec3(max.x, max.y, max.z);
-            node->childNodes->at(5).extent = AABB(center, p);
-        }
-        {
-            glm::vec3 p = glm::vec3(max.x, max.y, min.z);
-            node->childNodes->at(6).extent = AABB(center, p);
-        }
-        {
-            glm::vec3 p = glm::vec3(min.x, max.y, min.z);
-            node->childNodes->at(7).extent = AABB(center, p);
-        }
+        std::array<AABB, 8> octants = SplitExtent(node->extent);
+        for (uint32_t i = 0; i < 8; i++)
+            node->childNodes->at(i).extent = octants[i];
     }
 
     void traverseNode(const Node* node, void(*func)(const T*, void*), void* userIn) const
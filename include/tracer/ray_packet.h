@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "aabb.h"
+
+namespace tracer
+{
+
+inline constexpr uint32_t rayPacketSize = 4u;
+inline constexpr uint32_t allLanes = (1u << rayPacketSize) - 1u;
+
+// rays traced together through the bvh, stored per component so that the box tests run across the lanes
+struct RayPacket
+{
+    std::array<float, rayPacketSize> origX, origY, origZ;
+    std::array<float, rayPacketSize> dirX, dirY, dirZ;
+    std::array<float, rayPacketSize> invDirX, invDirY, invDirZ;
+
+    void SetRay(uint32_t lane, const glm::vec3& orig, const glm::vec3& dir)
+    {
+        origX[lane] = orig.x;
+        origY[lane] = orig.y;
+        origZ[lane] = orig.z;
+        dirX[lane] = dir.x;
+        dirY[lane] = dir.y;
+        dirZ[lane] = dir.z;
+        invDirX[lane] = 1.0f / dir.x;
+        invDirY[lane] = 1.0f / dir.y;
+        invDirZ[lane] = 1.0f / dir.z;
+    }
+    glm::vec3 GetOrigin(uint32_t lane) const
+    {
+        return glm::vec3(origX[lane], origY[lane], origZ[lane]);
+    }
+    glm::vec3 GetDirection(uint32_t lane) const
+    {
+        return glm::vec3(dirX[lane], dirY[lane], dirZ[lane]);
+    }
+    // lanes whose directions differ in sign would want to visit the children in different orders,
+    // such packets are better traced one ray at a time
+    bool IsCoherent(uint32_t laneMask) const
+    {
+        uint32_t lane = static_cast<uint32_t>(std::countr_zero(laneMask));
+        for (uint32_t i = 0; i < rayPacketSize; i++)
+        {
+            if (!(laneMask & (1u << i)))
+                continue;
+            if (std::signbit(dirX[i]) != std::signbit(dirX[lane]) ||
+                std::signbit(dirY[i]) != std::signbit(dirY[lane]) ||
+                std::signbit(dirZ[i]) != std::signbit(dirZ[lane]))
+                return false;
+        }
+        return true;
+    }
+};
+
+// slab test of all lanes at once, returns the lanes of laneMask that enter the box before their tMax
+// tEntry receives the entry distance of every lane, zero when the origin is inside
+inline uint32_t intersectPacket(const AABB& box, const RayPacket& packet, uint32_t laneMask, const std::array<float, rayPacketSize>& tMax, std::array<float, rayPacketSize>& tEntry)
+{
+    glm::vec3 min = box.GetMin();
+    glm::vec3 max = box.GetMax();
+
+    // branchless so that the compiler can keep the lanes in one simd register
+    uint32_t hitMask = 0u;
+    for (uint32_t i = 0; i < rayPacketSize; i++)
+    {
+        float tx0 = (min.x - packet.origX[i]) * packet.invDirX[i];
+        float tx1 = (max.x - packet.origX[i]) * packet.invDirX[i];
+        float ty0 = (min.y - packet.origY[i]) * packet.invDirY[i];
+        float ty1 = (max.y - packet.origY[i]) * packet.invDirY[i];
+        float tz0 = (min.z - packet.origZ[i]) * packet.invDirZ[i];
+        float tz1 = (max.z - packet.origZ[i]) * packet.invDirZ[i];
+        float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+        float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax[i]));
+        tEntry[i] = tNear;
+        hitMask |= static_cast<uint32_t>(tNear <= tFar) << i;
+    }
+    return hitMask & laneMask;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <thread>
+
+#include "canvas.h"
+#include "scene.h"
+#include "tracer.h"
+
+namespace tracer
+{
+
+class CoreScheduler;
+template <typename T>
+class AssetCache;
+
+// keeps scenes loaded for many renders and runs the renders side by side on the shared thread pool; jobs of a higher
+// priority get the cores first, jobs of the same priority share them evenly, tile by tile (pass by pass outside the
+// default mode), so a job that starts or ends moves the cores of the others right away
+class RenderService
+{
+public:
+    // a render of the service, it owns what the render needs and waits for the render to end when destroyed
+    class Job
+    {
+    public:
+        // wait, cancel, progress and the partial framebuffer
+        RenderJob& GetHandle() { return *handle; }
+        // the result once the render has ended
+        const Tracer& GetTracer() const { return tracer; }
+        const Canvas& GetCanvas() const { return canvas; }
+    private:
+        friend class RenderService;
+        Job(std::shared_ptr<const Scene> scene, const TracerConfiguration& config) : scene(std::move(scene)), tracer(config)
+        {}
+
+        std::shared_ptr<const Scene> scene;
+        Tracer tracer;
+        Canvas canvas;
+        std::unique_ptr<RenderJob> handle; // ends the render before the rest goes
+    };
+
+    // nCores is the number of workers that render at the same time over all jobs
+    explicit RenderService(uint32_t nCores = std::max(std::thread::hardware_concurrency(), 1u));
+    ~RenderService();
+    // the scene of the file, loaded once for every file of the same content whose meshes and images have the same content
+    // and kept while a job or the caller uses it; the meshes and images are shared even between different scenes
+    std::shared_ptr<const Scene> LoadScene(std::string_view path);
+    // starts rendering scene with config right away, with as many workers as the service has cores (nThreads of the
+    // configuration is replaced) that only render while the job's priority and share allow it
+    std::unique_ptr<Job> Submit(std::shared_ptr<const Scene> scene, TracerConfiguration config, int32_t priority = 0);
+private:
+    uint32_t nCores;
+    std::shared_ptr<CoreScheduler> scheduler;
+    std::unique_ptr<AssetCache<const Scene>> sceneCache;
+};
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <random>
 
 namespace tracer
@@ -9,6 +10,11 @@ class RNG
 {
 public:
     RNG() = default;
+    RNG(uint32_t seed) : gen(seed) {}
+    void Seed(uint32_t seed)
+    {
+        gen.seed(seed);
+    }
     float Uniform(float lower = 0.0f, float upper = 1.0f)
     {
         std::uniform_real_distribution distr(lower, upper);
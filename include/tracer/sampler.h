@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 
 #include <glm/glm.hpp>
@@ -10,16 +11,64 @@
 namespace tracer
 {
 
-glm::vec3 transformLocalSampleToWorld(const glm::vec3& normal, const glm::vec3& sample);
+// source of the random numbers consumed by a single path
+// every (pixel, sample index) pair owns its own stream, and each call draws the next dimension of it;
+// the samplers count sample indices from firstSample, so renders that start at different samples take disjoint samples
+class Sampler
+{
+public:
+    virtual void StartPixelSample(const glm::u32vec2& pixel, uint32_t sampleIndex) = 0;
+    virtual float Get1D() = 0;
+    virtual glm::vec2 Get2D() = 0;
+    virtual ~Sampler() {}
+};
+
+// plain monte carlo, every dimension is an independent uniform number
+class IndependentSampler : public Sampler
+{
+public:
+    IndependentSampler(uint32_t seed = 0u, uint32_t firstSample = 0u) : seed(seed), firstSample(firstSample) {}
+    void StartPixelSample(const glm::u32vec2& pixel, uint32_t sampleIndex) override;
+    float Get1D() override
+    {
+        return rng.Uniform();
+    }
+    glm::vec2 Get2D() override
+    {
+        float r1 = rng.Uniform();
+        float r2 = rng.Uniform();
+        return glm::vec2(r1, r2);
+    }
+private:
+    uint32_t seed;
+    uint32_t firstSample;
+    RNG rng;
+};
 
-glm::vec3 transformWorldSampleToLocal(const glm::vec3& normal, const glm::vec3& sample);
+// owen-scrambled sobol (0,2)-sequence, padded to higher dimensions by shuffling the sample index per dimension
+// (burley 2020, "practical hash-based owen scrambling")
+class SobolSampler : public Sampler
+{
+public:
+    SobolSampler(uint32_t seed = 0u, uint32_t firstSample = 0u) : seed(seed), firstSample(firstSample) {}
+    void StartPixelSample(const glm::u32vec2& pixel, uint32_t sampleIndex) override;
+    float Get1D() override;
+    glm::vec2 Get2D() override;
+private:
+    uint32_t seed;
+    uint32_t firstSample;
+    uint32_t pixelSeed{};
+    uint32_t sampleIndex{};
+    uint32_t dimension{};
+};
 
-inline void generateUniform(RNG& rng, glm::vec3& sample, float& pdf)
+inline void generateUniform(Sampler& sampler, glm::vec3& sample, float& pdf)
 {
     using namespace glm;
 
-    float r1 = rng.Uniform();
-    float r2 = rng.Uniform();
+    vec2 u = sampler.Get2D();
+    float r1 = u.x;
+    float r2 = u.y;
 
     float sinTheta = sqrt(1.0f - r1 * r1);
     float phi = 2.0f * r2 * pi<float>();
@@ -31,12 +80,13 @@ inline void generateUniform(RNG& rng, glm::vec3& sample, float& pdf)
     pdf = 1.0f / (2.0f * pi<float>());
 }
 
-inline void generateCosine(RNG& rng, glm::vec3& sample, float& pdf)
+inline void generateCosine(Sampler& sampler, glm::vec3& sample, float& pdf)
 {
     using namespace glm;
 
-    float r1 = rng.Uniform();
-    float r2 = rng.Uniform();
+    vec2 u = sampler.Get2D();
+    float r1 = u.x;
+    float r2 = u.y;
 
     float cosTheta = sqrt(1.0f - r1);
     float sinTheta = sqrt(r1);
@@ -54,9 +104,75 @@ inline float getCosinePdf(const glm::vec3& sample)
     return sample.y / glm::pi<float>();
 }
 
-inline void generateGgx(RNG& rng, glm::vec3& sample, float& pdf)
+// ggx normal distribution, cosThetaH is the cosine between the normal and the microfacet normal
+inline float ggxD(float alpha, float cosThetaH)
+{
+    using namespace glm;
+
+    if (cosThetaH <= 0.0f)
+        return 0.0f;
+
+    float alpha2 = alpha * alpha;
+    float in = cosThetaH * cosThetaH * (alpha2 - 1.0f) + 1.0f;
+    return alpha2 / (pi<float>() * in * in);
+}
+
+// smith masking term of ggx for a single direction
+inline float ggxG1(float alpha, float cosTheta)
+{
+    using namespace glm;
+
+    float cos2 = cosTheta * cosTheta;
+    return 2.0f / (1.0f + sqrt(1.0f + alpha * alpha * ((1.0f - cos2) / cos2)));
+}
+
+// pdf of generateGgx, both directions in local space
+inline float getGgxPdf(const glm::vec3& wo, const glm::vec3& wi, float alpha)
 {
-    
+    using namespace glm;
+
+    if (wo.y <= 0.0f || wi.y <= 0.0f)
+        return 0.0f;
+
+    vec3 half = normalize(wo + wi);
+    return ggxG1(alpha, wo.y) * ggxD(alpha, half.y) / (4.0f * wo.y);
+}
+
+// samples a microfacet normal from the distribution of normals visible from wo (heitz 2018) and reflects wo about it
+// wo is the local direction towards the viewer, and has to be in the upper hemisphere
+inline void generateGgx(Sampler& sampler, const glm::vec3& wo, float alpha, glm::vec3& sample, float& pdf)
+{
+    using namespace glm;
+
+    vec2 u = sampler.Get2D();
+
+    // z-up as in the paper
+    vec3 v(wo.x, wo.z, wo.y);
+
+    // stretch the view direction so that the microsurface becomes a hemisphere
+    vec3 vh = normalize(vec3(alpha * v.x, alpha * v.y, v.z));
+
+    float lenSq = vh.x * vh.x + vh.y * vh.y;
+    vec3 t1 = lenSq > 0.0f ?
+        vec3(-vh.y, vh.x, 0.0f) / sqrt(lenSq) :
+        vec3(1.0f, 0.0f, 0.0f);
+    vec3 t2 = cross(vh, t1);
+
+    // uniform point on the disk, squashed onto the part of it that is visible from vh
+    float r = sqrt(u.x);
+    float phi = 2.0f * pi<float>() * u.y;
+    float p1 = r * cos(phi);
+    float p2 = r * sin(phi);
+    float s = 0.5f * (1.0f + vh.z);
+    p2 = (1.0f - s) * sqrt(1.0f - p1 * p1) + s * p2;
+
+    // project back onto the hemisphere and unstretch
+    vec3 nh = p1 * t1 + p2 * t2 + sqrt(max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * vh;
+    vec3 ne = normalize(vec3(alpha * nh.x, alpha * nh.y, max(0.0f, nh.z)));
+
+    vec3 half(ne.x, ne.z, ne.y);
+    sample = reflect(-wo, half);
+    pdf = getGgxPdf(wo, sample, alpha);
 }
 
 }
\ No newline at end of file
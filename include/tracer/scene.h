@@ -1,16 +1,21 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <memory>
 #include <ranges>
+#include <span>
 #include <string_view>
 #include <vector>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #include "bvh.h"
 #include "camera.h"
+#include "light_sampler.h"
 #include "object.h"
+#include "ray_packet.h"
 
 namespace tracer
 {
@@ -32,10 +37,47 @@ struct ObjectPtrBoxFunc
     }
 };
 
+// places an object of the scene (by its index in GetObjects) relative to where the scene file put it
+struct ObjectTransformation
+{
+    uint32_t object;
+    glm::mat4 transformation{1.0f};
+};
+
+struct CameraKeyframe
+{
+    float time;
+    Camera camera;
+};
+
+// the transformation of the object at time, scale first, then rotation, then translation, all about the origin
+struct ObjectKeyframe
+{
+    uint32_t object;
+    float time;
+    glm::vec3 translation{0.0f};
+    glm::quat rotation{1.0f, 0.0f, 0.0f, 0.0f};
+    glm::vec3 scale{1.0f};
+};
+
+// keys in order of time; between two keys the camera position, lens, translation and scale are interpolated linearly,
+// the camera direction and rotation spherically (keys of a direction have to be less than half a turn apart),
+// before the first and after the last key the values of that key hold; the camera and objects without keys stay put
+struct Animation
+{
+    std::vector<CameraKeyframe> cameraKeys;
+    std::vector<ObjectKeyframe> objectKeys;
+};
+
 class Scene
 {
 public:
+    // meshes loaded from files and image textures are shared with the other scenes of the process that use files of the same
+    // content (see Mesh::CreateShared)
     static std::unique_ptr<Scene> Create(std::string_view path);
+    // one copy of the scene per numa node, each loaded by a thread pinned to its node so that the geometry and bvhs
+    // land in the node's memory (first touch); a single copy on machines with one node, the replicas share nothing
+    static std::vector<std::unique_ptr<Scene>> CreateNodeReplicas(std::string_view path);
     auto GetObjects() const
     {
         return objects | std::views::transform([](const std::unique_ptr<Object>& ptr) -> const Object*
@@ -44,16 +86,33 @@ public:
         });
     }
     Camera GetCamera() const { return camera; }
+    void SetCamera(const Camera& camera) { this->camera = camera; }
+    // moves bounded objects (unbounded ones can't be moved) while keeping the bvhs: the objects' own bvhs stay as they are,
+    // the scene's bvh is refitted and only built anew once refitting has made it too loose, the lights are only rebuilt if
+    // an emissive object moved; not while the scene renders
+    void SetObjectTransformations(std::span<const ObjectTransformation> transformations);
+    // sets the camera and the transformations of the objects with keys to those of the animation at time
+    void Animate(const Animation& animation, float time);
     glm::vec3 GetAmbientColor() const { return ambientColor; }
+    const LightSampler& GetLights() const { return lights; }
     void Trace(const glm::vec3& orig, const glm::vec3& dir, HitResult& hitResult) const;
+    // traces a batch of rays as packets of rays pointing the same way, hitResults[i] receives the hit of origs[i], dirs[i]
+    void Trace(std::span<const glm::vec3> origs, std::span<const glm::vec3> dirs, std::span<HitResult> hitResults) const;
+    // traces the lanes of laneMask together, the rays should point roughly the same way (see RayPacket::IsCoherent)
+    void Trace(const RayPacket& packet, uint32_t laneMask, std::span<HitResult, rayPacketSize> hitResults) const;
+    // shadow ray test, true if anything is hit closer than maxDistance
+    bool Occluded(const glm::vec3& orig, const glm::vec3& dir, float maxDistance) const;
 private:
     Scene() {}
+    static std::unique_ptr<Scene> load(std::string_view path, bool loadObjectsInParallel, bool shareAssets);
     void buildAccel();
+    void buildLights();
     glm::vec3 ambientColor;
     Camera camera;
     std::vector<std::unique_ptr<Object>> objects;
     std::vector<const Object*> unboundedObjects;
     BVH<const BoundedObject*, ObjectPtrBoxFunc> bvh;
+    LightSampler lights;
 };
 
 }
\ No newline at end of file
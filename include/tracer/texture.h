@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string_view>
 
 #include <glm/glm.hpp>
@@ -9,6 +12,30 @@
 namespace tracer
 {
 
+class ImageTexture;
+
+// plain copy of a built-in texture, sampled with a switch instead of a virtual call
+struct TextureRecord
+{
+    enum class Type : uint8_t
+    {
+        Gradient, Image
+    };
+    Type type;
+    glm::vec3 topL, topR, botR, botL, avg; // gradient only
+    const ImageTexture* image; // image only, owned by the texture the record was made from
+    glm::vec3 Sample(const std::optional<glm::vec2>& uv) const;
+};
+
+// bilinear blend of the four corner colors
+inline glm::vec3 sampleGradient(const glm::vec3& topL, const glm::vec3& topR, const glm::vec3& botR, const glm::vec3& botL, const glm::vec2& uv)
+{
+    using namespace glm;
+    vec3 bot = uv.s * botR + (1.0f - uv.s) * botL;
+    vec3 top = uv.s * topR + (1.0f - uv.s) * topL;
+    return uv.t * top + (1.0f - uv.t) * bot;
+}
+
 class Texture
 {
 public:
@@ -23,10 +50,15 @@ public:
     {
         return glm::vec3(0.0f);
     }
+    // textures without a record can only be used through the virtual interface
+    virtual std::optional<TextureRecord> GetRecord() const
+    {
+        return std::nullopt;
+    }
     virtual ~Texture() {}
 };
 
-class SimpleGradientTexture : public Texture
+class SimpleGradientTexture final : public Texture
 {
 public:
     SimpleGradientTexture(const glm::vec3& color) : SimpleGradientTexture(color, color, color, color)
@@ -36,26 +68,47 @@ public:
     {}
     glm::vec3 Sample(const glm::vec2& uv) const override
     {
-        using namespace glm;
-        vec3 bot = uv.s * botR + (1.0f - uv.s) * botL;
-        vec3 top = uv.s * topR + (1.0f - uv.s) * topL;
-        return uv.t * top + (1.0f - uv.t) * bot;
+        return sampleGradient(topL, topR, botR, botL, uv);
     }
     glm::vec3 Fallback() const override
     {
         return avg;
     }
+    std::optional<TextureRecord> GetRecord() const override
+    {
+        return TextureRecord{TextureRecord::Type::Gradient, topL, topR, botR, botL, avg, nullptr};
+    }
 private:
     glm::vec3 topL, topR, botR, botL;
     glm::vec3 avg;
 };
 
-class ImageTexture : public Texture
+class ImageTexture final : public Texture
 {
 public:
     ImageTexture(std::string_view file);
-    glm::vec3 Sample(const glm::vec2& uv) const;
+    // decodes an image file read into memory
+    explicit ImageTexture(std::span<const uint8_t> encoded);
+    // the image of the file, shared with everyone who loaded a file of the same content while it is in use
+    static std::shared_ptr<ImageTexture> LoadShared(std::string_view file);
+    glm::vec3 Sample(const glm::vec2& uv) const override
+    {
+        uint32_t w = static_cast<uint32_t>(uv.x * width);
+        uint32_t h = static_cast<uint32_t>((1.0f - uv.y) * height);
+        w = std::clamp(w, 0u, width - 1);
+        h = std::clamp(h, 0u, height - 1);
+        return toFloats(load(w, h));
+    }
+    std::optional<TextureRecord> GetRecord() const override
+    {
+        TextureRecord record{};
+        record.type = TextureRecord::Type::Image;
+        record.image = this;
+        return record;
+    }
 private:
+    // takes over pixels decoded by stb_image
+    void setPixels(unsigned char* bytes, int width, int height);
     static glm::vec3 toFloats(const glm::u8vec3& bytes)
     {
         return glm::vec3(bytes) / 255.0f;
@@ -73,4 +126,16 @@ private:
     std::unique_ptr<glm::u8vec3[]> data;
 };
 
+inline glm::vec3 TextureRecord::Sample(const std::optional<glm::vec2>& uv) const
+{
+    switch (type)
+    {
+        case Type::Gradient:
+            return uv ? sampleGradient(topL, topR, botR, botL, uv.value()) : avg;
+        case Type::Image:
+            return uv ? image->Sample(uv.value()) : image->Fallback();
+    }
+    return glm::vec3(0.0f);
+}
+
 }
\ No newline at end of file
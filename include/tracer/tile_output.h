@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "framebuffer.h"
+
+namespace tracer
+{
+
+// receives the beauty image tile by tile while a render runs, see TracerConfiguration::tileOutputs
+// WriteTile is called concurrently from the render threads, Begin and End from the thread calling Render
+class TileOutput
+{
+public:
+    virtual void Begin(uint32_t width, uint32_t height) = 0;
+    // rgb holds size.x * size.y pixels of three floats, row major from the top of the tile
+    virtual void WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb) = 0;
+    // returns once everything is written
+    virtual void End() = 0;
+    virtual ~TileOutput() {}
+};
+
+// zip compressed openexr file written while the render runs, every block of 16 scanlines is compressed by the render
+// thread whose tile completes it and appended to the file, the offset table is filled in by End
+class ExrTileWriter : public TileOutput
+{
+public:
+    explicit ExrTileWriter(std::string_view path);
+    void Begin(uint32_t width, uint32_t height) override;
+    void WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb) override;
+    void End() override;
+private:
+    void compressAndAppend(uint32_t block);
+
+    std::string path;
+    uint32_t width = 0, height = 0;
+    std::mutex mutex;
+    std::vector<std::vector<float>> blockData; // rgb of the blocks still waiting for tiles, allocated by their first tile
+    std::vector<uint64_t> nBlockPixels; // pixels received per block
+    std::mutex fileMutex;
+    std::ofstream file;
+    uint64_t offsetTablePos = 0;
+    std::vector<uint64_t> blockOffsets;
+};
+
+// float rgb image on disk for renders too large for memory (see TracerConfiguration::outOfCore), every tile goes
+// straight to its place in the file and nothing but the tile being written is held in memory; the file is a
+// "TRTI" header (version, width, height, tile size as little endian uint32s) padded to headerSize bytes, followed by
+// the tiles of tileSize pixels in row major order, each a full square of row major rgb floats (edge tiles are padded)
+class TiledImageFile : public TileOutput
+{
+public:
+    static constexpr uint64_t headerSize = 64u;
+
+    explicit TiledImageFile(std::string_view path, uint32_t tileSize = 256u);
+    void Begin(uint32_t width, uint32_t height) override;
+    void WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb) override;
+    void End() override;
+    // copies the rgb of a rectangle of the file at path into rgb, row major
+    static void ReadRegion(std::string_view path, const glm::u32vec2& origin, const glm::u32vec2& size, std::span<float> rgb);
+private:
+    std::string path;
+    uint32_t tileSize;
+    uint32_t width = 0, height = 0;
+    std::mutex mutex;
+    std::fstream file;
+};
+
+// raw tiles for downstream consumers reading a pipe (or any stream opened by the caller, which stays open),
+// a "TRTS" header with the image width and height as little endian uint32s, then every tile as its origin and size
+// (four uint32s) followed by its rgb floats, and a final tile of size zero
+class TileStreamWriter : public TileOutput
+{
+public:
+    explicit TileStreamWriter(std::FILE* stream) : stream(stream) {}
+    void Begin(uint32_t width, uint32_t height) override;
+    void WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb) override;
+    void End() override;
+private:
+    std::FILE* stream;
+    std::mutex mutex;
+};
+
+// keeps the tiles in memory so that a render can be looked at while it runs (see RenderJob::GetPartialFramebuffer)
+class FramebufferTileWriter : public TileOutput
+{
+public:
+    void Begin(uint32_t width, uint32_t height) override;
+    void WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb) override;
+    void End() override {}
+    // the beauty layer holds the tiles received so far, the rest of the image is black
+    Framebuffer GetFramebuffer() const;
+private:
+    mutable std::mutex mutex;
+    Framebuffer framebuffer;
+};
+
+}
@@ -1,11 +1,26 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include <glm/glm.hpp>
 
 #include "camera.h"
 #include "canvas.h"
-#include "rng.h"
+#include "framebuffer.h"
+#include "ray_packet.h"
+#include "sampler.h"
 #include "scene.h"
+#include "tile_output.h"
 
 namespace tracer
 {
@@ -23,6 +38,37 @@ struct RayTraceConfiguration
     uint32_t nSamplesPerPixel = 16u;
 };
 
+enum class SamplerType
+{
+    Independent, Sobol
+};
+
+// order in which the tiles of the default mode are handed out
+enum class TileOrder
+{
+    Scanline, Morton, Hilbert
+};
+
+// how far a render has got, the default mode counts tiles and the other modes pixel samples
+struct RenderProgress
+{
+    uint64_t nCompleted = 0u;
+    uint64_t nTotal = 0u;
+    std::chrono::duration<double> elapsed{};
+    std::chrono::duration<double> estimatedRemaining{}; // extrapolated from the rate so far
+};
+
+// shares the cores between renders running at the same time (see RenderService), a render worker holds a core while it
+// renders a tile in the default mode or its part of a stage of a pass in the other modes
+class CoreGate
+{
+public:
+    // blocks until the worker may use a core
+    virtual void Acquire() = 0;
+    virtual void Release() = 0;
+    virtual ~CoreGate() {}
+};
+
 struct TracerConfiguration
 {
     uint32_t nThreads = 4u;
@@ -34,6 +80,163 @@ struct TracerConfiguration
     uint32_t nMinBounces = 3u;
     uint32_t nMaxBounces = 16u;
     uint32_t nSamplesPerPixel = 16u;
+
+    // when enabled, nSamplesPerPixel is the minimum and each pixel keeps sampling
+    // until the relative standard error of its luminance drops below adaptiveTargetError
+    bool adaptiveSampling = false;
+    uint32_t nMaxSamplesPerPixel = 256u;
+    float adaptiveTargetError = 0.02f;
+
+    // progressive mode sweeps the whole frame one sample per pixel at a time,
+    // nSamplesPerPixel (or nMaxSamplesPerPixel when adaptive) bounds the number of passes
+    bool progressive = false;
+    // progressive only, rendering stops once it is exceeded; zero means no limit
+    std::chrono::milliseconds timeBudget{0};
+    // progressive only, onSnapshot receives the current image every nPassesPerSnapshot passes
+    uint32_t nPassesPerSnapshot = 0u;
+    std::function<void(const Canvas& snapshot, uint32_t nPassesCompleted)> onSnapshot;
+
+    SamplerType samplerType = SamplerType::Sobol;
+    uint32_t seed = 0u;
+
+    // sharding a frame over machines that never talk to each other: every shard renders with the same seed and either
+    // its own range of sample indices, starting at firstSample, or its own crop window (default mode only, a cropSize
+    // of zero covers the whole image) and saves its sums with Tracer::SavePartial, Tracer::MergePartials combines them;
+    // sample ranges only add up to a single render without adaptive sampling, which picks the sample counts per shard
+    uint32_t firstSample = 0u;
+    glm::u32vec2 cropOrigin{0u};
+    glm::u32vec2 cropSize{0u};
+
+    // sample a light with a shadow ray at every non-specular vertex, combined with the material sample by mis
+    bool nextEventEstimation = true;
+    LightSelection lightSelection = LightSelection::Tree;
+
+    // resampled importance sampling of the direct light at the first vertex (restir), always renders pass by pass
+    // every pixel picks one of nLightCandidates light samples, merges the picks of nSpatialNeighbors pixels within
+    // spatialReuseRadius and, with temporalReuse, its own pick of the previous pass, then traces a single shadow ray
+    bool resampledDirectLighting = false;
+    uint32_t nLightCandidates = 32u;
+    uint32_t nSpatialNeighbors = 4u;
+    float spatialReuseRadius = 16.0f;
+    bool temporalReuse = true;
+
+    // wavefront mode keeps nWavefrontPaths paths in flight and moves the whole batch through one stage at a time
+    // (generate, extend, sort by material, shade, trace shadow rays) instead of tracing every path to completion on its own,
+    // it renders pass by pass like progressive mode but without the time budget and snapshots
+    // resampledDirectLighting takes precedence over it
+    bool wavefront = false;
+    uint32_t nWavefrontPaths = 1u << 16;
+
+    // the default mode renders the image in square tiles of tileSize pixels, every thread works through its own
+    // stretch of tiles along tileOrder and steals tiles from the others when it runs out
+    uint32_t tileSize = 16u;
+    TileOrder tileOrder = TileOrder::Hilbert;
+
+    // default mode only, binds every render worker to a cpu; the workers are split over the numa nodes in contiguous blocks,
+    // take the tiles of their own node's stretch of the curve and steal from workers of the same node first
+    bool pinThreads = false;
+
+    // default mode only, the camera rays of four samples of a pixel are traced through the bvh together as a packet
+    bool rayPackets = true;
+
+    // filters the beauty image after rendering, guided by the albedo and normal of the first hits, into the denoised layer
+    // of the framebuffer, which the canvas then shows; nDenoiseIterations passes of an a-trous wavelet filter
+    // reach 2^(n + 1) pixels out, denoiseColorSigma is in standard deviations of a pixel's luminance
+    bool denoise = false;
+    uint32_t nDenoiseIterations = 5u;
+    float denoiseColorSigma = 4.0f;
+
+    // called about once a second by the thread running the render and once more when it ends, the progress and the ray count
+    // at the end are also printed to stdout unless logProgress is off
+    std::function<void(const RenderProgress& progress)> onProgress;
+    bool logProgress = true;
+
+    // receive the beauty image while it renders, the default mode hands over every tile as soon as it is done,
+    // the other modes the whole frame as a single tile at the end; Render calls Begin and End around every frame
+    std::vector<std::shared_ptr<TileOutput>> tileOutputs;
+
+    // default mode only (Render throws for the others), for images too large for memory: only the sums of the tiles being
+    // rendered are kept, finished tiles exist only in the tileOutputs (a TiledImageFile spills them to disk), the canvas,
+    // framebuffer, accumulation buffer and tile statistics stay empty and denoise is ignored; the list of the tiles is all
+    // that grows with the image, larger tiles keep it small
+    bool outOfCore = false;
+
+    // default mode only, ignored out of core: every checkpointInterval the finished tiles (sums, sample counts, luminance
+    // moments and aovs of their pixels) are written to checkpointPath, replacing the previous checkpoint; with resume a
+    // checkpoint found there is loaded first and only the missing tiles are rendered, which gives the same image as an
+    // uninterrupted render because every sample is seeded by its pixel and sample index; the scene has to be the same
+    std::string checkpointPath;
+    std::chrono::seconds checkpointInterval{600};
+    bool resume = false;
+
+    // distributed rendering (Tracer::RenderAsCoordinator), a tile handed out longer than stragglerTimeout ago is handed
+    // out once more to the next idle worker and the first result to come back is taken
+    std::chrono::milliseconds stragglerTimeout{10000};
+    // the coordinator gives up with an error once it has had no worker connected, or heard nothing from the connected
+    // ones, for workerTimeout; it has to be longer than a tile takes to render
+    std::chrono::milliseconds workerTimeout{60000};
+
+    // the workers of the render run only while they hold a core of coreGate, if set
+    std::shared_ptr<CoreGate> coreGate;
+
+    // shade the built-in materials from the material tables of the meshes with a switch instead of virtual calls
+    bool staticMaterialDispatch = true;
+};
+
+// first hit guides of a sample, all zero when the camera ray escapes
+struct SampleAovs
+{
+    glm::vec3 albedo{0.0f};
+    glm::vec3 normal{0.0f};
+    glm::vec3 emission{0.0f}; // radiance emitted towards the camera by the first hit
+    float depth = 0.0f; // distance from the camera
+};
+
+struct TileStatistics
+{
+    glm::u32vec2 origin{};
+    glm::u32vec2 size{};
+    uint32_t thread = 0u; // index of the worker that rendered the tile
+    uint64_t nSamples = 0u;
+    uint64_t nRaysTraced = 0u;
+    std::chrono::duration<double> duration{};
+};
+
+struct RenderStatistics
+{
+    uint64_t nRaysTraced = 0u; // camera, bounce and shadow rays
+    std::chrono::duration<double> duration{};
+    std::vector<TileStatistics> tiles; // default mode only, in the order the tiles were scheduled
+};
+
+struct Tile;
+class CameraRayGenerator;
+
+// a render running on a thread of its own, see Tracer::Submit; destroying the job cancels it and waits for it to end
+class RenderJob
+{
+public:
+    ~RenderJob();
+    // returns once the render has ended and rethrows what it threw, the tracer then holds the result as after Render
+    void Wait();
+    bool IsDone() const;
+    // the default mode stops after the tiles in flight, the other modes after the pass in flight; what has been rendered
+    // is resolved into the canvas and framebuffer, the tiles never rendered stay black
+    void Cancel();
+    bool IsCancelled() const { return isCancelled.load(std::memory_order_relaxed); }
+    // as of the last report, see TracerConfiguration::onProgress
+    RenderProgress GetProgress() const;
+    // the beauty of the tiles finished so far, the modes other than the default one hand over the whole frame at the end
+    Framebuffer GetPartialFramebuffer() const { return partial->GetFramebuffer(); }
+private:
+    friend class Tracer;
+    RenderJob() = default;
+
+    std::atomic_bool isCancelled{};
+    mutable std::mutex progressMutex;
+    RenderProgress progress;
+    std::shared_ptr<FramebufferTileWriter> partial;
+    std::shared_future<void> done;
 };
 
 class Tracer
@@ -44,9 +247,81 @@ public:
     Tracer() : config{}
     {}
     void Render(Canvas& canvas, const Scene& scene);
+    // nodeScenes holds a copy of the scene per numa node (see Scene::CreateNodeReplicas), with pinThreads the workers
+    // of node k trace against nodeScenes[k], otherwise and in the other modes the first copy is used
+    void Render(Canvas& canvas, std::span<const Scene* const> nodeScenes);
+    // starts Render on a thread of its own and returns right away; canvas, scene and the tracer have to outlive the job
+    // and the tracer must not be used otherwise until it has ended, a tracer runs one job at a time
+    std::unique_ptr<RenderJob> Submit(Canvas& canvas, const Scene& scene);
+    // receives a frame of a sequence on a worker of the pool while the next frame renders, one call at a time in frame order
+    using FrameCallback = std::function<void(uint32_t frame, const Canvas& canvas, const Framebuffer& framebuffer)>;
+    // renders the scene once through each camera (views of a turntable, stereo pair or light field) and leaves it with the
+    // last one; the tile outputs receive every frame in turn, the framebuffers go to onFrame, so GetFramebuffer stays empty
+    void RenderSequence(Scene& scene, std::span<const Camera> cameras, const FrameCallback& onFrame);
+    // renders the animation at each of frameTimes like the cameras above, the objects that move between frames are
+    // refitted into the scene's bvh instead of reloading the scene (see Scene::SetObjectTransformations)
+    void RenderSequence(Scene& scene, const Animation& animation, std::span<const float> frameTimes, const FrameCallback& onFrame);
+    // sum of all samples of each pixel in the last render, row major
+    std::span<const glm::vec3> GetAccumulationBuffer() const { return accumBuffer; }
+    // number of samples taken by each pixel in the last render, row major
+    std::span<const uint32_t> GetSampleCounts() const { return sampleCounts; }
+    // visualizes the sample counts of the last render, normalized to the highest count
+    void GetSampleCountMap(Canvas& canvas) const;
+    const RenderStatistics& GetStatistics() const { return statistics; }
+    // writes the sums of the last render's pixels in the crop window (see TracerConfiguration::firstSample)
+    void SavePartial(std::string_view path) const;
+    // combines the partial renders of one image as if a single render had taken all of their samples, then resolves
+    // the result into the canvas and framebuffer like Render; the size of the image is taken from the partials
+    void MergePartials(Canvas& canvas, std::span<const std::string> paths);
+    // renders the tiles of the default mode on worker processes instead of threads: waits for workers on port, hands out
+    // the tiles one at a time to every connection, hands out the tiles of workers that disconnect again and those of
+    // stragglers to idle workers, and resolves the results into the canvas, framebuffer and tile outputs like Render
+    void RenderAsCoordinator(Canvas& canvas, uint16_t port);
+    // the counterpart of RenderAsCoordinator with the same configuration (checked on connecting) and its own copy of the
+    // scene, connects nThreads times and renders the tiles each connection receives until the coordinator is done
+    void RenderAsWorker(const Scene& scene, std::string_view host, uint16_t port);
+    // float result of the last render with the beauty, albedo, normal, emission, depth and sample count layers, averaged per pixel
+    const Framebuffer& GetFramebuffer() const { return framebuffer; }
 private:
+    // sets up frame n of nFrames with setFrame and renders it, the previous frame is handed to onFrame meanwhile
+    void renderSequence(Scene& scene, uint32_t nFrames, const std::function<void(uint32_t)>& setFrame, const FrameCallback& onFrame);
+    // runs the stages one after another over every pixel that needs samples, once per pass
+    void renderProgressive(uint64_t nPixels, std::span<const std::function<void(Sampler&, uint64_t)>> stages);
+    void renderWavefront(const CameraRayGenerator& cameraRays, const Scene& scene, const glm::u32vec2& dim);
+    // passes the progress to the job, onProgress and stdout
+    void reportProgress(std::chrono::steady_clock::time_point startTime, uint64_t nCompleted, uint64_t nTotal, std::string_view unit) const;
+    bool isCancelled() const { return job && job->IsCancelled(); }
+    uint32_t getMinSamplesPerPixel() const;
+    uint32_t getMaxSamplesPerPixel() const;
+    bool needsSamples(uint64_t pixel) const;
+    void accumulateSample(uint64_t pixel, const glm::vec3& color, const SampleAovs& aovs);
+    void resolveFramebuffer(const glm::u32vec2& dim);
+    void resolveCanvas(Canvas& canvas) const;
+    glm::u32vec2 getCropSize() const;
+    // the tiles of the crop window in tileOrder
+    std::vector<Tile> generateImageTiles() const;
+    // takes the samples of every pixel of the tile, the tile's pixels start at firstBuffer in the buffers, rows bufferStride
+    // apart; returns the number of samples taken
+    uint64_t renderTile(const Tile& tile, uint64_t firstBuffer, uint64_t bufferStride, const CameraRayGenerator& cameraRays, const Scene& scene,
+        std::span<const std::unique_ptr<Sampler>, rayPacketSize> samplers);
+    void clearPixels(uint64_t firstPixel, uint64_t nPixels);
+    // passes the mean of every pixel of the rectangle to the tile outputs, the pixels are laid out like in renderTile
+    void streamTile(const glm::u32vec2& origin, const glm::u32vec2& size, uint64_t firstBuffer, uint64_t bufferStride) const;
+    // sums, sample count, luminance moments and aovs of a pixel, as stored by checkpoints and partial renders
+    void writePixelState(std::ostream& stream, uint64_t pixel) const;
+    void readPixelState(std::istream& stream, uint64_t pixel);
+    void saveCheckpoint(std::span<const Tile> tiles, std::span<const uint32_t> finishedTiles) const;
+    // restores the finished tiles of the checkpoint into the buffers and returns their indices
+    std::vector<uint32_t> loadCheckpoint(std::span<const Tile> tiles);
+
     TracerConfiguration config;
-    RNG rng;
+    std::vector<glm::vec3> accumBuffer;
+    std::vector<uint32_t> sampleCounts;
+    std::vector<glm::vec2> luminanceMoments;
+    std::vector<SampleAovs> aovBuffer; // sums like accumBuffer
+    Framebuffer framebuffer;
+    RenderStatistics statistics;
+    RenderJob* job = nullptr; // the job running the render, if any
 };
 
 }
\ No newline at end of file
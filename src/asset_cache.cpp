@@ -0,0 +1,185 @@
+#include "asset_cache.h"
+
+#include <bit>
+#include <filesystem>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+#include "util.h"
+
+namespace tracer
+{
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace
+{
+
+    constexpr std::array<uint32_t, 64> sha256RoundConstants
+    {
+        0x428a2f98u, 0x71374491u, 0xb5c0fbcfu, 0xe9b5dba5u, 0x3956c25bu, 0x59f111f1u, 0x923f82a4u, 0xab1c5ed5u,
+        0xd807aa98u, 0x12835b01u, 0x243185beu, 0x550c7dc3u, 0x72be5d74u, 0x80deb1feu, 0x9bdc06a7u, 0xc19bf174u,
+        0xe49b69c1u, 0xefbe4786u, 0x0fc19dc6u, 0x240ca1ccu, 0x2de92c6fu, 0x4a7484aau, 0x5cb0a9dcu, 0x76f988dau,
+        0x983e5152u, 0xa831c66du, 0xb00327c8u, 0xbf597fc7u, 0xc6e00bf3u, 0xd5a79147u, 0x06ca6351u, 0x14292967u,
+        0x27b70a85u, 0x2e1b2138u, 0x4d2c6dfcu, 0x53380d13u, 0x650a7354u, 0x766a0abbu, 0x81c2c92eu, 0x92722c85u,
+        0xa2bfe8a1u, 0xa81a664bu, 0xc24b8b70u, 0xc76c51a3u, 0xd192e819u, 0xd6990624u, 0xf40e3585u, 0x106aa070u,
+        0x19a4c116u, 0x1e376c08u, 0x2748774cu, 0x34b0bcb5u, 0x391c0cb3u, 0x4ed8aa4au, 0x5b9cca4fu, 0x682e6ff3u,
+        0x748f82eeu, 0x78a5636fu, 0x84c87814u, 0x8cc70208u, 0x90befffau, 0xa4506cebu, 0xbef9a3f7u, 0xc67178f2u
+    };
+
+    void collectPaths(const json& obj, std::vector<std::string>& paths)
+    {
+        if (obj.is_object())
+        {
+            for (const auto& [key, value] : obj.items())
+            {
+                if (key == "path" && value.is_string())
+                    paths.push_back(value.get<std::string>());
+                else
+                    collectPaths(value, paths);
+            }
+        }
+        else if (obj.is_array())
+        {
+            for (const json& element : obj)
+                collectPaths(element, paths);
+        }
+    }
+
+    struct HashedFile
+    {
+        fs::file_time_type writeTime;
+        uintmax_t size = 0;
+        AssetKey key; // of the content alone
+        std::vector<std::string> referencedPaths;
+    };
+
+    std::mutex hashedFilesMutex;
+    std::unordered_map<std::string, HashedFile> hashedFiles;
+
+    // the entry of the file, read and hashed again only when it has changed since
+    HashedFile getHashedFile(const std::string& path)
+    {
+        std::error_code error;
+        fs::file_time_type writeTime = fs::last_write_time(path, error);
+        uintmax_t size = error ? 0 : fs::file_size(path, error);
+        if (error)
+            throw std::runtime_error(fmt::format("cannot open {}", path));
+        {
+            std::lock_guard lock(hashedFilesMutex);
+            auto found = hashedFiles.find(path);
+            if (found != hashedFiles.end() && found->second.writeTime == writeTime && found->second.size == size)
+                return found->second;
+        }
+
+        HashedFile file;
+        file.writeTime = writeTime;
+        file.size = size;
+        std::string content = readBinaryFile(path);
+        file.key = AssetKeyBuilder().Add(content).Finish();
+        // files that are not json (images) reference nothing
+        json jsonObj = json::parse(content, nullptr, false);
+        if (!jsonObj.is_discarded())
+            collectPaths(jsonObj, file.referencedPaths);
+
+        std::lock_guard lock(hashedFilesMutex);
+        hashedFiles[path] = file;
+        return file;
+    }
+
+    // the paths themselves are part of the content of the files naming them, visited breaks reference cycles
+    void addFileAndReferences(const std::string& path, AssetKeyBuilder& builder, std::unordered_set<std::string>& visited)
+    {
+        if (!visited.insert(path).second)
+            return;
+        HashedFile file = getHashedFile(path);
+        builder.Add(file.key);
+        for (const std::string& referencedPath : file.referencedPaths)
+            addFileAndReferences(referencedPath, builder, visited);
+    }
+
+}
+
+AssetKeyBuilder& AssetKeyBuilder::Add(std::string_view bytes)
+{
+    uint64_t n = bytes.size();
+    append(reinterpret_cast<const uint8_t*>(&n), sizeof(n));
+    append(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+    return *this;
+}
+
+AssetKey AssetKeyBuilder::Finish()
+{
+    uint64_t nBits = nBytes * 8;
+    AssetKey key;
+    key.size = nBytes;
+
+    // padding: a one bit, zeros up to 56 bytes into the block and the length in bits, big endian
+    uint8_t one = 0x80;
+    append(&one, 1);
+    uint8_t zero = 0;
+    while (nBytes % 64 != 56)
+        append(&zero, 1);
+    for (int i = 7; i >= 0; i--)
+    {
+        uint8_t byte = static_cast<uint8_t>(nBits >> (i * 8));
+        append(&byte, 1);
+    }
+
+    key.digest = state;
+    return key;
+}
+
+void AssetKeyBuilder::append(const uint8_t* bytes, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        block[nBytes % 64] = bytes[i];
+        nBytes++;
+        if (nBytes % 64 == 0)
+            compressBlock();
+    }
+}
+
+void AssetKeyBuilder::compressBlock()
+{
+    std::array<uint32_t, 64> w;
+    for (uint32_t i = 0; i < 16; i++)
+        w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) | (static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+            (static_cast<uint32_t>(block[i * 4 + 2]) << 8) | block[i * 4 + 3];
+    for (uint32_t i = 16; i < 64; i++)
+    {
+        uint32_t s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    std::array<uint32_t, 8> v = state;
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        uint32_t s1 = std::rotr(v[4], 6) ^ std::rotr(v[4], 11) ^ std::rotr(v[4], 25);
+        uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7] + s1 + choice + sha256RoundConstants[i] + w[i];
+        uint32_t s0 = std::rotr(v[0], 2) ^ std::rotr(v[0], 13) ^ std::rotr(v[0], 22);
+        uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        uint32_t t2 = s0 + majority;
+        v = {t1 + t2, v[0], v[1], v[2], v[3] + t1, v[4], v[5], v[6]};
+    }
+    for (uint32_t i = 0; i < 8; i++)
+        state[i] += v[i];
+}
+
+AssetKey hashFileAndReferences(const std::string& path)
+{
+    AssetKeyBuilder builder;
+    std::unordered_set<std::string> visited;
+    addFileAndReferences(path, builder, visited);
+    return builder.Finish();
+}
+
+}
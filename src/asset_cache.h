@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace tracer
+{
+
+// identifies the content of an asset: the sha-256 digest of everything that went into it and how many bytes that was
+struct AssetKey
+{
+    uint64_t size = 0;
+    std::array<uint32_t, 8> digest{};
+
+    bool operator==(const AssetKey&) const = default;
+};
+
+struct AssetKeyHash
+{
+    size_t operator()(const AssetKey& key) const
+    {
+        // the digest is uniform already
+        return static_cast<size_t>(key.digest[0] | (static_cast<uint64_t>(key.digest[1]) << 32));
+    }
+};
+
+// builds an AssetKey from parts, every part is prefixed with its size so different splits of the same bytes differ
+class AssetKeyBuilder
+{
+public:
+    AssetKeyBuilder& Add(std::string_view bytes);
+    AssetKeyBuilder& Add(std::span<const float> values)
+    {
+        return Add(std::string_view(reinterpret_cast<const char*>(values.data()), values.size_bytes()));
+    }
+    AssetKeyBuilder& Add(const AssetKey& key)
+    {
+        return Add(std::string_view(reinterpret_cast<const char*>(&key), sizeof(key)));
+    }
+    AssetKey Finish();
+private:
+    void append(const uint8_t* bytes, size_t n);
+    void compressBlock();
+
+    std::array<uint32_t, 8> state{0x6a09e667u, 0xbb67ae85u, 0x3c6ef372u, 0xa54ff53au, 0x510e527fu, 0x9b05688cu, 0x1f83d9abu, 0x5be0cd19u};
+    std::array<uint8_t, 64> block{};
+    uint64_t nBytes = 0;
+};
+
+// the key of the file's content and, if it is json, of the files named by its "path" fields and theirs in turn (a scene
+// file's meshes and the images of those), so a change to any of them changes the key; a file is only read again once
+// its modification time or size has changed
+AssetKey hashFileAndReferences(const std::string& path);
+
+// assets loaded once and shared by everything that asks for the same key (see AssetKey), the cache only
+// holds weak references, so an asset lives as long as something uses it; concurrent requests for a key that is being
+// loaded wait for that load instead of loading it once more
+template <typename T>
+class AssetCache
+{
+public:
+    template <typename Loader>
+    std::shared_ptr<T> GetOrLoad(const AssetKey& key, const Loader& load)
+    {
+        std::promise<std::shared_ptr<T>> loaded;
+        {
+            std::unique_lock lock(mutex);
+            Entry& entry = entries[key];
+            if (std::shared_ptr<T> asset = entry.asset.lock())
+                return asset;
+            if (entry.loading.valid())
+            {
+                std::shared_future<std::shared_ptr<T>> loading = entry.loading;
+                lock.unlock();
+                return loading.get();
+            }
+            entry.loading = loaded.get_future().share();
+        }
+
+        std::shared_ptr<T> asset;
+        try
+        {
+            asset = load();
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard lock(mutex);
+                entries.erase(key);
+            }
+            loaded.set_exception(std::current_exception());
+            throw;
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            // the entries of assets nobody uses any more are dropped on the way
+            std::erase_if(entries, [](const auto& pair) { return pair.second.asset.expired() && !pair.second.loading.valid(); });
+            entries[key] = Entry{asset, {}};
+        }
+        loaded.set_value(asset);
+        return asset;
+    }
+private:
+    struct Entry
+    {
+        std::weak_ptr<T> asset;
+        std::shared_future<std::shared_ptr<T>> loading; // valid while the asset is being loaded
+    };
+
+    std::mutex mutex;
+    std::unordered_map<AssetKey, Entry, AssetKeyHash> entries;
+};
+
+}
@@ -1,5 +1,7 @@
 #include <tracer/canvas.h>
 
+#include <string>
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
@@ -9,7 +11,7 @@ namespace tracer
 void Canvas::SaveToPNG(std::string_view file) const
 {
     assert(channelCount <= 4 && channelCount >= 3);
-    stbi_write_png("out.png", width, height, channelCount, data.get(), 0);
+    stbi_write_png(std::string(file).c_str(), width, height, channelCount, data.get(), 0);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "denoiser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include "thread_pool.h"
+#include "util.h"
+
+namespace tracer
+{
+
+namespace
+{
+
+    constexpr uint32_t tileSize = 32u;
+
+    // runs func(x, y) for every pixel, tile by tile on the shared pool
+    template <typename Func>
+    void forEachPixelInTiles(const glm::u32vec2& dim, uint32_t nThreads, const Func& func)
+    {
+        glm::u32vec2 nTiles = (dim + glm::u32vec2(tileSize - 1)) / tileSize;
+        uint32_t nTotalTiles = nTiles.x * nTiles.y;
+        std::atomic_uint32_t nextTile{};
+        ThreadPool::GetShared().Run(std::max(nThreads, 1u), [&](uint32_t)
+        {
+            uint32_t tile;
+            while ((tile = nextTile.fetch_add(1, std::memory_order_relaxed)) < nTotalTiles)
+            {
+                uint32_t x0 = tile % nTiles.x * tileSize;
+                uint32_t y0 = tile / nTiles.x * tileSize;
+                uint32_t x1 = std::min(x0 + tileSize, dim.x);
+                uint32_t y1 = std::min(y0 + tileSize, dim.y);
+                for (uint32_t y = y0; y < y1; y++)
+                    for (uint32_t x = x0; x < x1; x++)
+                        func(x, y);
+            }
+        });
+    }
+
+}
+
+void denoise(const glm::u32vec2& dim, std::span<const glm::vec3> color, std::span<const float> variance,
+    std::span<const glm::vec3> albedo, std::span<const glm::vec3> normal, const DenoiserSettings& settings, std::span<glm::vec3> output)
+{
+    using namespace glm;
+
+    size_t nPixels = static_cast<size_t>(dim.x) * dim.y;
+
+    // untextured illumination is what gets filtered, the albedo is multiplied back in at the end
+    std::vector<vec3> demodulation(nPixels);
+    std::vector<vec3> guideNormals(nPixels);
+    std::vector<vec3> illumination(nPixels), filteredIllumination(nPixels);
+    std::vector<float> illuminationVariance(nPixels), filteredVariance(nPixels);
+    forEachPixelInTiles(dim, settings.nThreads, [&](uint32_t x, uint32_t y)
+    {
+        size_t p = static_cast<size_t>(y) * dim.x + x;
+        vec3 factor = luminance(albedo[p]) > 1e-3f ? max(albedo[p], vec3(1e-3f)) : vec3(1.0f);
+        float factorLuminance = luminance(factor);
+        demodulation[p] = factor;
+        illumination[p] = color[p] / factor;
+        illuminationVariance[p] = variance[p] / (factorLuminance * factorLuminance);
+        float normalLength = length(normal[p]);
+        guideNormals[p] = normalLength > 0.0f ? normal[p] / normalLength : vec3(0.0f);
+    });
+
+    // b3 spline, spread out by the step size of each iteration
+    constexpr float kernel[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+    for (uint32_t iteration = 0; iteration < settings.nIterations; iteration++)
+    {
+        int32_t step = 1 << iteration;
+        forEachPixelInTiles(dim, settings.nThreads, [&](uint32_t x, uint32_t y)
+        {
+            size_t p = static_cast<size_t>(y) * dim.x + x;
+            float centerLuminance = luminance(illumination[p]);
+            float luminanceSigma = settings.colorSigma * std::sqrt(std::max(illuminationVariance[p], 0.0f)) + 1e-4f;
+            vec3 centerNormal = guideNormals[p];
+            vec3 centerAlbedo = albedo[p];
+
+            vec3 sum(0.0f);
+            float weightSum = 0.0f;
+            float varianceSum = 0.0f;
+            for (int32_t dy = -2; dy <= 2; dy++)
+            {
+                int32_t qy = static_cast<int32_t>(y) + dy * step;
+                if (qy < 0 || qy >= static_cast<int32_t>(dim.y))
+                    continue;
+                for (int32_t dx = -2; dx <= 2; dx++)
+                {
+                    int32_t qx = static_cast<int32_t>(x) + dx * step;
+                    if (qx < 0 || qx >= static_cast<int32_t>(dim.x))
+                        continue;
+                    size_t q = static_cast<size_t>(qy) * dim.x + qx;
+
+                    float luminanceWeight = std::exp(-std::abs(luminance(illumination[q]) - centerLuminance) / luminanceSigma);
+                    // surfaces never blend with the background, whose normal is zero
+                    float cosine = dot(centerNormal, guideNormals[q]);
+                    float normalWeight = centerNormal == vec3(0.0f) && guideNormals[q] == vec3(0.0f) ?
+                        1.0f :
+                        std::pow(std::max(cosine, 0.0f), settings.normalPower);
+                    vec3 albedoDifference = albedo[q] - centerAlbedo;
+                    float albedoWeight = std::exp(-dot(albedoDifference, albedoDifference) / (settings.albedoSigma * settings.albedoSigma));
+
+                    float weight = kernel[std::abs(dx)] * kernel[std::abs(dy)] * luminanceWeight * normalWeight * albedoWeight;
+                    sum += weight * illumination[q];
+                    weightSum += weight;
+                    varianceSum += weight * weight * illuminationVariance[q];
+                }
+            }
+            // the center tap always has a positive weight
+            filteredIllumination[p] = sum / weightSum;
+            filteredVariance[p] = varianceSum / (weightSum * weightSum);
+        });
+        std::swap(illumination, filteredIllumination);
+        std::swap(illuminationVariance, filteredVariance);
+    }
+
+    for (size_t p = 0; p < nPixels; p++)
+        output[p] = illumination[p] * demodulation[p];
+}
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include <glm/glm.hpp>
+
+namespace tracer
+{
+
+struct DenoiserSettings
+{
+    uint32_t nIterations = 5u;
+    uint32_t nThreads = 4u;
+    float colorSigma = 4.0f; // in standard deviations of the pixel's luminance
+    float normalPower = 64.0f;
+    float albedoSigma = 0.2f;
+};
+
+// edge-avoiding a-trous wavelet filter (dammertz et al. 2010) with the luminance variance guided weights of svgf
+// (schied et al. 2017); the color is divided by the albedo before filtering so that texture detail survives,
+// variance is the variance of each pixel's mean luminance, normal and albedo are the first hit guides
+void denoise(const glm::u32vec2& dim, std::span<const glm::vec3> color, std::span<const float> variance,
+    std::span<const glm::vec3> albedo, std::span<const glm::vec3> normal, const DenoiserSettings& settings, std::span<glm::vec3> output);
+
+}
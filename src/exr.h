@@ -0,0 +1,101 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tracer
+{
+
+// exr and pfm are little endian
+static_assert(std::endian::native == std::endian::little);
+
+enum class ExrCompression : uint8_t
+{
+    None = 0, Zip = 3 // zip covers blocks of 16 scanlines
+};
+
+enum class ExrLineOrder : uint8_t
+{
+    IncreasingY = 0, RandomY = 2
+};
+
+inline uint32_t getExrLinesPerBlock(ExrCompression compression)
+{
+    return compression == ExrCompression::Zip ? 16u : 1u;
+}
+
+template <typename T>
+void writeBinary(std::ostream& stream, const T& value)
+{
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+inline void writeCString(std::ostream& stream, std::string_view str)
+{
+    stream.write(str.data(), str.size());
+    stream.put('\0');
+}
+
+// header of a single part scanline file with 32-bit float channels, channelNames have to be sorted,
+// the offset table of the blocks has to follow right after
+inline void writeExrHeader(std::ostream& stream, std::span<const std::string> channelNames, uint32_t width, uint32_t height,
+    ExrCompression compression, ExrLineOrder lineOrder)
+{
+    constexpr int32_t floatPixelType = 2;
+
+    writeBinary(stream, uint32_t(20000630)); // magic number
+    writeBinary(stream, uint32_t(2)); // version 2, single part scanline file
+
+    auto writeAttributeHeader = [&](std::string_view name, std::string_view type, uint32_t size)
+    {
+        writeCString(stream, name);
+        writeCString(stream, type);
+        writeBinary(stream, size);
+    };
+
+    uint32_t channelListSize = 1;
+    for (const std::string& name : channelNames)
+        channelListSize += static_cast<uint32_t>(name.size()) + 1 + 16;
+    writeAttributeHeader("channels", "chlist", channelListSize);
+    for (const std::string& name : channelNames)
+    {
+        writeCString(stream, name);
+        writeBinary(stream, floatPixelType);
+        writeBinary(stream, uint32_t(0)); // pLinear and reserved
+        writeBinary(stream, int32_t(1)); // x sampling
+        writeBinary(stream, int32_t(1)); // y sampling
+    }
+    stream.put('\0');
+
+    writeAttributeHeader("compression", "compression", 1);
+    writeBinary(stream, compression);
+
+    int32_t window[4] = {0, 0, static_cast<int32_t>(width) - 1, static_cast<int32_t>(height) - 1};
+    writeAttributeHeader("dataWindow", "box2i", sizeof(window));
+    stream.write(reinterpret_cast<const char*>(window), sizeof(window));
+    writeAttributeHeader("displayWindow", "box2i", sizeof(window));
+    stream.write(reinterpret_cast<const char*>(window), sizeof(window));
+
+    writeAttributeHeader("lineOrder", "lineOrder", 1);
+    writeBinary(stream, lineOrder);
+
+    writeAttributeHeader("pixelAspectRatio", "float", sizeof(float));
+    writeBinary(stream, 1.0f);
+    writeAttributeHeader("screenWindowCenter", "v2f", 2 * sizeof(float));
+    writeBinary(stream, 0.0f);
+    writeBinary(stream, 0.0f);
+    writeAttributeHeader("screenWindowWidth", "float", sizeof(float));
+    writeBinary(stream, 1.0f);
+    stream.put('\0'); // end of header
+}
+
+// zip blocks store the bytes split into even and odd halves and delta encoded before deflating,
+// blocks that do not get smaller are stored as they are
+std::vector<uint8_t> compressExrZipBlock(std::span<const uint8_t> data);
+
+}
@@ -0,0 +1,157 @@
+#include <tracer/framebuffer.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "exr.h"
+
+namespace tracer
+{
+
+namespace
+{
+
+    std::ofstream openBinaryFile(std::string_view file)
+    {
+        std::ofstream stream(std::string(file), std::ios::binary);
+        if (!stream)
+            throw std::runtime_error(fmt::format("cannot open {} for writing", file));
+        return stream;
+    }
+
+    std::vector<std::string> getExrChannelNames(const Framebuffer::Layer& layer)
+    {
+        if (layer.channelCount == 1)
+            return {layer.name};
+
+        const char* suffixes = layer.name == normalLayerName ? "XYZW" : "RGBA";
+        std::vector<std::string> names;
+        for (uint32_t c = 0; c < layer.channelCount; c++)
+        {
+            std::string suffix = c < 4 ? std::string(1, suffixes[c]) : std::to_string(c);
+            names.push_back(layer.name == beautyLayerName ? suffix : layer.name + "." + suffix);
+        }
+        return names;
+    }
+
+}
+
+std::span<float> Framebuffer::AddLayer(std::string_view name, uint32_t channelCount)
+{
+    size_t size = static_cast<size_t>(width) * height * channelCount;
+    for (Layer& layer : layers)
+    {
+        if (layer.name != name)
+            continue;
+        if (layer.channelCount != channelCount)
+            throw std::runtime_error(fmt::format("layer {} already exists with {} channels", name, layer.channelCount));
+        layer.data.assign(size, 0.0f);
+        return layer.data;
+    }
+    layers.push_back(Layer{std::string(name), channelCount, std::vector<float>(size, 0.0f)});
+    return layers.back().data;
+}
+
+std::span<float> Framebuffer::GetLayer(std::string_view name)
+{
+    const Layer* layer = findLayer(name);
+    if (!layer)
+        throw std::runtime_error(fmt::format("no layer named {}", name));
+    return const_cast<Layer*>(layer)->data;
+}
+
+std::span<const float> Framebuffer::GetLayer(std::string_view name) const
+{
+    const Layer* layer = findLayer(name);
+    if (!layer)
+        throw std::runtime_error(fmt::format("no layer named {}", name));
+    return layer->data;
+}
+
+uint32_t Framebuffer::GetLayerChannelCount(std::string_view name) const
+{
+    const Layer* layer = findLayer(name);
+    if (!layer)
+        throw std::runtime_error(fmt::format("no layer named {}", name));
+    return layer->channelCount;
+}
+
+const Framebuffer::Layer* Framebuffer::findLayer(std::string_view name) const
+{
+    auto it = std::ranges::find(layers, name, &Layer::name);
+    return it != layers.end() ? &*it : nullptr;
+}
+
+void Framebuffer::SaveToPFM(std::string_view file, std::string_view layerName) const
+{
+    const Layer* layer = findLayer(layerName);
+    if (!layer)
+        throw std::runtime_error(fmt::format("no layer named {}", layerName));
+    if (layer->channelCount != 1 && layer->channelCount != 3)
+        throw std::runtime_error(fmt::format("pfm cannot hold the {} channels of layer {}", layer->channelCount, layerName));
+
+    std::ofstream stream = openBinaryFile(file);
+    // a negative scale marks little endian data
+    std::string header = fmt::format("{}\n{} {}\n-1.0\n", layer->channelCount == 3 ? "PF" : "Pf", width, height);
+    stream.write(header.data(), header.size());
+
+    // rows go from the bottom up
+    size_t rowSize = static_cast<size_t>(width) * layer->channelCount;
+    for (uint32_t j = height; j-- > 0;)
+        stream.write(reinterpret_cast<const char*>(layer->data.data() + j * rowSize), rowSize * sizeof(float));
+}
+
+void Framebuffer::SaveToEXR(std::string_view file) const
+{
+    // channels are stored sorted by name, both in the header and within every scanline
+    struct Channel
+    {
+        std::string name;
+        const Layer* layer;
+        uint32_t index;
+    };
+    std::vector<Channel> channels;
+    for (const Layer& layer : layers)
+    {
+        std::vector<std::string> names = getExrChannelNames(layer);
+        for (uint32_t c = 0; c < layer.channelCount; c++)
+            channels.push_back(Channel{names[c], &layer, c});
+    }
+    std::ranges::sort(channels, {}, &Channel::name);
+    if (channels.empty())
+        throw std::runtime_error("the framebuffer has no layers to save");
+
+    std::vector<std::string> channelNames;
+    for (const Channel& channel : channels)
+        channelNames.push_back(channel.name);
+    std::ofstream stream = openBinaryFile(file);
+    writeExrHeader(stream, channelNames, width, height, ExrCompression::None, ExrLineOrder::IncreasingY);
+
+    // uncompressed files hold one scanline per block, the offset table points at each of them
+    uint32_t lineDataSize = static_cast<uint32_t>(channels.size() * width * sizeof(float));
+    uint64_t firstBlock = static_cast<uint64_t>(stream.tellp()) + static_cast<uint64_t>(height) * sizeof(uint64_t);
+    for (uint32_t j = 0; j < height; j++)
+        writeBinary(stream, firstBlock + static_cast<uint64_t>(j) * (2 * sizeof(int32_t) + lineDataSize));
+
+    std::vector<float> line(width);
+    for (uint32_t j = 0; j < height; j++)
+    {
+        writeBinary(stream, static_cast<int32_t>(j));
+        writeBinary(stream, lineDataSize);
+        for (const Channel& channel : channels)
+        {
+            uint32_t channelCount = channel.layer->channelCount;
+            const float* row = channel.layer->data.data() + static_cast<size_t>(j) * width * channelCount;
+            for (uint32_t i = 0; i < width; i++)
+                line[i] = row[i * channelCount + channel.index];
+            stream.write(reinterpret_cast<const char*>(line.data()), width * sizeof(float));
+        }
+    }
+    if (!stream)
+        throw std::runtime_error(fmt::format("failed to write {}", file));
+}
+
+}
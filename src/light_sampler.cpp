@@ -0,0 +1,167 @@
+#include <tracer/light_sampler.h>
+
+#include <algorithm>
+
+#include <tracer/material.h>
+
+#include "util.h"
+
+namespace tracer
+{
+
+AliasTable::AliasTable(std::span<const float> weights)
+{
+    uint32_t n = static_cast<uint32_t>(weights.size());
+    bins.resize(n);
+    pmfs.resize(n);
+    if (n == 0)
+        return;
+
+    double sum = 0.0;
+    for (float weight : weights)
+        sum += weight;
+
+    // degenerate weights fall back to a uniform distribution
+    for (uint32_t i = 0; i < n; i++)
+        pmfs.at(i) = sum > 0.0 ? static_cast<float>(weights[i] / sum) : 1.0f / static_cast<float>(n);
+
+    std::vector<uint32_t> small, large;
+    std::vector<float> scaled(n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        scaled.at(i) = pmfs.at(i) * static_cast<float>(n);
+        if (scaled.at(i) < 1.0f)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t s = small.back();
+        small.pop_back();
+        uint32_t l = large.back();
+        large.pop_back();
+
+        bins.at(s) = Bin{scaled.at(s), l};
+        scaled.at(l) -= 1.0f - scaled.at(s);
+        if (scaled.at(l) < 1.0f)
+            small.push_back(l);
+        else
+            large.push_back(l);
+    }
+
+    // whatever is left over is 1 up to rounding
+    for (uint32_t i : large)
+        bins.at(i) = Bin{1.0f, i};
+    for (uint32_t i : small)
+        bins.at(i) = Bin{1.0f, i};
+}
+
+uint32_t AliasTable::Sample(float u, float& pmf) const
+{
+    uint32_t n = GetSize();
+    float scaled = u * static_cast<float>(n);
+    uint32_t index = std::min(static_cast<uint32_t>(scaled), n - 1);
+    float remapped = scaled - static_cast<float>(index);
+
+    const Bin& bin = bins.at(index);
+    if (remapped >= bin.threshold)
+        index = bin.alias;
+
+    pmf = pmfs.at(index);
+    return index;
+}
+
+void LightSampler::Build(std::span<const std::unique_ptr<EmissionProfile>> profiles)
+{
+    using namespace glm;
+
+    triangles.clear();
+    for (const auto& profile : profiles)
+        for (uint32_t i = 0; i < profile->GetTriangleCount(); i++)
+            triangles.push_back(profile->GetTriangle(i));
+
+    std::vector<float> powers;
+    powers.reserve(triangles.size());
+    for (const EmissiveTriangle& triangle : triangles)
+    {
+        vec2 centroidTexCoords = (triangle.texCoords.at(0) + triangle.texCoords.at(1) + triangle.texCoords.at(2)) / 3.0f;
+        float power = triangle.area * luminance(triangle.material->GetEmissivity(centroidTexCoords));
+        if (triangle.doubleFaced)
+            power *= 2.0f;
+        powers.push_back(power);
+    }
+
+    aliasTable = AliasTable(powers);
+    lightTree.Build(triangles, powers);
+}
+
+bool LightSampler::Sample(Sampler& sampler, LightSelection selection, const glm::vec3& orig, const glm::vec3& normal, EmissionSample& emissionSample) const
+{
+    using namespace glm;
+
+    // both numbers are drawn up front so the dimensions consumed do not depend on the outcome
+    float u = sampler.Get1D();
+    vec2 coords;
+    sampleBarycentricUniform(sampler, coords);
+
+    float pmf;
+    uint32_t lightId = selection == LightSelection::Tree ?
+        lightTree.Sample(u, orig, normal, pmf) :
+        aliasTable.Sample(u, pmf);
+    if (lightId == invalidLightId)
+        return false;
+    const EmissiveTriangle& triangle = triangles.at(lightId);
+
+    vec3 point = triangle.points.at(0) +
+        (triangle.points.at(1) - triangle.points.at(0)) * coords.x +
+        (triangle.points.at(2) - triangle.points.at(0)) * coords.y;
+    vec2 texCoords = triangle.texCoords.at(0) +
+        (triangle.texCoords.at(1) - triangle.texCoords.at(0)) * coords.x +
+        (triangle.texCoords.at(2) - triangle.texCoords.at(0)) * coords.y;
+
+    vec3 toLight = point - orig;
+    float distance = length(toLight);
+    if (distance <= 0.0f)
+        return false;
+    vec3 dir = toLight / distance;
+
+    float cosTheta = dot(-dir, triangle.normal);
+    if (triangle.doubleFaced)
+        cosTheta = abs(cosTheta);
+    if (cosTheta <= 0.0f)
+        return false;
+
+    emissionSample.sample = dir;
+    emissionSample.distance = distance;
+    emissionSample.pdf = pmf * distance * distance / (cosTheta * triangle.area);
+    emissionSample.emission = triangle.material->GetEmissivity(texCoords);
+    emissionSample.lightId = lightId;
+
+    return true;
+}
+
+float LightSampler::getPmf(LightSelection selection, uint32_t lightId, const glm::vec3& orig, const glm::vec3& normal) const
+{
+    if (selection == LightSelection::Tree)
+        return lightTree.GetPmf(lightId, orig, normal);
+    return aliasTable.GetPmf(lightId);
+}
+
+float LightSampler::GetPdf(LightSelection selection, uint32_t lightId, const glm::vec3& orig, const glm::vec3& normal, const glm::vec3& dir, float distance) const
+{
+    using namespace glm;
+
+    const EmissiveTriangle& triangle = triangles.at(lightId);
+
+    float cosTheta = dot(-dir, triangle.normal);
+    if (triangle.doubleFaced)
+        cosTheta = abs(cosTheta);
+    if (cosTheta <= 0.0f)
+        return 0.0f;
+
+    return getPmf(selection, lightId, orig, normal) * distance * distance / (cosTheta * triangle.area);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include <tracer/light_tree.h>
+
+#include <algorithm>
+
+#include <glm/gtc/constants.hpp>
+
+namespace tracer
+{
+
+static float safeSqrt(float x)
+{
+    return glm::sqrt(std::max(x, 0.0f));
+}
+
+// cos(max(0, a - b)) from the sines and cosines of a and b
+static float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 1.0f;
+    return cosA * cosB + sinA * sinB;
+}
+
+// sin(max(0, a - b)) from the sines and cosines of a and b
+static float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 0.0f;
+    return sinA * cosB - cosA * sinB;
+}
+
+// smallest cone containing both, its axis is rotated from a's towards b's
+static LightCone unionCones(const LightCone& a, const LightCone& b)
+{
+    using namespace glm;
+
+    float cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+
+    float thetaA = acos(clamp(a.cosThetaO, -1.0f, 1.0f));
+    float thetaB = acos(clamp(b.cosThetaO, -1.0f, 1.0f));
+    float thetaD = acos(clamp(dot(a.axis, b.axis), -1.0f, 1.0f));
+
+    if (std::min(thetaD + thetaB, pi<float>()) <= thetaA)
+        return LightCone{a.axis, a.cosThetaO, cosThetaE};
+    if (std::min(thetaD + thetaA, pi<float>()) <= thetaB)
+        return LightCone{b.axis, b.cosThetaO, cosThetaE};
+
+    float thetaO = (thetaA + thetaD + thetaB) / 2.0f;
+    if (thetaO >= pi<float>())
+        return LightCone{a.axis, -1.0f, cosThetaE};
+
+    vec3 rotationAxis = cross(a.axis, b.axis);
+    if (dot(rotationAxis, rotationAxis) == 0.0f)
+        return LightCone{a.axis, -1.0f, cosThetaE};
+    rotationAxis = normalize(rotationAxis);
+
+    // rodrigues' rotation of a's axis by thetaO - thetaA
+    float thetaR = thetaO - thetaA;
+    vec3 axis =
+        a.axis * cos(thetaR) +
+        cross(rotationAxis, a.axis) * sin(thetaR) +
+        rotationAxis * dot(rotationAxis, a.axis) * (1.0f - cos(thetaR));
+
+    return LightCone{normalize(axis), cos(thetaO), cosThetaE};
+}
+
+void LightTree::Build(std::span<const EmissiveTriangle> triangles, std::span<const float> powers)
+{
+    using namespace glm;
+
+    nodes.clear();
+    bitTrails.assign(triangles.size(), 0u);
+
+    // lights that cannot emit anything are left out and keep a zero pmf
+    std::vector<BuildItem> items;
+    for (uint32_t i = 0; i < triangles.size(); i++)
+    {
+        const EmissiveTriangle& triangle = triangles[i];
+        if (powers[i] <= 0.0f || triangle.area <= 0.0f)
+            continue;
+
+        BuildItem item{};
+        item.lightId = i;
+        item.bounds = AABB(triangle.points.at(0), triangle.points.at(1));
+        item.bounds.Grow(triangle.points.at(2));
+        item.cone = LightCone{triangle.normal, 1.0f, 0.0f}; // a flat emitter radiates over its hemisphere
+        item.power = powers[i];
+        item.doubleFaced = triangle.doubleFaced;
+        items.push_back(item);
+    }
+
+    if (items.empty())
+        return;
+
+    nodes.reserve(items.size() * 2 - 1);
+    build(items, 0u, 0u);
+}
+
+uint32_t LightTree::build(std::span<BuildItem> items, uint64_t bitTrail, uint32_t depth)
+{
+    uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    if (items.size() == 1)
+    {
+        const BuildItem& item = items.front();
+        nodes.at(nodeIndex) = Node{item.bounds, item.cone, item.power, item.doubleFaced, true, item.lightId};
+        bitTrails.at(item.lightId) = bitTrail;
+        return nodeIndex;
+    }
+
+    // median split along the longest axis of the centroids keeps the depth within the 64 bits of the trail
+    AABB centroidBounds(items.front().bounds.GetCenter(), items.front().bounds.GetCenter());
+    for (const BuildItem& item : items)
+        centroidBounds.Grow(item.bounds.GetCenter());
+    glm::vec3 size = centroidBounds.GetSize();
+    uint32_t axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+
+    size_t mid = items.size() / 2;
+    std::nth_element(items.begin(), items.begin() + mid, items.end(),
+        [axis](const BuildItem& a, const BuildItem& b)
+        {
+            return a.bounds.GetCenter()[axis] < b.bounds.GetCenter()[axis];
+        });
+
+    uint32_t first = build(items.subspan(0, mid), bitTrail, depth + 1);
+    uint32_t second = build(items.subspan(mid), bitTrail | (uint64_t(1) << depth), depth + 1);
+
+    const Node& a = nodes.at(first);
+    const Node& b = nodes.at(second);
+    Node node{};
+    node.bounds = AABB(a.bounds, b.bounds);
+    node.cone = unionCones(a.cone, b.cone);
+    node.power = a.power + b.power;
+    node.doubleFaced = a.doubleFaced || b.doubleFaced;
+    node.isLeaf = false;
+    node.index = second;
+    nodes.at(nodeIndex) = node;
+
+    return nodeIndex;
+}
+
+float LightTree::calcImportance(const Node& node, const glm::vec3& point, const glm::vec3& normal)
+{
+    using namespace glm;
+
+    vec3 center = node.bounds.GetCenter();
+    vec3 toPoint = point - center;
+    float distance2 = dot(toPoint, toPoint);
+    float radius = length(node.bounds.GetSize()) / 2.0f;
+    vec3 wi = distance2 > 0.0f ? toPoint / sqrt(distance2) : vec3(0.0f);
+
+    // angle between the cone axis and the direction to the point
+    float cosThetaW = dot(node.cone.axis, wi);
+    if (node.doubleFaced)
+        cosThetaW = abs(cosThetaW);
+    float sinThetaW = safeSqrt(1.0f - cosThetaW * cosThetaW);
+
+    // half angle the bounding sphere of the node subtends at the point
+    float cosThetaB = -1.0f;
+    if (distance2 > radius * radius)
+        cosThetaB = safeSqrt(1.0f - radius * radius / distance2);
+    float sinThetaB = safeSqrt(1.0f - cosThetaB * cosThetaB);
+
+    // smallest angle any emitter in the node can make with the direction to the point
+    float sinThetaO = safeSqrt(1.0f - node.cone.cosThetaO * node.cone.cosThetaO);
+    float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cone.cosThetaO);
+    float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cone.cosThetaO);
+    float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= node.cone.cosThetaE)
+        return 0.0f;
+
+    // clamped so that points inside or close to the node do not blow up
+    float importance = node.power * cosThetaP / std::max(distance2, radius * radius);
+
+    // smallest angle the node can make with the surface normal
+    float cosThetaI = dot(-wi, normal);
+    float sinThetaI = safeSqrt(1.0f - cosThetaI * cosThetaI);
+    float cosThetaPI = cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    importance *= std::max(cosThetaPI, 0.0f);
+
+    return importance;
+}
+
+uint32_t LightTree::Sample(float u, const glm::vec3& point, const glm::vec3& normal, float& pmf) const
+{
+    constexpr float oneMinusEpsilon = 0x1.fffffep-1f;
+
+    pmf = 0.0f;
+    if (nodes.empty())
+        return invalidLightId;
+
+    float nodePmf = 1.0f;
+    uint32_t nodeIndex = 0;
+    while (!nodes.at(nodeIndex).isLeaf)
+    {
+        const Node& node = nodes.at(nodeIndex);
+        float importance0 = calcImportance(nodes.at(nodeIndex + 1), point, normal);
+        float importance1 = calcImportance(nodes.at(node.index), point, normal);
+        if (importance0 <= 0.0f && importance1 <= 0.0f)
+            return invalidLightId;
+
+        // reuse the random number by rescaling it into the chosen interval
+        float p0 = importance0 / (importance0 + importance1);
+        if (u < p0)
+        {
+            nodeIndex = nodeIndex + 1;
+            u = std::min(u / p0, oneMinusEpsilon);
+            nodePmf *= p0;
+        }
+        else
+        {
+            nodeIndex = node.index;
+            u = std::min((u - p0) / (1.0f - p0), oneMinusEpsilon);
+            nodePmf *= 1.0f - p0;
+        }
+    }
+
+    pmf = nodePmf;
+    return nodes.at(nodeIndex).index;
+}
+
+float LightTree::GetPmf(uint32_t lightId, const glm::vec3& point, const glm::vec3& normal) const
+{
+    if (nodes.empty())
+        return 0.0f;
+
+    uint64_t bitTrail = bitTrails.at(lightId);
+    float pmf = 1.0f;
+    uint32_t nodeIndex = 0;
+    while (!nodes.at(nodeIndex).isLeaf)
+    {
+        const Node& node = nodes.at(nodeIndex);
+        float importance0 = calcImportance(nodes.at(nodeIndex + 1), point, normal);
+        float importance1 = calcImportance(nodes.at(node.index), point, normal);
+        if (importance0 <= 0.0f && importance1 <= 0.0f)
+            return 0.0f;
+
+        float p0 = importance0 / (importance0 + importance1);
+        if (bitTrail & 1u)
+        {
+            nodeIndex = node.index;
+            pmf *= 1.0f - p0;
+        }
+        else
+        {
+            nodeIndex = nodeIndex + 1;
+            pmf *= p0;
+        }
+        bitTrail >>= 1;
+    }
+
+    // lights without power were never inserted and end up at someone else's leaf
+    if (nodes.at(nodeIndex).index != lightId)
+        return 0.0f;
+
+    return pmf;
+}
+
+}
\ No newline at end of file
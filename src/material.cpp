@@ -2,229 +2,144 @@
 
 #include <glm/gtc/constants.hpp>
 
+#include "shading.h"
 #include "util.h"
 
 namespace tracer
 {
 
-bool ReflectiveMaterial::Shade(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& wi, glm::vec3& attenuation, float& currentIor, bool& isInside) const
+bool ReflectiveMaterial::Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const
 {
     using namespace glm;
 
-    float pdf;
+    vec3 localWi;
     vec3 brdf;
-    SampleAndCalcBrdf(rng, rayDir, normal, texCoords, lightSample, lightSamplePdfFunc, wi, pdf, brdf, currentIor);
-    float cosTerm = dot(wi, normal);
-    if (cosTerm < 0.0f)
-        cosTerm = 0.0f;
-    attenuation *= brdf * cosTerm / pdf;
+    bool isDelta = false;
+    if (!SampleAndCalcBrdf(sampler, frame.ToLocal(-rayDir), texCoords, localWi, pdf, brdf, isDelta, currentIor))
+        return false;
+    applyReflection(brdf, localWi, isDelta, attenuation, pdf);
+    wi = frame.ToWorld(localWi);
 
     return true;
 }
 
-void SimpleDiffuseMaterial::SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const
+bool SimpleDiffuseMaterial::SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const
 {
-    using namespace glm;
-
-    if (lightSample)
-    {
-        float p = 0.5f;
-        float cosinePdf;
-        if (rng.Uniform() < p)
-        {
-            sample = lightSample.value();
-            cosinePdf = getCosinePdf(transformWorldSampleToLocal(normal, sample));
-        }
-        else
-        {
-            vec3 localSample;
-            generateCosine(rng, localSample, cosinePdf);
-            sample = transformLocalSampleToWorld(normal, localSample);
-        }
-        float lightPdf = lightSamplePdfFunc(sample);
-
-        pdf = cosinePdf * (1.0f - p) + lightPdf * p;
-    }
-    else
-    {
-        vec3 localSample;
-        float generatedPdf;
-        generateCosine(rng, localSample, generatedPdf);
-        vec3 generatedSample = transformLocalSampleToWorld(normal, localSample);
-        sample = generatedSample;
-        pdf = generatedPdf;
-    }
-
-    brdf = texture->SampleOptional(texCoords) / pi<float>();
+    sampleDiffuse(sampler, texture->SampleOptional(texCoords), sample, pdf, brdf);
+    return true;
 }
 
-void SimpleMirrorMaterial::SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const
+bool SimpleDiffuseMaterial::Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const
 {
     using namespace glm;
 
-    sample = reflect(rayDir, normal);
-
-    pdf = 1.0f;
+    vec3 localWi = frame.ToLocal(wi);
+    if (localWi.y <= 0.0f)
+        return false;
 
-    brdf = vec3(1.0f) / dot(sample, normal);
+    return evaluateDiffuse(texture->SampleOptional(texCoords), localWi, brdf, pdf);
 }
 
-static float ndfGgx(float alpha, const glm::vec3& normal, const glm::vec3& half)
+std::optional<MaterialRecord> SimpleDiffuseMaterial::GetRecord() const
 {
-    using namespace glm;
-
-    float cosine = dot(normal, half);
-    float d = 0.0f;
-    if (cosine <= 0.0f)
-        return 0;
-
-    float in = cosine * cosine * (alpha * alpha - 1.0f) + 1.0f;
-    d = alpha * alpha / (pi<float>() * in * in);
-
-    return d;
+    std::optional<TextureRecord> albedo = texture->GetRecord();
+    if (!albedo)
+        return std::nullopt;
+    return SimpleDiffuseRecord{albedo.value()};
 }
 
-static float gemetricShadowing(float alpha, const glm::vec3& normal, const glm::vec3& half, const glm::vec3& d)
+bool SimpleMirrorMaterial::SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const
 {
-    using namespace glm;
-
-    float dn = dot(d, normal);
-    float dn2 = dn * dn;
-    float g = 0.0f;
-    if (dot(d, half) / dn <= 0.0f)
-        return 0.0f;
-
-    g = 2.0f / (1.0f + sqrt(1.0f + alpha * alpha * ((1.0f - dn2) / dn2)));
-
-    return g;
+    sampleMirror(wo, sample, pdf, brdf, isDelta);
+    return true;
 }
 
-static float schlickApprox(float n, float cosine)
+std::optional<MaterialRecord> SimpleMirrorMaterial::GetRecord() const
 {
-    float r_0 = (1.0f - n) / (1.0f + n);
-    r_0 *= r_0;
-    float r = r_0 + (1.0f - r_0) * pow(1.0f - cosine, 5.0f);
-    return r;
+    return SimpleMirrorRecord{};
 }
 
-static float fresnel(float n, float cosine)
+std::optional<MaterialRecord> SimpleEmissiveMaterial::GetRecord() const
 {
-    float recN2 = 1.0f / (n * n);
-    float sine2 = 1.0f - cosine * cosine;
-    float sqrtComp = sqrt(1.0f - recN2 * sine2);
-    float r_s = abs((cosine - n * sqrtComp) / (cosine + n * sqrtComp));
-    r_s *= r_s;
-    float r_p = abs((sqrtComp - n * cosine) / (sqrtComp + n * cosine));
-    r_p *= r_p;
-    return (r_s + r_p) / 2.0f;
+    std::optional<TextureRecord> emissivity = texture->GetRecord();
+    if (!emissivity)
+        return std::nullopt;
+    return SimpleEmissiveRecord{emissivity.value(), multiplier};
 }
 
-bool ExposedMediumMaterial::Shade(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& wi, glm::vec3& attenuation, float& currentIor, bool& isInside) const
+bool ExposedMediumMaterial::Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const
 {
     using namespace glm;
 
-    float n;
-    if (isInside) // going out
-        n = 1.0f / mediumIor;
-    else // going in
-        n = mediumIor;
-
-    float f = fresnel(n, dot(-rayDir, normal));
-
-    float cosTheta = dot(-rayDir, normal);
-    float sinTheta = sqrt(1.0f - cosTheta * cosTheta);
-
-    if (rng.Uniform() < f || n * sinTheta > 1.0f)
-    {
-        wi = reflect(rayDir, normal);
-        attenuation *= 1.0f;
-        return true;
-    }
-
-    if (isInside)
-    {
-        isInside = false;
-        currentIor = 1.0f;
-    }
-    else
-    {
-        isInside = true;
-        currentIor = mediumIor;
-    }
-    wi = refract(rayDir, normal, n);
-    attenuation *= 1.0f;
+    vec3 localWi;
+    shadeExposedMedium(sampler, mediumIor, frame.ToLocal(-rayDir), localWi, attenuation, pdf, currentIor, isInside);
+    wi = frame.ToWorld(localWi);
 
     return true;
 }
 
-void SpecularCoatedMaterial::SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const
+std::optional<MaterialRecord> ExposedMediumMaterial::GetRecord() const
+{
+    return ExposedMediumRecord{mediumIor};
+}
+
+bool SpecularCoatedMaterial::SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const
 {
     using namespace glm;
 
-    vec3 localSample;
-    generateUniform(rng, localSample, pdf);
-    sample = transformLocalSampleToWorld(normal, localSample);
+    vec3 albedo = albedoTexture->SampleOptional(texCoords);
+    float alpha = max(alphaTexture->SampleOptional(texCoords).r, 1e-3f);
 
-    vec3 half = normalize(sample - rayDir);
+    return sampleSpecularCoated(sampler, albedo, alpha, ior, wo, currentIor, sample, pdf, brdf);
+}
 
-    vec3 albedo = albedoTexture->SampleOptional(texCoords);
-    float alpha = alphaTexture->SampleOptional(texCoords).r;
+bool SpecularCoatedMaterial::Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const
+{
+    using namespace glm;
 
-    float d = ndfGgx(alpha, normal, half);
+    vec3 wo = frame.ToLocal(-rayDir);
+    vec3 localWi = frame.ToLocal(wi);
+    if (wo.y <= 0.0f || localWi.y <= 0.0f)
+        return false;
 
-    float g = gemetricShadowing(alpha, normal, half, -rayDir) * gemetricShadowing(alpha, normal, half, sample);
+    vec3 albedo = albedoTexture->SampleOptional(texCoords);
+    float alpha = max(alphaTexture->SampleOptional(texCoords).r, 1e-3f);
 
-    float f = fresnel(ior / currentIor, dot(-rayDir, half));
+    return evaluateSpecularCoated(albedo, alpha, ior, wo, currentIor, localWi, brdf, pdf);
+}
 
-    float specular = d * g * f / (4.0f * dot(-rayDir, normal) * dot(sample, normal));
+std::optional<MaterialRecord> SpecularCoatedMaterial::GetRecord() const
+{
+    std::optional<TextureRecord> albedo = albedoTexture->GetRecord();
+    std::optional<TextureRecord> alpha = alphaTexture->GetRecord();
+    if (!albedo || !alpha)
+        return std::nullopt;
+    return SpecularCoatedRecord{albedo.value(), alpha.value(), ior};
+}
 
-    brdf = (1.0f - f) * albedo / pi<float>() + specular;
+bool PerfectSpecularCoatedMaterial::SampleAndCalcBrdf(Sampler& sampler, const glm::vec3& wo, const std::optional<glm::vec2>& texCoords, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta, float& currentIor) const
+{
+    samplePerfectSpecularCoated(sampler, [&] { return albedoTexture->SampleOptional(texCoords); }, ior, wo, currentIor, sample, pdf, brdf, isDelta);
+    return true;
 }
 
-void PerfectSpecularCoatedMaterial::SampleAndCalcBrdf(RNG& rng, const glm::vec3& rayDir, const glm::vec3& normal, const std::optional<glm::vec2>& texCoords, const std::optional<glm::vec3>& lightSample, const std::function<float(const glm::vec3&)>& lightSamplePdfFunc, glm::vec3& sample, float& pdf, glm::vec3& brdf, float& currentIor) const
+bool PerfectSpecularCoatedMaterial::Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const
 {
     using namespace glm;
 
-    float f = fresnel(ior / currentIor, dot(-rayDir, normal));
-
-    if (rng.Uniform() < f)
-    {
-        sample = reflect(rayDir, normal);
-        pdf = 1.0f;
-        brdf = vec3(1.0f) / dot(sample, normal);
-        return;
-    }
-    
-    if (lightSample)
-    {
-        float p = 0.5f;
-        float cosinePdf;
-        if (rng.Uniform() < p)
-        {
-            sample = lightSample.value();
-            cosinePdf = getCosinePdf(transformWorldSampleToLocal(normal, sample));
-        }
-        else
-        {
-            vec3 localSample;
-            generateCosine(rng, localSample, cosinePdf);
-            sample = transformLocalSampleToWorld(normal, localSample);
-        }
-        float lightPdf = lightSamplePdfFunc(sample);
-
-        pdf = cosinePdf * (1.0f - p) + lightPdf * p;
-    }
-    else
-    {
-        vec3 localSample;
-        float cosinePdf;
-        generateCosine(rng, localSample, cosinePdf);
-        vec3 cosineSample = transformLocalSampleToWorld(normal, localSample);
-        sample = cosineSample;
-        pdf = cosinePdf;
-    }
-
-    brdf = albedoTexture->SampleOptional(texCoords) / pi<float>();
+    vec3 localWi = frame.ToLocal(wi);
+    if (localWi.y <= 0.0f)
+        return false;
+
+    return evaluatePerfectSpecularCoated(albedoTexture->SampleOptional(texCoords), ior, frame.ToLocal(-rayDir), currentIor, localWi, brdf, pdf);
+}
+
+std::optional<MaterialRecord> PerfectSpecularCoatedMaterial::GetRecord() const
+{
+    std::optional<TextureRecord> albedo = albedoTexture->GetRecord();
+    if (!albedo)
+        return std::nullopt;
+    return PerfectSpecularCoatedRecord{albedo.value(), ior};
 }
 
 }
\ No newline at end of file
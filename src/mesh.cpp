@@ -9,7 +9,9 @@
 
 #include <fmt/core.h>
 
+#include "asset_cache.h"
 #include "json_helper.h"
+#include "thread_pool.h"
 #include "util.h"
 
 namespace tracer
@@ -21,7 +23,7 @@ using json = nlohmann::json;
 namespace
 {
 
-    std::shared_ptr<Texture> parseGradientTextureJson(const json& obj)
+    std::shared_ptr<Texture> parseGradientTextureJson(const json& obj, bool shareImages)
     {
         JsonObjectParser parser;
         parser.RegisterField("top-left", JsonFieldType::Array);
@@ -39,7 +41,7 @@ namespace
         return std::make_shared<SimpleGradientTexture>(topL, topR, botR, botL);
     }
 
-    std::shared_ptr<Texture> parsePlainColorTextureJson(const json& obj)
+    std::shared_ptr<Texture> parsePlainColorTextureJson(const json& obj, bool shareImages)
     {
         JsonObjectParser parser;
         parser.RegisterField("value", JsonFieldType::String);
@@ -50,7 +52,7 @@ namespace
         return std::make_shared<SimpleGradientTexture>(color);
     }
 
-    std::shared_ptr<Texture> parseImageTextureJson(const json& obj)
+    std::shared_ptr<Texture> parseImageTextureJson(const json& obj, bool shareImages)
     {
         JsonObjectParser parser;
         parser.RegisterField("path", JsonFieldType::String);
@@ -61,10 +63,12 @@ namespace
         if (!fs::is_regular_file(path))
             throw std::runtime_error("");
 
+        if (shareImages)
+            return ImageTexture::LoadShared(path);
         return std::make_shared<ImageTexture>(path);
     }
 
-    std::unordered_map<std::string, std::function<std::shared_ptr<Texture>(const json&)>> typeNameToTextureFactory
+    std::unordered_map<std::string, std::function<std::shared_ptr<Texture>(const json&, bool)>> typeNameToTextureFactory
     {{"gradient", parseGradientTextureJson}, {"plain-color", parsePlainColorTextureJson}, {"image", parseImageTextureJson}};
 
     Vertex parseVertexJson(const json& obj)
@@ -161,8 +165,7 @@ namespace
         const std::vector<std::shared_ptr<Texture>>& textures,
         const std::vector<Vertex>& vertices,
         std::back_insert_iterator<std::vector<std::unique_ptr<Material>>> materialsInserter,
-        std::back_insert_iterator<std::vector<Triad>> triadsInserter,
-        std::optional<LightInfo>& lightInfo
+        std::back_insert_iterator<std::vector<Triad>> triadsInserter
     )
     {
         JsonObjectParser parser;
@@ -184,8 +187,6 @@ namespace
             materials.push_back(parseTypedJson<std::unique_ptr<Material>>(obj, typeNameToReflectiveMaterialFactory, textures));
         }
 
-        std::vector<std::array<glm::vec3, 3>> emissiveTriads;
-
         for (const auto& [indices, materialIndex] : indicesToMaterialIndex)
         {
             Triad triad{};
@@ -200,26 +201,6 @@ namespace
                 throw std::runtime_error("");
             triad.material = materials.at(materialIndex).get();
             *triadsInserter = triad;
-
-            if (triad.material->IsEmissive())
-            {
-                std::array<glm::vec3, 3> triadPos;
-                for (uint32_t i = 0; i < 3; i++)
-                    triadPos.at(i) = triad.vertices.at(i).pos;
-                emissiveTriads.push_back(triadPos);
-            }
-        }
-
-        if (!emissiveTriads.empty())
-        {
-            LightInfo info{};
-            info.nTriads = static_cast<uint32_t>(emissiveTriads.size());
-            info.triads = std::make_unique<std::array<glm::vec3, 3>[]>(emissiveTriads.size());
-            for (uint32_t i = 0; i < info.nTriads; i++)
-            {
-                info.triads[i] = emissiveTriads.at(i);
-            }
-            lightInfo.emplace(std::move(info));
         }
 
         std::ranges::copy(materials | std::views::as_rvalue, materialsInserter);
@@ -229,8 +210,7 @@ namespace
         const std::vector<std::shared_ptr<Texture>>& textures,
         const std::vector<Vertex>& vertices,
         std::back_insert_iterator<std::vector<std::unique_ptr<Material>>> materialsInserter,
-        std::back_insert_iterator<std::vector<Triad>> triadsInserter,
-        std::optional<LightInfo>& lightInfo
+        std::back_insert_iterator<std::vector<Triad>> triadsInserter
     )
     {
         JsonObjectParser parser;
@@ -253,8 +233,6 @@ namespace
             materials.push_back(parseTypedJson<std::unique_ptr<Material>>(obj, typeNameToRefractiveMaterialFactory, textures, result.Get(2)));
         }
 
-        std::vector<std::array<glm::vec3, 3>> emissiveTriads;
-
         for (const auto& [indices, materialIndex] : indicesToMaterialIndex)
         {
             Triad triad{};
@@ -269,26 +247,6 @@ namespace
                 throw std::runtime_error("");
             triad.material = materials.at(materialIndex).get();
             *triadsInserter = triad;
-
-            if (triad.material->IsEmissive())
-            {
-                std::array<glm::vec3, 3> triadPos;
-                for (uint32_t i = 0; i < 3; i++)
-                    triadPos.at(i) = triad.vertices.at(i).pos;
-                emissiveTriads.push_back(triadPos);
-            }
-        }
-
-        if (!emissiveTriads.empty())
-        {
-            LightInfo info{};
-            info.nTriads = static_cast<uint32_t>(emissiveTriads.size());
-            info.triads = std::make_unique<std::array<glm::vec3, 3>[]>(emissiveTriads.size());
-            for (uint32_t i = 0; i < info.nTriads; i++)
-            {
-                info.triads[i] = emissiveTriads.at(i);
-            }
-            lightInfo.emplace(std::move(info));
         }
 
         std::ranges::copy(materials | std::views::as_rvalue, materialsInserter);
@@ -300,14 +258,99 @@ namespace
                 const json&,
                 const std::vector<std::shared_ptr<Texture>>&,
                 const std::vector<Vertex>&, std::back_insert_iterator<std::vector<std::unique_ptr<Material>>>,
-                std::back_insert_iterator<std::vector<Triad>>,
-                std::optional<LightInfo>&
+                std::back_insert_iterator<std::vector<Triad>>
             )>> typeNameToPrimitiveFactory
     {{"reflective", parseReflectivePrimitiveJson}, {"refractive", parseRefractivePrimitiveJson}};
+
+    struct TriadIntersectionResult
+    {
+        SurfaceData surfaceData{};
+        float t{};
+    };
+    // distance to the hit on the faces the cull mode keeps, clockwise tells which face it is
+    std::optional<float> intersectTriad(const Triad& triad, CullMode cullMode, const glm::vec3& orig, const glm::vec3& dir, glm::vec2& coords, bool& clockwise)
+    {
+        glm::vec3 p0 = triad.vertices[0].pos;
+        glm::vec3 p1 = triad.vertices[1].pos;
+        glm::vec3 p2 = triad.vertices[2].pos;
+
+        std::optional<float> t;
+        if (cullMode == CullMode::None)
+        {
+            t = intersectTriangleMT(orig, dir, p0, p1, p2, coords);
+            if (!(clockwise = t.has_value()))
+                t = intersectTriangleCounterClockwiseMT(orig, dir, p0, p1, p2, coords);
+        }
+        else if (cullMode == CullMode::Back)
+        {
+            t = intersectTriangleMT(orig, dir, p0, p1, p2, coords);
+            clockwise = true;
+        }
+        else if (cullMode == CullMode::Front)
+        {
+            t = intersectTriangleCounterClockwiseMT(orig, dir, p0, p1, p2, coords);
+            clockwise = false;
+        }
+        if (!t || t.value() < 0.0f)
+            return std::nullopt;
+        return t;
+    }
+    struct TriadIntersectionFunc
+    {
+        CullMode cullMode{};
+        uint32_t lightIdOffset{};
+        const MaterialRecord* materialTable{};
+        std::optional<TriadIntersectionResult> operator()(const Triad& triad, const glm::vec3& orig, const glm::vec3& dir) const
+        {
+            using namespace glm;
+
+            Vertex v0 = triad.vertices.at(0);
+            Vertex v1 = triad.vertices.at(1);
+            Vertex v2 = triad.vertices.at(2);
+
+            vec3 p0 = v0.pos;
+            vec3 p1 = v1.pos;
+            vec3 p2 = v2.pos;
+
+            vec2 t0 = v0.texCoords;
+            vec2 t1 = v1.texCoords;
+            vec2 t2 = v2.texCoords;
+
+            vec2 coords;
+            bool clockwise{};
+            std::optional<float> opt = intersectTriad(triad, cullMode, orig, dir, coords, clockwise);
+            if (!opt)
+                return std::nullopt;
+            float t = opt.value();
+            vec3 normal = clockwise ?
+                cross(p2 - p0, p1 - p0) :
+                cross(p1 - p0, p2 - p0);
+
+            SurfaceData data{};
+            normal = normalize(normal);
+            data.normal = normal;
+            vec2 ab = t1 - t0;
+            vec2 ac = t2 - t0;
+            data.texCoords = t0 + ab * coords.x + ac * coords.y;
+            data.material = triad.material;
+            if (triad.materialId != invalidMaterialId)
+                data.materialRecord = &materialTable[triad.materialId];
+            if (triad.lightIndex != invalidLightId)
+                data.lightId = lightIdOffset + triad.lightIndex;
+            return TriadIntersectionResult{data, t};
+        }
+    };
+    struct TriadDistanceFunc
+    {
+        float operator()(const TriadIntersectionResult& result) const
+        {
+            return result.t;
+        }
+    };
 }
 
 
-std::unique_ptr<Mesh> Mesh::Create(const void* jsonObjPtr, const glm::mat4& transformation)
+std::unique_ptr<Mesh> Mesh::Create(const void* jsonObjPtr, const glm::mat4& transformation, bool shareTextures)
 {
     const json& jsonObj = *reinterpret_cast<const json*>(jsonObjPtr);
 
@@ -331,7 +374,7 @@ std::unique_ptr<Mesh> Mesh::Create(const void* jsonObjPtr, const glm::mat4& tran
 
     std::vector<std::shared_ptr<Texture>> textures;
     for (const json& obj : result.Get(0))
-        textures.push_back(parseTypedJson<std::shared_ptr<Texture>>(obj, typeNameToTextureFactory));
+        textures.push_back(parseTypedJson<std::shared_ptr<Texture>>(obj, typeNameToTextureFactory, shareTextures));
 
     std::vector<Vertex> vertices;
     for (const json& obj : result.Get(2))
@@ -339,18 +382,50 @@ std::unique_ptr<Mesh> Mesh::Create(const void* jsonObjPtr, const glm::mat4& tran
 
     std::vector<std::unique_ptr<Material>> materials;
     std::vector<Triad> triads;
-    std::vector<LightInfo> lightInfos;
     for (const json& obj : result.Get(1))
+        parseTypedJson<void>(obj, typeNameToPrimitiveFactory, textures, vertices, std::back_inserter(materials), std::back_inserter(triads));
+
+    // the light index of an emissive triad is its position in the emission profile
+    std::vector<Triad> emissiveTriads;
+    for (Triad& triad : triads)
+    {
+        if (!triad.material->IsEmissive())
+            continue;
+        triad.lightIndex = static_cast<uint32_t>(emissiveTriads.size());
+        emissiveTriads.push_back(triad);
+    }
+
+    // materials that have a record are copied into the material table, so that they can be shaded without virtual calls
+    std::vector<MaterialRecord> materialTable;
+    std::unordered_map<const Material*, uint16_t> materialToId;
+    for (const std::unique_ptr<Material>& material : materials)
+    {
+        std::optional<MaterialRecord> record = material->GetRecord();
+        if (!record)
+            continue;
+        if (materialTable.size() >= invalidMaterialId)
+            throw std::runtime_error("Too many materials in mesh");
+        materialToId.emplace(material.get(), static_cast<uint16_t>(materialTable.size()));
+        materialTable.push_back(record.value());
+    }
+    for (Triad& triad : triads)
+        if (auto it = materialToId.find(triad.material); it != materialToId.end())
+            triad.materialId = it->second;
+
+    std::vector<LightInfo> lightInfos;
+    if (!emissiveTriads.empty())
     {
-        std::optional<LightInfo> lightInfo;
-        parseTypedJson<void>(obj, typeNameToPrimitiveFactory, textures, vertices, std::back_inserter(materials), std::back_inserter(triads), lightInfo);
-        if (lightInfo)
-            lightInfos.push_back(std::move(lightInfo.value()));
+        LightInfo info{};
+        info.nTriads = static_cast<uint32_t>(emissiveTriads.size());
+        info.triads = std::make_unique<Triad[]>(emissiveTriads.size());
+        std::ranges::copy(emissiveTriads, info.triads.get());
+        lightInfos.push_back(std::move(info));
     }
 
     std::unique_ptr<Mesh> mesh(new Mesh());
     mesh->cullMode = cullMode;
     mesh->materialHolder = std::move(materials);
+    mesh->materialTable = std::move(materialTable);
     mesh->triads = std::move(triads);
     mesh->lightInfos = std::move(lightInfos);
 
@@ -376,88 +451,33 @@ std::unique_ptr<Mesh> Mesh::Create(std::string_view _path, const glm::mat4& tran
     return Create(&jsonObj, transformation);
 }
 
-std::optional<float> Mesh::Intersect(const glm::vec3& orig, const glm::vec3& dir, SurfaceData& surfaceData) const
+std::shared_ptr<const Mesh> Mesh::CreateShared(std::string_view _path, const glm::mat4& transformation)
 {
-    using namespace glm;
-    
-    assert(accelStruct.IsBuilt());
-
-    struct TriadIntersectionResult
-    {
-        SurfaceData surfaceData{};
-        float t{};
-    };
-    struct TriadIntersectionFunc
+    static AssetCache<const Mesh> cache;
+    std::string path(_path);
+    // the images of the mesh are part of its key, a mesh keeps pointing to the images it was loaded with
+    AssetKey key = AssetKeyBuilder().Add(hashFileAndReferences(path)).Add(std::span(&transformation[0][0], 16)).Finish();
+    return cache.GetOrLoad(key, [&]
     {
-        CullMode cullMode{};
-        std::optional<TriadIntersectionResult> operator()(const Triad& triad, const glm::vec3& orig, const glm::vec3& dir) const
+        std::string jsonStr = readTextFile(path);
+        json jsonObj;
+        try
         {
-            Vertex v0 = triad.vertices.at(0);
-            Vertex v1 = triad.vertices.at(1);
-            Vertex v2 = triad.vertices.at(2);
-
-            vec3 p0 = v0.pos;
-            vec3 p1 = v1.pos;
-            vec3 p2 = v2.pos;
-
-            vec2 t0 = v0.texCoords;
-            vec2 t1 = v1.texCoords;
-            vec2 t2 = v2.texCoords;
-
-            vec2 coords;
-            float t;
-            vec3 normal;
-
-            if (cullMode == CullMode::None)
-            {
-                auto opt = intersectTriangleMT(orig, dir, p0, p1, p2, coords);
-                bool clockwise;
-                if (!(clockwise = opt.has_value()))
-                    opt = intersectTriangleCounterClockwiseMT(orig, dir, p0, p1, p2, coords);
-                if (!opt)
-                    return std::nullopt;
-                if ((t = opt.value()) < 0.0f)
-                    return std::nullopt;
-                normal = clockwise ?
-                cross(p2 - p0, p1 - p0) :
-                cross(p1 - p0, p2 - p0);
-            }
-            else if (cullMode == CullMode::Back)
-            {
-                auto opt = intersectTriangleMT(orig, dir, p0, p1, p2, coords);
-                if (!opt)
-                    return std::nullopt;
-                if ((t = opt.value()) < 0.0f)
-                    return std::nullopt;
-                normal = cross(p2 - p0, p1 - p0);
-            }
-            else if (cullMode == CullMode::Front)
-            {
-                auto opt = intersectTriangleCounterClockwiseMT(orig, dir, p0, p1, p2, coords);
-                if (!opt)
-                    return std::nullopt;
-                if ((t = opt.value()) < 0.0f)
-                    return std::nullopt;
-                normal = cross(p1 - p0, p2 - p0);
-            }
-
-            SurfaceData data{};
-            normal = normalize(normal);
-            data.normal = normal;
-            vec2 ab = t1 - t0;
-            vec2 ac = t2 - t0;
-            data.texCoords = t0 + ab * coords.x + ac * coords.y;
-            data.material = triad.material;
-            return TriadIntersectionResult{data, t};
+            jsonObj = json::parse(jsonStr);
         }
-    };
-    struct TriadDistanceFunc
-    {
-        float operator()(const TriadIntersectionResult& result) const
+        catch(std::exception& e)
         {
-            return result.t;
+            throw std::runtime_error(e.what());
         }
-    };
+        return std::shared_ptr<const Mesh>(Create(&jsonObj, transformation, true));
+    });
+}
+
+std::optional<float> Mesh::Intersect(const glm::vec3& orig, const glm::vec3& dir, SurfaceData& surfaceData) const
+{
+    using namespace glm;
+    
+    assert(accelStruct.IsBuilt());
 
     // // linear intersection test
     // TriadIntersectionFunc f{};
@@ -492,7 +512,7 @@ std::optional<float> Mesh::Intersect(const glm::vec3& orig, const glm::vec3& dir
     std::optional<TriadIntersectionResult> result =
         accelStruct.Intersect(
             orig, dir,
-            TriadIntersectionFunc{cullMode},
+            TriadIntersectionFunc{cullMode, GetLightIdOffset(), materialTable.data()},
             TriadDistanceFunc{}
         );
     if (!result)
@@ -501,6 +521,62 @@ std::optional<float> Mesh::Intersect(const glm::vec3& orig, const glm::vec3& dir
     return result.value().t;
 }
 
+bool Mesh::Occluded(const glm::vec3& orig, const glm::vec3& dir, float maxDistance) const
+{
+    assert(accelStruct.IsBuilt());
+
+    return accelStruct.IntersectAny(orig, dir, maxDistance,
+        [&](const Triad& triad, const glm::vec3& orig, const glm::vec3& dir, float maxDistance)
+        {
+            glm::vec2 coords;
+            bool clockwise;
+            std::optional<float> t = intersectTriad(triad, cullMode, orig, dir, coords, clockwise);
+            return t && t.value() < maxDistance;
+        });
+}
+
+uint32_t Mesh::IntersectPacket(const RayPacket& packet, uint32_t laneMask, std::array<float, rayPacketSize>& tMax, std::array<SurfaceData, rayPacketSize>& surfaceData) const
+{
+    assert(accelStruct.IsBuilt());
+
+    TriadIntersectionFunc intersectionFunc{cullMode, GetLightIdOffset(), materialTable.data()};
+    uint32_t hitMask = 0u;
+    accelStruct.IntersectPacket(packet, laneMask,
+        [&](const Triad& triad, uint32_t laneMask, std::array<float, rayPacketSize>& tMax)
+        {
+            for (uint32_t i = 0; i < rayPacketSize; i++)
+            {
+                if (!(laneMask & (1u << i)))
+                    continue;
+                std::optional<TriadIntersectionResult> result = intersectionFunc(triad, packet.GetOrigin(i), packet.GetDirection(i));
+                if (!result || result.value().t >= tMax[i])
+                    continue;
+                tMax[i] = result.value().t;
+                surfaceData[i] = result.value().surfaceData;
+                hitMask |= 1u << i;
+            }
+        }, tMax);
+    return hitMask;
+}
+
+void Mesh::Transform(const glm::mat4& matrix)
+{
+    for (Triad& triad : triads)
+        for (Vertex& vertex : triad.vertices)
+        {
+            glm::vec4 v = matrix * glm::vec4(vertex.pos, 1.0f);
+            vertex.pos = glm::vec3(v);
+        }
+    accelStruct.Build(triads, [](uint32_t n, const std::function<void(uint32_t)>& func) { ThreadPool::GetShared().ParallelFor(n, func); });
+    for (LightInfo& lightInfo : lightInfos)
+        for (uint32_t i = 0; i < lightInfo.nTriads; i++)
+            for (Vertex& vertex : lightInfo.triads[i].vertices)
+            {
+                glm::vec4 v = matrix * glm::vec4(vertex.pos, 1.0f);
+                vertex.pos = glm::vec3(v);
+            }
+}
+
 void Mesh::GetEmissionProfiles(std::back_insert_iterator<std::vector<std::unique_ptr<EmissionProfile>>> profilesInserter) const
 {
     struct TriadsEmissionProfile : public EmissionProfile
@@ -510,97 +586,34 @@ void Mesh::GetEmissionProfiles(std::back_insert_iterator<std::vector<std::unique
         TriadsEmissionProfile(const LightInfo& lightInfo, CullMode cullMode) : lightInfo(lightInfo), cullMode(cullMode)
         {
         }
-        std::optional<EmissionSample> Sample(RNG& rng, const glm::vec3& orig, const glm::vec3& pNorm) const override
+        uint32_t GetTriangleCount() const override
+        {
+            return lightInfo.nTriads;
+        }
+        EmissiveTriangle GetTriangle(uint32_t index) const override
         {
             using namespace glm;
 
-            bool doubleFaced = cullMode == CullMode::None;
-            
-            std::vector<vec3> samples;
-            std::vector<vec3> normals;
-            for (uint32_t i = 0; i < lightInfo.nTriads; i++)
+            const Triad& triad = lightInfo.triads[index];
+
+            EmissiveTriangle triangle{};
+            for (uint32_t i = 0; i < 3; i++)
             {
-                vec3 normal;
-                vec3 ab = lightInfo.triads[i].at(1) - lightInfo.triads[i].at(0);
-                vec3 ac = lightInfo.triads[i].at(2) - lightInfo.triads[i].at(0);
-                if (cullMode == CullMode::Front)
-                    normal = cross(ab, ac);
-                else
-                    normal = cross(ac, ab);
-                normal = normalize(normal);
-
-                vec3 sample;
-                float pdf;
-                sampleTriangleUniform(rng, lightInfo.triads[i].at(0), lightInfo.triads[i].at(1), lightInfo.triads[i].at(2), sample, pdf);
-
-                vec3 dir = normalize(sample - orig);
-
-                samples.push_back(dir);
-                normals.push_back(normal);
+                triangle.points.at(i) = triad.vertices.at(i).pos;
+                triangle.texCoords.at(i) = triad.vertices.at(i).texCoords;
             }
 
-            if (samples.empty())
-                return std::nullopt;
-
-            int selectedIndex = rng.Uniform(0, static_cast<uint32_t>(samples.size()) - 1);
-            vec3 sample = samples.at(selectedIndex);
-            vec3 normal = normals.at(selectedIndex);
-
-            if (!doubleFaced && dot(-sample, normal) <= 0.0f)
-                return std::nullopt;
-            if (dot(sample, pNorm) <= 0.0f)
-                return std::nullopt;
+            vec3 ab = triangle.points.at(1) - triangle.points.at(0);
+            vec3 ac = triangle.points.at(2) - triangle.points.at(0);
+            vec3 normal = cullMode == CullMode::Front ? cross(ab, ac) : cross(ac, ab);
+            float normalLength = length(normal);
 
-            EmissionSample emissionSample{};
-            emissionSample.sample = sample;
-
-            return emissionSample;
-        }
-        virtual float GetPdf(const glm::vec3& orig, const glm::vec3& dir) const override
-        {
-            float accumPdf = 0.0f;
-            for (uint32_t i = 0; i < lightInfo.nTriads; i++)
-            {
-                auto points = lightInfo.triads[i];
-                glm::vec3 p0 = points.at(0);
-                glm::vec3 p1 = points.at(1);
-                glm::vec3 p2 = points.at(2);
-                glm::vec2 coords;
-                std::optional<float> t;
-                glm::vec3 normal;
-                if (cullMode == CullMode::None)
-                {
-                    t = intersectTriangleMT(orig, dir, p0, p1, p2, coords);
-                    bool clockwise;
-                    if (!(clockwise = t.has_value()))
-                        t = intersectTriangleCounterClockwiseMT(orig, dir, p0, p1, p2, coords);
-                    if (!t)
-                        continue;
-                    normal = clockwise ?
-                    cross(p2 - p0, p1 - p0) :
-                    cross(p1 - p0, p2 - p0);
-                }
-                else if (cullMode == CullMode::Back)
-                {
-                    t = intersectTriangleMT(orig, dir, p0, p1, p2, coords);
-                    if (!t)
-                        continue;
-                    normal = cross(p2 - p0, p1 - p0);
-                }
-                else if (cullMode == CullMode::Front)
-                {
-                    t = intersectTriangleCounterClockwiseMT(orig, dir, p0, p1, p2, coords);
-                    if (!t)
-                        continue;
-                    normal = cross(p1 - p0, p2 - p0);
-                }
-                normal = normalize(normal);
-                float distance = t.value();
-                float area = 0.5f * length(cross(p1 - p0, p2 - p0));
-                accumPdf += distance * distance / (abs(dot(-dir, normal)) * area);
-            }
+            triangle.normal = normalLength > 0.0f ? normal / normalLength : vec3(0.0f);
+            triangle.area = 0.5f * normalLength;
+            triangle.doubleFaced = cullMode == CullMode::None;
+            triangle.material = triad.material;
 
-            return accumPdf / static_cast<float>(lightInfo.nTriads);
+            return triangle;
         }
     };
     for (const LightInfo& lightInfo : lightInfos)
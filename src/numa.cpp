@@ -0,0 +1,130 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "util.h"
+
+namespace tracer
+{
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+#if defined(__linux__)
+    // affinity of the thread before it was pinned, kept until it is unpinned so that repinning starts from it as well
+    thread_local std::optional<cpu_set_t> originalAffinity;
+#endif
+
+    // parses the kernel's cpu list format, e.g. "0-3,8-11"
+    std::vector<uint32_t> parseCpuList(const std::string& list)
+    {
+        std::vector<uint32_t> cpus;
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+                end = list.size();
+            std::string range = list.substr(pos, end - pos);
+            pos = end + 1;
+
+            size_t dash = range.find('-');
+            try
+            {
+                uint32_t first = static_cast<uint32_t>(std::stoul(range.substr(0, dash)));
+                uint32_t last = dash == std::string::npos ? first : static_cast<uint32_t>(std::stoul(range.substr(dash + 1)));
+                for (uint32_t cpu = first; cpu <= last; cpu++)
+                    cpus.push_back(cpu);
+            }
+            catch (std::exception&)
+            {
+                // blank line or trailing newline
+            }
+        }
+        return cpus;
+    }
+
+    std::vector<NumaNode> queryNumaNodes()
+    {
+        std::vector<NumaNode> nodes;
+#if defined(__linux__)
+        std::error_code error;
+        fs::path nodeDir("/sys/devices/system/node");
+        for (const fs::directory_entry& entry : fs::directory_iterator(nodeDir, error))
+        {
+            std::string name = entry.path().filename().string();
+            if (!name.starts_with("node") || name.size() == 4 || !std::all_of(name.begin() + 4, name.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+                continue;
+            NumaNode node{};
+            node.id = static_cast<uint32_t>(std::stoul(name.substr(4)));
+            node.cpus = parseCpuList(readTextFile((entry.path() / "cpulist").string()));
+            if (!node.cpus.empty())
+                nodes.push_back(std::move(node));
+        }
+        std::ranges::sort(nodes, {}, &NumaNode::id);
+#endif
+        if (nodes.empty())
+        {
+            NumaNode node{};
+            node.id = 0;
+            for (uint32_t cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); cpu++)
+                node.cpus.push_back(cpu);
+            nodes.push_back(std::move(node));
+        }
+        return nodes;
+    }
+
+}
+
+const std::vector<NumaNode>& getNumaNodes()
+{
+    static const std::vector<NumaNode> nodes = queryNumaNodes();
+    return nodes;
+}
+
+bool pinCurrentThread(std::span<const uint32_t> cpus)
+{
+#if defined(__linux__)
+    if (!originalAffinity)
+    {
+        cpu_set_t affinity;
+        if (pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity) != 0)
+            return false;
+        originalAffinity = affinity;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : cpus)
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &*originalAffinity))
+            CPU_SET(cpu, &set);
+    if (CPU_COUNT(&set) == 0)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+void unpinCurrentThread()
+{
+#if defined(__linux__)
+    if (!originalAffinity)
+        return;
+    pthread_setaffinity_np(pthread_self(), sizeof(*originalAffinity), &*originalAffinity);
+    originalAffinity.reset();
+#endif
+}
+
+}
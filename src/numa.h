@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace tracer
+{
+
+struct NumaNode
+{
+    uint32_t id;
+    std::vector<uint32_t> cpus;
+};
+
+// the numa nodes of the machine and their cpus, read once; a single node holding every cpu
+// where the topology cannot be queried
+const std::vector<NumaNode>& getNumaNodes();
+
+// restricts the calling thread to those of the given cpus it may already run on (the process may be confined to a
+// cpuset), false where pinning is not supported or none of them is allowed, the thread is left as it was then
+bool pinCurrentThread(std::span<const uint32_t> cpus);
+// lets the calling thread run on the cpus it had before it was first pinned again
+void unpinCurrentThread();
+
+// node of worker thread out of nThreads, consecutive workers share a node so that every node
+// gets a contiguous block of workers
+inline uint32_t getWorkerNode(uint32_t thread, uint32_t nThreads, uint32_t nNodes)
+{
+    return static_cast<uint32_t>(static_cast<uint64_t>(thread) * nNodes / nThreads);
+}
+
+}
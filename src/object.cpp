@@ -62,4 +62,142 @@ std::optional<float> Plane::Intersect(const glm::vec3& orig, const glm::vec3& di
     return t;
 }
 
+namespace
+{
+
+    // the emissive triangles of a moved instance, where the instance puts them
+    class TransformedEmissionProfile : public EmissionProfile
+    {
+    public:
+        TransformedEmissionProfile(std::unique_ptr<EmissionProfile> profile, const glm::mat4& toWorld, const glm::mat3& normalToWorld)
+            : profile(std::move(profile)), toWorld(toWorld), normalToWorld(normalToWorld)
+        {}
+        uint32_t GetTriangleCount() const override
+        {
+            return profile->GetTriangleCount();
+        }
+        EmissiveTriangle GetTriangle(uint32_t index) const override
+        {
+            using namespace glm;
+
+            EmissiveTriangle triangle = profile->GetTriangle(index);
+            for (vec3& point : triangle.points)
+                point = vec3(toWorld * vec4(point, 1.0f));
+            triangle.normal = normalize(normalToWorld * triangle.normal);
+            triangle.area = 0.5f * length(cross(triangle.points[1] - triangle.points[0], triangle.points[2] - triangle.points[0]));
+            return triangle;
+        }
+    private:
+        std::unique_ptr<EmissionProfile> profile;
+        glm::mat4 toWorld;
+        glm::mat3 normalToWorld;
+    };
+
+}
+
+std::optional<float> ObjectInstance::Intersect(const glm::vec3& orig, const glm::vec3& dir, SurfaceData& surfaceData) const
+{
+    using namespace glm;
+
+    if (!isTransformed)
+    {
+        std::optional<float> t = object->Intersect(orig, dir, surfaceData);
+        if (t && surfaceData.lightId != invalidLightId)
+            surfaceData.lightId += GetLightIdOffset();
+        return t;
+    }
+
+    // the object expects a unit direction, the distance is scaled back to the world's
+    vec3 objectDir = vec3(toObject * vec4(dir, 0.0f));
+    float scale = length(objectDir);
+    std::optional<float> t = object->Intersect(vec3(toObject * vec4(orig, 1.0f)), objectDir / scale, surfaceData);
+    if (!t)
+        return std::nullopt;
+    surfaceData.normal = normalize(normalToWorld * surfaceData.normal);
+    if (surfaceData.lightId != invalidLightId)
+        surfaceData.lightId += GetLightIdOffset();
+    return t.value() / scale;
+}
+
+uint32_t ObjectInstance::IntersectPacket(const RayPacket& packet, uint32_t laneMask, std::array<float, rayPacketSize>& tMax, std::array<SurfaceData, rayPacketSize>& surfaceData) const
+{
+    using namespace glm;
+
+    if (!isTransformed)
+    {
+        uint32_t hitMask = object->IntersectPacket(packet, laneMask, tMax, surfaceData);
+        for (uint32_t i = 0; i < rayPacketSize; i++)
+            if ((hitMask & (1u << i)) && surfaceData[i].lightId != invalidLightId)
+                surfaceData[i].lightId += GetLightIdOffset();
+        return hitMask;
+    }
+
+    RayPacket objectPacket;
+    std::array<float, rayPacketSize> scales;
+    std::array<float, rayPacketSize> objectTMax;
+    for (uint32_t i = 0; i < rayPacketSize; i++)
+    {
+        vec3 objectDir = vec3(toObject * vec4(packet.GetDirection(i), 0.0f));
+        scales[i] = length(objectDir);
+        objectPacket.SetRay(i, vec3(toObject * vec4(packet.GetOrigin(i), 1.0f)), objectDir / scales[i]);
+        objectTMax[i] = tMax[i] * scales[i];
+    }
+
+    uint32_t hitMask = object->IntersectPacket(objectPacket, laneMask, objectTMax, surfaceData);
+    for (uint32_t i = 0; i < rayPacketSize; i++)
+    {
+        if (!(hitMask & (1u << i)))
+            continue;
+        tMax[i] = objectTMax[i] / scales[i];
+        surfaceData[i].normal = normalize(normalToWorld * surfaceData[i].normal);
+        if (surfaceData[i].lightId != invalidLightId)
+            surfaceData[i].lightId += GetLightIdOffset();
+    }
+    return hitMask;
+}
+
+bool ObjectInstance::Occluded(const glm::vec3& orig, const glm::vec3& dir, float maxDistance) const
+{
+    using namespace glm;
+
+    if (!isTransformed)
+        return object->Occluded(orig, dir, maxDistance);
+
+    vec3 objectDir = vec3(toObject * vec4(dir, 0.0f));
+    float scale = length(objectDir);
+    return object->Occluded(vec3(toObject * vec4(orig, 1.0f)), objectDir / scale, maxDistance * scale);
+}
+
+void ObjectInstance::GetEmissionProfiles(std::back_insert_iterator<std::vector<std::unique_ptr<EmissionProfile>>> profilesInserter) const
+{
+    if (!isTransformed)
+    {
+        object->GetEmissionProfiles(profilesInserter);
+        return;
+    }
+
+    std::vector<std::unique_ptr<EmissionProfile>> profiles;
+    object->GetEmissionProfiles(std::back_inserter(profiles));
+    for (std::unique_ptr<EmissionProfile>& profile : profiles)
+        *profilesInserter++ = std::make_unique<TransformedEmissionProfile>(std::move(profile), toWorld, normalToWorld);
+}
+
+void ObjectInstance::SetTransformation(const glm::mat4& transformation)
+{
+    using namespace glm;
+
+    isTransformed = transformation != mat4(1.0f);
+    toWorld = transformation;
+    toObject = inverse(transformation);
+    normalToWorld = transpose(inverse(mat3(transformation)));
+
+    // the box around the corners of the object's box
+    AABB objectBox = object->GetBox();
+    vec3 corners[2]{objectBox.GetMin(), objectBox.GetMax()};
+    vec3 first = vec3(toWorld * vec4(corners[0], 1.0f));
+    box = AABB(first, first);
+    for (uint32_t i = 1; i < 8; i++)
+        box.Grow(vec3(toWorld * vec4(corners[i & 1].x, corners[(i >> 1) & 1].y, corners[(i >> 2) & 1].z, 1.0f)));
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <tracer/render_service.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "asset_cache.h"
+
+namespace tracer
+{
+
+// hands out the cores to the waiting workers of the jobs, strictly by priority and within a priority to the job
+// holding the fewest cores (the older job on a tie)
+class CoreScheduler
+{
+public:
+    struct Client
+    {
+        int32_t priority = 0;
+        uint64_t order = 0;
+        uint32_t nHeld = 0;
+        uint32_t nWaiting = 0;
+    };
+
+    explicit CoreScheduler(uint32_t nCores) : nCores(nCores)
+    {}
+    void Add(Client& client)
+    {
+        std::lock_guard lock(mutex);
+        client.order = nextOrder++;
+        clients.push_back(&client);
+    }
+    void Remove(Client& client)
+    {
+        {
+            std::lock_guard lock(mutex);
+            std::erase(clients, &client);
+        }
+        condition.notify_all();
+    }
+    void Acquire(Client& client)
+    {
+        std::unique_lock lock(mutex);
+        client.nWaiting++;
+        condition.wait(lock, [&] { return nInUse < nCores && isNext(client); });
+        client.nWaiting--;
+        client.nHeld++;
+        nInUse++;
+    }
+    void Release(Client& client)
+    {
+        {
+            std::lock_guard lock(mutex);
+            client.nHeld--;
+            nInUse--;
+        }
+        condition.notify_all();
+    }
+private:
+    // requires the lock
+    bool isNext(const Client& client) const
+    {
+        for (const Client* other : clients)
+        {
+            if (other == &client || other->nWaiting == 0)
+                continue;
+            if (other->priority != client.priority)
+            {
+                if (other->priority > client.priority)
+                    return false;
+                continue;
+            }
+            if (other->nHeld < client.nHeld || (other->nHeld == client.nHeld && other->order < client.order))
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t nCores;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<Client*> clients;
+    uint32_t nInUse = 0;
+    uint64_t nextOrder = 0;
+};
+
+namespace
+{
+
+    // the cores of a job, it takes part in the scheduling for as long as the job's tracer holds on to it
+    class ScheduledCoreGate : public CoreGate
+    {
+    public:
+        ScheduledCoreGate(std::shared_ptr<CoreScheduler> scheduler, int32_t priority) : scheduler(std::move(scheduler))
+        {
+            client.priority = priority;
+            this->scheduler->Add(client);
+        }
+        ~ScheduledCoreGate()
+        {
+            scheduler->Remove(client);
+        }
+        void Acquire() override
+        {
+            scheduler->Acquire(client);
+        }
+        void Release() override
+        {
+            scheduler->Release(client);
+        }
+    private:
+        std::shared_ptr<CoreScheduler> scheduler;
+        CoreScheduler::Client client;
+    };
+
+}
+
+RenderService::RenderService(uint32_t nCores)
+    : nCores(std::max(nCores, 1u)), scheduler(std::make_shared<CoreScheduler>(this->nCores)), sceneCache(std::make_unique<AssetCache<const Scene>>())
+{
+}
+
+RenderService::~RenderService() = default;
+
+std::shared_ptr<const Scene> RenderService::LoadScene(std::string_view _path)
+{
+    // the meshes the scene references and their images are part of its content
+    std::string path(_path);
+    return sceneCache->GetOrLoad(hashFileAndReferences(path), [&] { return std::shared_ptr<const Scene>(Scene::Create(path)); });
+}
+
+std::unique_ptr<RenderService::Job> RenderService::Submit(std::shared_ptr<const Scene> scene, TracerConfiguration config, int32_t priority)
+{
+    if (!scene)
+        throw std::runtime_error("no scene to render");
+
+    config.nThreads = nCores;
+    config.coreGate = std::make_shared<ScheduledCoreGate>(scheduler, priority);
+    std::unique_ptr<Job> job(new Job(std::move(scene), config));
+    job->handle = job->tracer.Submit(job->canvas, *job->scene);
+    return job;
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include <tracer/emission_profile.h>
+
+namespace tracer
+{
+
+// weighted reservoir holding one light sample picked out of a stream of candidates
+// (bitterli et al. 2020, "spatiotemporal reservoir resampling for real-time ray tracing with dynamic direct lighting")
+struct LightReservoir
+{
+    glm::vec3 lightPoint{};
+    glm::vec3 emission{};
+    uint32_t lightId = invalidLightId;
+    float targetPdf = 0.0f; // unshadowed luminance contribution of the kept sample at the owning pixel
+    float weightSum = 0.0f;
+    float nCandidates = 0.0f; // number of candidates the reservoir stands for
+    float weight = 0.0f; // contribution weight of the kept sample, an estimate of 1 / pdf
+
+    // streams one candidate in with resampling weight w, u decides whether it replaces the kept sample
+    void Update(uint32_t candidateLightId, const glm::vec3& candidatePoint, const glm::vec3& candidateEmission, float candidateTargetPdf, float w, float u)
+    {
+        weightSum += w;
+        if (w <= 0.0f || u * weightSum >= w)
+            return;
+        lightId = candidateLightId;
+        lightPoint = candidatePoint;
+        emission = candidateEmission;
+        targetPdf = candidateTargetPdf;
+    }
+    void Finalize()
+    {
+        weight = targetPdf > 0.0f && nCandidates > 0.0f ?
+            weightSum / (nCandidates * targetPdf) :
+            0.0f;
+    }
+    bool IsValid() const
+    {
+        return lightId != invalidLightId && weight > 0.0f;
+    }
+};
+
+}
\ No newline at end of file
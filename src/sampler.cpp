@@ -1,32 +1,108 @@
 #include <tracer/sampler.h>
 
+#include <algorithm>
 #include <functional>
 
-#include "util.h"
-
 namespace tracer
 {
 
-glm::vec3 transformLocalSampleToWorld(const glm::vec3& normal, const glm::vec3& sample)
+namespace
 {
-    using namespace glm;
+    constexpr float oneMinusEpsilon = 0x1.fffffep-1f;
+
+    uint32_t reverseBits(uint32_t x)
+    {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    uint32_t hashUint(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x21f0aaadu;
+        x ^= x >> 15;
+        x *= 0x735a2d97u;
+        x ^= x >> 15;
+        return x;
+    }
+
+    uint32_t hashCombine(uint32_t seed, uint32_t v)
+    {
+        return seed ^ (hashUint(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+    }
+
+    // only higher bits are affected by lower bits, so after a bit reversal this is a nested uniform scramble
+    uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+    {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+    {
+        x = reverseBits(x);
+        x = laineKarrasPermutation(x, seed);
+        x = reverseBits(x);
+        return x;
+    }
+
+    // first dimension of sobol is the van der corput sequence
+    uint32_t sobol0(uint32_t index)
+    {
+        return reverseBits(index);
+    }
 
-    vec3 axis1, axis2;
-    createCoordSystemWithUpVec(normal, axis1, axis2);
-    mat3 localToWorld(axis1, normal, axis2);
+    // second dimension, generated by the primitive polynomial x + 1
+    uint32_t sobol1(uint32_t index)
+    {
+        uint32_t result = 0u;
+        for (uint32_t v = 1u << 31; index != 0u; index >>= 1, v ^= v >> 1)
+            if (index & 1u)
+                result ^= v;
+        return result;
+    }
 
-    return normalize(localToWorld * sample);
+    float toUnitFloat(uint32_t x)
+    {
+        return std::min(static_cast<float>(x) * 0x1p-32f, oneMinusEpsilon);
+    }
 }
 
-glm::vec3 transformWorldSampleToLocal(const glm::vec3& normal, const glm::vec3& sample)
+void IndependentSampler::StartPixelSample(const glm::u32vec2& pixel, uint32_t sampleIndex)
 {
-    using namespace glm;
+    uint32_t h = hashCombine(hashCombine(hashCombine(hashUint(seed), pixel.x), pixel.y), firstSample + sampleIndex);
+    rng.Seed(h);
+}
 
-    vec3 axis1, axis2;
-    createCoordSystemWithUpVec(normal, axis1, axis2);
-    mat3 localToWorld(axis1, normal, axis2);
+void SobolSampler::StartPixelSample(const glm::u32vec2& pixel, uint32_t sampleIndex)
+{
+    pixelSeed = hashCombine(hashCombine(hashUint(seed), pixel.x), pixel.y);
+    this->sampleIndex = firstSample + sampleIndex;
+    dimension = 0u;
+}
 
-    return normalize(inverse(localToWorld) * sample);
+float SobolSampler::Get1D()
+{
+    uint32_t dimensionSeed = hashCombine(pixelSeed, dimension++);
+    uint32_t index = nestedUniformScramble(sampleIndex, dimensionSeed);
+    uint32_t x = nestedUniformScramble(sobol0(index), hashCombine(dimensionSeed, 0u));
+    return toUnitFloat(x);
+}
+
+glm::vec2 SobolSampler::Get2D()
+{
+    uint32_t dimensionSeed = hashCombine(pixelSeed, dimension++);
+    uint32_t index = nestedUniformScramble(sampleIndex, dimensionSeed);
+    uint32_t x = nestedUniformScramble(sobol0(index), hashCombine(dimensionSeed, 0u));
+    uint32_t y = nestedUniformScramble(sobol1(index), hashCombine(dimensionSeed, 1u));
+    return glm::vec2(toUnitFloat(x), toUnitFloat(y));
 }
 
 }
\ No newline at end of file
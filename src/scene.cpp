@@ -1,11 +1,20 @@
 #include <tracer/scene.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <thread>
+#include <tuple>
+
 #include <glm/gtc/matrix_transform.hpp>
 #include <nlohmann/json.hpp>
 
 #include <tracer/mesh.h>
 
 #include "json_helper.h"
+#include "numa.h"
+#include "thread_pool.h"
 #include "util.h"
 
 namespace tracer
@@ -77,38 +86,40 @@ namespace
         {"rotation", parseRotationTransformationJson}
     };
 
-    std::unique_ptr<Object> parseInlineMeshObjectJson(const json& obj, const glm::mat4& transformation)
+    std::unique_ptr<Object> parseInlineMeshObjectJson(const json& obj, const glm::mat4& transformation, bool shareAssets)
     {
-        return Mesh::Create(&obj, transformation);
+        return Mesh::Create(&obj, transformation, shareAssets);
     }
 
-    std::unique_ptr<Object> parseFileMeshObjectJson(const json& obj, const glm::mat4& transformation)
+    std::unique_ptr<Object> parseFileMeshObjectJson(const json& obj, const glm::mat4& transformation, bool shareAssets)
     {
         JsonObjectParser parser;
         parser.RegisterField("path", JsonFieldType::String);
         auto result = parser.Parse(obj);
 
         std::string path = result.Get(0);
+        if (shareAssets)
+            return std::make_unique<ObjectInstance>(Mesh::CreateShared(path, transformation));
         return Mesh::Create(path, transformation);
     }
 
-    std::unordered_map<std::string, std::function<std::unique_ptr<Object>(const json&, const glm::mat4&)>> typeNameToMeshFactory
+    std::unordered_map<std::string, std::function<std::unique_ptr<Object>(const json&, const glm::mat4&, bool)>> typeNameToMeshFactory
     {
         {"inline", parseInlineMeshObjectJson},
         {"file", parseFileMeshObjectJson}
     };
 
-    std::unique_ptr<Object> parseMeshObjectJson(const json& obj, const glm::mat4& transformation)
+    std::unique_ptr<Object> parseMeshObjectJson(const json& obj, const glm::mat4& transformation, bool shareAssets)
     {
-        return parseTypedJson<std::unique_ptr<Object>>(obj, typeNameToMeshFactory, transformation);
+        return parseTypedJson<std::unique_ptr<Object>>(obj, typeNameToMeshFactory, transformation, shareAssets);
     }
 
-    std::unordered_map<std::string, std::function<std::unique_ptr<Object>(const json&, const glm::mat4&)>> typeNameToObjectFactory
+    std::unordered_map<std::string, std::function<std::unique_ptr<Object>(const json&, const glm::mat4&, bool)>> typeNameToObjectFactory
     {
         {"mesh", parseMeshObjectJson}
     };
 
-    std::unique_ptr<Object> parseObjectJson(const json& obj)
+    std::unique_ptr<Object> parseObjectJson(const json& obj, bool shareAssets)
     {
         JsonObjectParser parser;
         parser.RegisterField("transformations", JsonFieldType::Array);
@@ -120,7 +131,7 @@ namespace
             transformation = transformation * parseTypedJson<glm::mat4>(transformationObj, typeNameToTransformationFactory);
 
         const json& objectObj = result.Get(1);
-        return parseTypedJson<std::unique_ptr<Object>>(objectObj, typeNameToObjectFactory, transformation);
+        return parseTypedJson<std::unique_ptr<Object>>(objectObj, typeNameToObjectFactory, transformation, shareAssets);
     }
 
     Lens parseRawParamsLensJson(const json& obj)
@@ -222,9 +233,90 @@ namespace
         return camera;
     }
 
+    // the indices of the keys around time and how far between them it lies, time is clamped to the keys
+    std::tuple<size_t, size_t, float> findKeys(size_t nKeys, float time, const std::function<float(size_t)>& getTime)
+    {
+        size_t next = 0;
+        while (next < nKeys && getTime(next) <= time)
+            next++;
+        if (next == 0)
+            return {0, 0, 0.0f};
+        if (next == nKeys)
+            return {nKeys - 1, nKeys - 1, 0.0f};
+        float prevTime = getTime(next - 1);
+        return {next - 1, next, (time - prevTime) / (getTime(next) - prevTime)};
+    }
+
+    // along the great circle between two unit directions
+    glm::vec3 slerpDirection(const glm::vec3& a, const glm::vec3& b, float t)
+    {
+        using namespace glm;
+
+        float angle = acos(clamp(dot(a, b), -1.0f, 1.0f));
+        if (angle < 1e-4f)
+            return normalize(mix(a, b, t));
+        return (sin((1.0f - t) * angle) * a + sin(t * angle) * b) / sin(angle);
+    }
+
+    Camera interpolateCameras(const Camera& a, const Camera& b, float t)
+    {
+        using namespace glm;
+
+        Camera camera{};
+        camera.pos = mix(a.pos, b.pos, t);
+        camera.dir = slerpDirection(a.dir, b.dir, t);
+        camera.lens.fov = mix(a.lens.fov, b.lens.fov, t);
+        camera.lens.defocusDiskRadius = mix(a.lens.defocusDiskRadius, b.lens.defocusDiskRadius, t);
+        camera.lens.focalPointDistance = mix(a.lens.focalPointDistance, b.lens.focalPointDistance, t);
+        return camera;
+    }
+
+    glm::mat4 interpolateObjectKeys(const ObjectKeyframe& a, const ObjectKeyframe& b, float t)
+    {
+        using namespace glm;
+
+        mat4 transformation = translate(mat4(1.0f), mix(a.translation, b.translation, t));
+        transformation = transformation * mat4_cast(slerp(a.rotation, b.rotation, t));
+        return scale(transformation, mix(a.scale, b.scale, t));
+    }
+
+    bool isEmissive(const Object& obj)
+    {
+        std::vector<std::unique_ptr<EmissionProfile>> profiles;
+        obj.GetEmissionProfiles(std::back_inserter(profiles));
+        return std::ranges::any_of(profiles, [](const std::unique_ptr<EmissionProfile>& profile) { return profile->GetTriangleCount() > 0; });
+    }
+
+}
+
+std::unique_ptr<Scene> Scene::Create(std::string_view path)
+{
+    return load(path, true, true);
 }
 
-std::unique_ptr<Scene> Scene::Create(std::string_view _path)
+std::vector<std::unique_ptr<Scene>> Scene::CreateNodeReplicas(std::string_view path)
+{
+    const std::vector<NumaNode>& nodes = getNumaNodes();
+    std::vector<std::unique_ptr<Scene>> replicas(nodes.size());
+    ThreadPool::GetShared().Run(static_cast<uint32_t>(nodes.size()), [&](uint32_t node)
+    {
+        // the objects are loaded on this thread, pool workers elsewhere would touch the memory first
+        pinCurrentThread(nodes[node].cpus);
+        try
+        {
+            replicas[node] = load(path, false, false);
+        }
+        catch (...)
+        {
+            unpinCurrentThread();
+            throw;
+        }
+        unpinCurrentThread();
+    });
+    return replicas;
+}
+
+std::unique_ptr<Scene> Scene::load(std::string_view _path, bool loadObjectsInParallel, bool shareAssets)
 {
     std::string path(_path);
     std::string jsonStr = readTextFile(path);
@@ -248,21 +340,112 @@ std::unique_ptr<Scene> Scene::Create(std::string_view _path)
 
     scene->camera = parseCameraJson(result.Get(0));
 
-    for (const json& obj : result.Get(1))
-        scene->objects.push_back(parseObjectJson(obj));
+    if (loadObjectsInParallel)
+    {
+        // meshes are loaded and their bvhs built in parallel by workers that take the next object until none is left;
+        // Run waits for all of them before it rethrows an error since the tasks refer to the parsed json
+        const json& objs = result.Get(1);
+        uint32_t nObjects = static_cast<uint32_t>(objs.size());
+        std::vector<std::unique_ptr<Object>> loadedObjects(nObjects);
+        std::atomic_uint32_t nextObject = 0;
+        ThreadPool::GetShared().Run(std::min(nObjects, std::max(std::thread::hardware_concurrency(), 1u)),
+            [&](uint32_t)
+            {
+                for (uint32_t i = nextObject++; i < nObjects; i = nextObject++)
+                    loadedObjects[i] = parseObjectJson(objs[i], shareAssets);
+            });
+        for (std::unique_ptr<Object>& loadedObject : loadedObjects)
+            scene->objects.push_back(std::move(loadedObject));
+    }
+    else
+    {
+        for (const json& obj : result.Get(1))
+            scene->objects.push_back(parseObjectJson(obj, shareAssets));
+    }
     scene->buildAccel();
+    scene->buildLights();
 
     scene->ambientColor = parseVecJson<3>(result.Get(2));
 
     return scene;
 }
 
+void Scene::SetObjectTransformations(std::span<const ObjectTransformation> transformations)
+{
+    bool isBvhStale = false;
+    bool isMoved = false;
+    bool areLightsMoved = false;
+    for (const ObjectTransformation& transformation : transformations)
+    {
+        if (transformation.object >= objects.size())
+            throw std::runtime_error("no object " + std::to_string(transformation.object) + " in the scene");
+        std::unique_ptr<Object>& obj = objects[transformation.object];
+
+        ObjectInstance* instance = dynamic_cast<ObjectInstance*>(obj.get());
+        if (instance && instance->GetTransformation() == transformation.transformation)
+            continue;
+        if (!instance)
+        {
+            if (transformation.transformation == glm::mat4(1.0f))
+                continue;
+            BoundedObject* bounded = dynamic_cast<BoundedObject*>(obj.get());
+            if (!bounded)
+                throw std::runtime_error("unbounded objects can't be moved");
+
+            // the object moves into an instance of its own on its first move, which takes over its light ids;
+            // the bvh holds the object itself until it is built again
+            uint32_t lightIdOffset = obj->GetLightIdOffset();
+            obj->SetLightIdOffset(0u);
+            obj.release();
+            auto newInstance = std::make_unique<ObjectInstance>(std::shared_ptr<const BoundedObject>(bounded));
+            newInstance->SetLightIdOffset(lightIdOffset);
+            instance = newInstance.get();
+            obj = std::move(newInstance);
+            isBvhStale = true;
+        }
+
+        instance->SetTransformation(transformation.transformation);
+        isMoved = true;
+        areLightsMoved = areLightsMoved || isEmissive(*instance);
+    }
+    if (!isMoved)
+        return;
+
+    if (isBvhStale || !bvh.Refit())
+        buildAccel();
+    if (areLightsMoved)
+        buildLights();
+}
+
+void Scene::Animate(const Animation& animation, float time)
+{
+    const std::vector<CameraKeyframe>& cameraKeys = animation.cameraKeys;
+    if (!cameraKeys.empty())
+    {
+        auto [prev, next, t] = findKeys(cameraKeys.size(), time, [&](size_t i) { return cameraKeys[i].time; });
+        camera = interpolateCameras(cameraKeys[prev].camera, cameraKeys[next].camera, t);
+    }
+
+    std::map<uint32_t, std::vector<const ObjectKeyframe*>> objectKeys;
+    for (const ObjectKeyframe& key : animation.objectKeys)
+        objectKeys[key.object].push_back(&key);
+    std::vector<ObjectTransformation> transformations;
+    for (const auto& [object, keys] : objectKeys)
+    {
+        auto [prev, next, t] = findKeys(keys.size(), time, [&](size_t i) { return keys[i]->time; });
+        transformations.push_back(ObjectTransformation{object, interpolateObjectKeys(*keys[prev], *keys[next], t)});
+    }
+    SetObjectTransformations(transformations);
+}
+
 void Scene::buildAccel()
 {
+    unboundedObjects.clear();
     bvh.Build(objects
         | std::views::transform([](const std::unique_ptr<Object>& obj) { return obj.get(); })
         | std::views::filter([](const Object* obj) { return dynamic_cast<const BoundedObject*>(obj) != nullptr; })
-        | std::views::transform([](const Object* obj) { return dynamic_cast<const BoundedObject*>(obj); }));
+        | std::views::transform([](const Object* obj) { return dynamic_cast<const BoundedObject*>(obj); }),
+        [](uint32_t n, const std::function<void(uint32_t)>& func) { ThreadPool::GetShared().ParallelFor(n, func); });
     std::ranges::for_each(objects
         | std::views::transform([](const std::unique_ptr<Object>& obj) { return obj.get(); })
         | std::views::filter([](const Object* obj) { return dynamic_cast<const BoundedObject*>(obj) == nullptr; }),
@@ -270,6 +453,21 @@ void Scene::buildAccel()
     );
 }
 
+void Scene::buildLights()
+{
+    std::vector<std::unique_ptr<EmissionProfile>> profiles;
+    uint32_t nLights = 0;
+    for (const std::unique_ptr<Object>& obj : objects)
+    {
+        obj->SetLightIdOffset(nLights);
+        size_t first = profiles.size();
+        obj->GetEmissionProfiles(std::back_inserter(profiles));
+        for (size_t i = first; i < profiles.size(); i++)
+            nLights += profiles.at(i)->GetTriangleCount();
+    }
+    lights.Build(profiles);
+}
+
 void Scene::Trace(const glm::vec3& orig, const glm::vec3& dir, HitResult& hitResult) const
 {
     assert(bvh.IsBuilt());
@@ -347,4 +545,93 @@ void Scene::Trace(const glm::vec3& orig, const glm::vec3& dir, HitResult& hitRes
         unboundedObjectsHit : boundedObjectsHit;
 }
 
+void Scene::Trace(std::span<const glm::vec3> origs, std::span<const glm::vec3> dirs, std::span<HitResult> hitResults) const
+{
+    assert(origs.size() == dirs.size() && dirs.size() == hitResults.size());
+
+    // rays are gathered into packets by the octant of their direction, so that the lanes of a packet agree on the order
+    // the bvh's children are visited in; a packet is traced as soon as its octant has collected rayPacketSize rays
+    struct PendingPacket
+    {
+        RayPacket packet;
+        std::array<size_t, rayPacketSize> rays;
+        uint32_t nRays = 0;
+    };
+    std::array<PendingPacket, 8> pendingPackets{};
+    std::array<HitResult, rayPacketSize> packetHits;
+    auto tracePacket = [&](PendingPacket& pending)
+    {
+        Trace(pending.packet, (1u << pending.nRays) - 1u, packetHits);
+        for (uint32_t lane = 0; lane < pending.nRays; lane++)
+            hitResults[pending.rays[lane]] = packetHits[lane];
+        pending.nRays = 0;
+    };
+
+    for (size_t i = 0; i < origs.size(); i++)
+    {
+        uint32_t octant = (std::signbit(dirs[i].x) ? 1u : 0u) | (std::signbit(dirs[i].y) ? 2u : 0u) | (std::signbit(dirs[i].z) ? 4u : 0u);
+        PendingPacket& pending = pendingPackets[octant];
+        pending.packet.SetRay(pending.nRays, origs[i], dirs[i]);
+        pending.rays[pending.nRays++] = i;
+        if (pending.nRays == rayPacketSize)
+            tracePacket(pending);
+    }
+    // what is left of an octant is too few rays to share a descent
+    for (PendingPacket& pending : pendingPackets)
+    {
+        if (pending.nRays > 1)
+            tracePacket(pending);
+        else if (pending.nRays == 1)
+        {
+            hitResults[pending.rays[0]] = HitResult{};
+            Trace(origs[pending.rays[0]], dirs[pending.rays[0]], hitResults[pending.rays[0]]);
+        }
+    }
+}
+
+void Scene::Trace(const RayPacket& packet, uint32_t laneMask, std::span<HitResult, rayPacketSize> hitResults) const
+{
+    assert(bvh.IsBuilt());
+
+    std::array<float, rayPacketSize> tMax;
+    std::array<SurfaceData, rayPacketSize> surfaceData{};
+    tMax.fill(std::numeric_limits<float>::infinity());
+    for (HitResult& hitResult : hitResults)
+        hitResult.valid = false;
+
+    auto recordHits = [&](const Object* obj, uint32_t hitMask)
+    {
+        for (uint32_t i = 0; i < rayPacketSize; i++)
+        {
+            if (!(hitMask & (1u << i)))
+                continue;
+            hitResults[i].valid = true;
+            hitResults[i].distance = tMax[i];
+            hitResults[i].object = obj;
+            hitResults[i].surfaceData = surfaceData[i];
+        }
+    };
+
+    bvh.IntersectPacket(packet, laneMask,
+        [&](const BoundedObject* obj, uint32_t laneMask, std::array<float, rayPacketSize>& tMax)
+        {
+            recordHits(obj, obj->IntersectPacket(packet, laneMask, tMax, surfaceData));
+        }, tMax);
+
+    // unbounded objects only win strictly closer hits, as with single rays
+    for (const Object* obj : unboundedObjects)
+        recordHits(obj, obj->IntersectPacket(packet, laneMask, tMax, surfaceData));
+}
+
+bool Scene::Occluded(const glm::vec3& orig, const glm::vec3& dir, float maxDistance) const
+{
+    assert(bvh.IsBuilt());
+
+    // any hit will do, nothing is shaded
+    if (bvh.IntersectAny(orig, dir, maxDistance,
+        [](const BoundedObject* obj, const glm::vec3& orig, const glm::vec3& dir, float maxDistance) { return obj->Occluded(orig, dir, maxDistance); }))
+        return true;
+    return std::ranges::any_of(unboundedObjects, [&](const Object* obj) { return obj->Occluded(orig, dir, maxDistance); });
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <optional>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <tracer/frame.h>
+#include <tracer/material.h>
+
+#include "util.h"
+
+namespace tracer
+{
+
+// the lobes below are shared by the material classes and the material table kernel,
+// they take the textures already sampled at the hit and work in the local space of the hit's frame,
+// where wo points towards the viewer and the normal is the y axis
+
+inline float gemetricShadowing(float alpha, const glm::vec3& half, const glm::vec3& d)
+{
+    using namespace glm;
+
+    if (dot(d, half) / d.y <= 0.0f)
+        return 0.0f;
+
+    return ggxG1(alpha, d.y);
+}
+
+inline float schlickApprox(float n, float cosine)
+{
+    float r_0 = (1.0f - n) / (1.0f + n);
+    r_0 *= r_0;
+    float r = r_0 + (1.0f - r_0) * pow(1.0f - cosine, 5.0f);
+    return r;
+}
+
+inline float fresnel(float n, float cosine)
+{
+    float recN2 = 1.0f / (n * n);
+    float sine2 = 1.0f - cosine * cosine;
+    float sqrtComp = sqrt(1.0f - recN2 * sine2);
+    float r_s = abs((cosine - n * sqrtComp) / (cosine + n * sqrtComp));
+    r_s *= r_s;
+    float r_p = abs((sqrtComp - n * cosine) / (sqrtComp + n * cosine));
+    r_p *= r_p;
+    return (r_s + r_p) / 2.0f;
+}
+
+// scales the attenuation by the weight of a reflected sample, pdf is zeroed for specular samples
+inline void applyReflection(const glm::vec3& brdf, const glm::vec3& wi, bool isDelta, glm::vec3& attenuation, float& pdf)
+{
+    using namespace glm;
+
+    float cosTerm = max(wi.y, 0.0f);
+    attenuation *= brdf * cosTerm / pdf;
+
+    if (isDelta)
+        pdf = 0.0f;
+}
+
+inline void sampleDiffuse(Sampler& sampler, const glm::vec3& albedo, glm::vec3& sample, float& pdf, glm::vec3& brdf)
+{
+    using namespace glm;
+
+    generateCosine(sampler, sample, pdf);
+
+    brdf = albedo / pi<float>();
+}
+
+inline bool evaluateDiffuse(const glm::vec3& albedo, const glm::vec3& wi, glm::vec3& brdf, float& pdf)
+{
+    using namespace glm;
+
+    if (wi.y <= 0.0f)
+        return false;
+
+    pdf = getCosinePdf(wi);
+    brdf = albedo / pi<float>();
+
+    return true;
+}
+
+inline void sampleMirror(const glm::vec3& wo, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta)
+{
+    using namespace glm;
+
+    sample = vec3(-wo.x, wo.y, -wo.z);
+
+    pdf = 1.0f;
+
+    brdf = vec3(1.0f) / sample.y;
+
+    isDelta = true;
+}
+
+inline bool shadeExposedMedium(Sampler& sampler, float mediumIor, const glm::vec3& wo, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside)
+{
+    using namespace glm;
+
+    float n;
+    if (isInside) // going out
+        n = 1.0f / mediumIor;
+    else // going in
+        n = mediumIor;
+
+    float f = fresnel(n, wo.y);
+
+    // both reflection and refraction are perfectly specular
+    pdf = 0.0f;
+
+    float cosTheta = wo.y;
+    float sinTheta = sqrt(1.0f - cosTheta * cosTheta);
+
+    if (sampler.Get1D() < f || n * sinTheta > 1.0f)
+    {
+        wi = vec3(-wo.x, wo.y, -wo.z);
+        attenuation *= 1.0f;
+        return true;
+    }
+
+    if (isInside)
+    {
+        isInside = false;
+        currentIor = 1.0f;
+    }
+    else
+    {
+        isInside = true;
+        currentIor = mediumIor;
+    }
+    wi = refract(-wo, vec3(0.0f, 1.0f, 0.0f), n);
+    attenuation *= 1.0f;
+
+    return true;
+}
+
+// probability of sampling the specular lobe, in proportion to its rough share of the reflected energy
+inline float specularLobeProbability(float fresnelO, const glm::vec3& albedo)
+{
+    using namespace glm;
+
+    float diffuseWeight = (1.0f - fresnelO) * luminance(albedo);
+    return fresnelO + diffuseWeight > 0.0f ?
+        clamp(fresnelO / (fresnelO + diffuseWeight), 0.1f, 0.9f) :
+        1.0f;
+}
+
+inline glm::vec3 calcCoatedBrdf(float alpha, float relativeIor, const glm::vec3& albedo, const glm::vec3& wo, const glm::vec3& wi)
+{
+    using namespace glm;
+
+    vec3 half = normalize(wi + wo);
+
+    float d = ggxD(alpha, half.y);
+
+    float g = gemetricShadowing(alpha, half, wo) * gemetricShadowing(alpha, half, wi);
+
+    float f = fresnel(relativeIor, dot(wo, half));
+
+    float specular = d * g * f / (4.0f * wo.y * wi.y);
+
+    return (1.0f - f) * albedo / pi<float>() + specular;
+}
+
+// false when the microfacet reflects the sample below the surface, the path ends there
+inline bool sampleSpecularCoated(Sampler& sampler, const glm::vec3& albedo, float alpha, float ior, const glm::vec3& wo, float currentIor, glm::vec3& sample, float& pdf, glm::vec3& brdf)
+{
+    using namespace glm;
+
+    // one-sample mis between the two lobes
+    float pSpecular = wo.y > 0.0f ?
+        specularLobeProbability(fresnel(ior / currentIor, wo.y), albedo) :
+        0.0f;
+
+    float lobePdf;
+    if (sampler.Get1D() < pSpecular)
+        generateGgx(sampler, wo, alpha, sample, lobePdf);
+    else
+        generateCosine(sampler, sample, lobePdf);
+
+    if (sample.y <= 0.0f)
+        return false;
+
+    pdf = pSpecular * getGgxPdf(wo, sample, alpha) + (1.0f - pSpecular) * getCosinePdf(sample);
+
+    brdf = calcCoatedBrdf(alpha, ior / currentIor, albedo, wo, sample);
+    return true;
+}
+
+inline bool evaluateSpecularCoated(const glm::vec3& albedo, float alpha, float ior, const glm::vec3& wo, float currentIor, const glm::vec3& wi, glm::vec3& brdf, float& pdf)
+{
+    using namespace glm;
+
+    if (wo.y <= 0.0f || wi.y <= 0.0f)
+        return false;
+
+    float pSpecular = specularLobeProbability(fresnel(ior / currentIor, wo.y), albedo);
+    pdf = pSpecular * getGgxPdf(wo, wi, alpha) + (1.0f - pSpecular) * getCosinePdf(wi);
+    brdf = calcCoatedBrdf(alpha, ior / currentIor, albedo, wo, wi);
+
+    return true;
+}
+
+// the albedo is only needed for the diffuse lobe, so it is passed as a callable
+template <typename AlbedoFunc>
+inline void samplePerfectSpecularCoated(Sampler& sampler, const AlbedoFunc& albedo, float ior, const glm::vec3& wo, float currentIor, glm::vec3& sample, float& pdf, glm::vec3& brdf, bool& isDelta)
+{
+    using namespace glm;
+
+    float f = fresnel(ior / currentIor, wo.y);
+
+    if (sampler.Get1D() < f)
+    {
+        sampleMirror(wo, sample, pdf, brdf, isDelta);
+        return;
+    }
+    
+    // the diffuse lobe is only picked with probability 1 - f, which scales both its pdf and its brdf
+    float cosinePdf;
+    generateCosine(sampler, sample, cosinePdf);
+    pdf = (1.0f - f) * cosinePdf;
+
+    brdf = (1.0f - f) * albedo() / pi<float>();
+}
+
+inline bool evaluatePerfectSpecularCoated(const glm::vec3& albedo, float ior, const glm::vec3& wo, float currentIor, const glm::vec3& wi, glm::vec3& brdf, float& pdf)
+{
+    using namespace glm;
+
+    if (wi.y <= 0.0f)
+        return false;
+
+    float f = fresnel(ior / currentIor, wo.y);
+    pdf = (1.0f - f) * getCosinePdf(wi);
+    brdf = (1.0f - f) * albedo / pi<float>();
+
+    return true;
+}
+
+inline float sampleAlpha(const TextureRecord& alpha, const std::optional<glm::vec2>& texCoords)
+{
+    return glm::max(alpha.Sample(texCoords).r, 1e-3f);
+}
+
+// switch based counterparts of Material::Shade, Evaluate and GetEmissivity for the material table,
+// inline so that the whole kernel can be folded into the integrator
+
+inline bool shadeMaterial(const MaterialRecord& record, Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside)
+{
+    using namespace glm;
+
+    vec3 wo = frame.ToLocal(-rayDir);
+    vec3 localWi;
+    vec3 brdf;
+    bool isDelta = false;
+    switch (static_cast<MaterialType>(record.index()))
+    {
+        case MaterialType::SimpleDiffuse:
+        {
+            const auto& material = *std::get_if<SimpleDiffuseRecord>(&record);
+            sampleDiffuse(sampler, material.albedo.Sample(texCoords), localWi, pdf, brdf);
+            break;
+        }
+        case MaterialType::SimpleMirror:
+            sampleMirror(wo, localWi, pdf, brdf, isDelta);
+            break;
+        case MaterialType::SpecularCoated:
+        {
+            const auto& material = *std::get_if<SpecularCoatedRecord>(&record);
+            if (!sampleSpecularCoated(sampler, material.albedo.Sample(texCoords), sampleAlpha(material.alpha, texCoords), material.ior, wo, currentIor, localWi, pdf, brdf))
+                return false;
+            break;
+        }
+        case MaterialType::PerfectSpecularCoated:
+        {
+            const auto& material = *std::get_if<PerfectSpecularCoatedRecord>(&record);
+            samplePerfectSpecularCoated(sampler, [&] { return material.albedo.Sample(texCoords); }, material.ior, wo, currentIor, localWi, pdf, brdf, isDelta);
+            break;
+        }
+        case MaterialType::SimpleEmissive:
+            return false;
+        case MaterialType::ExposedMedium:
+            shadeExposedMedium(sampler, std::get_if<ExposedMediumRecord>(&record)->mediumIor, wo, localWi, attenuation, pdf, currentIor, isInside);
+            wi = frame.ToWorld(localWi);
+            return true;
+    }
+    applyReflection(brdf, localWi, isDelta, attenuation, pdf);
+    wi = frame.ToWorld(localWi);
+    return true;
+}
+
+inline bool evaluateMaterial(const MaterialRecord& record, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf)
+{
+    using namespace glm;
+
+    vec3 wo = frame.ToLocal(-rayDir);
+    vec3 localWi = frame.ToLocal(wi);
+    switch (static_cast<MaterialType>(record.index()))
+    {
+        case MaterialType::SimpleDiffuse:
+            return evaluateDiffuse(std::get_if<SimpleDiffuseRecord>(&record)->albedo.Sample(texCoords), localWi, brdf, pdf);
+        case MaterialType::SpecularCoated:
+        {
+            const auto& material = *std::get_if<SpecularCoatedRecord>(&record);
+            return evaluateSpecularCoated(material.albedo.Sample(texCoords), sampleAlpha(material.alpha, texCoords), material.ior, wo, currentIor, localWi, brdf, pdf);
+        }
+        case MaterialType::PerfectSpecularCoated:
+        {
+            const auto& material = *std::get_if<PerfectSpecularCoatedRecord>(&record);
+            return evaluatePerfectSpecularCoated(material.albedo.Sample(texCoords), material.ior, wo, currentIor, localWi, brdf, pdf);
+        }
+        default:
+            return false;
+    }
+}
+
+inline glm::vec3 getMaterialEmissivity(const MaterialRecord& record, const std::optional<glm::vec2>& texCoords)
+{
+    if (const auto* material = std::get_if<SimpleEmissiveRecord>(&record))
+        return material->multiplier * material->emissivity.Sample(texCoords);
+    return glm::vec3(0.0f);
+}
+
+// surface color for the albedo aov, white for purely specular materials and the clamped emission for lights
+inline glm::vec3 getMaterialAlbedo(const MaterialRecord& record, const std::optional<glm::vec2>& texCoords)
+{
+    switch (static_cast<MaterialType>(record.index()))
+    {
+        case MaterialType::SimpleDiffuse:
+            return std::get_if<SimpleDiffuseRecord>(&record)->albedo.Sample(texCoords);
+        case MaterialType::SpecularCoated:
+            return std::get_if<SpecularCoatedRecord>(&record)->albedo.Sample(texCoords);
+        case MaterialType::PerfectSpecularCoated:
+            return std::get_if<PerfectSpecularCoatedRecord>(&record)->albedo.Sample(texCoords);
+        case MaterialType::SimpleEmissive:
+            return glm::min(getMaterialEmissivity(record, texCoords), glm::vec3(1.0f));
+        default:
+            return glm::vec3(1.0f);
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "socket.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define TRACER_POSIX_SOCKETS
+#endif
+
+namespace tracer
+{
+
+#if defined(TRACER_POSIX_SOCKETS)
+
+namespace
+{
+
+#if defined(MSG_NOSIGNAL)
+    // a peer that went away must not kill the process with sigpipe
+    constexpr int sendFlags = MSG_NOSIGNAL;
+#else
+    constexpr int sendFlags = 0;
+#endif
+
+}
+
+Socket::Socket(Socket&& other) noexcept
+    : handle(std::exchange(other.handle, -1))
+{
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (handle >= 0)
+            close(handle);
+        handle = std::exchange(other.handle, -1);
+    }
+    return *this;
+}
+
+Socket::~Socket()
+{
+    if (handle >= 0)
+        close(handle);
+}
+
+Socket Socket::Listen(uint16_t port)
+{
+    Socket socket(::socket(AF_INET, SOCK_STREAM, 0));
+    if (!socket.IsValid())
+        throw std::runtime_error("cannot create a socket");
+    int reuse = 1;
+    setsockopt(socket.handle, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(socket.handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(socket.handle, SOMAXCONN) != 0)
+        throw std::runtime_error(fmt::format("cannot listen on port {}", port));
+    return socket;
+}
+
+Socket Socket::Connect(std::string_view host, uint16_t port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(std::string(host).c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+        throw std::runtime_error(fmt::format("cannot resolve {}", host));
+
+    Socket socket;
+    for (addrinfo* address = addresses; address; address = address->ai_next)
+    {
+        Socket candidate(::socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+        if (candidate.IsValid() && connect(candidate.handle, address->ai_addr, address->ai_addrlen) == 0)
+        {
+            socket = std::move(candidate);
+            break;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (!socket.IsValid())
+        throw std::runtime_error(fmt::format("cannot connect to {}:{}", host, port));
+
+    // requests are small and answered right away
+    int noDelay = 1;
+    setsockopt(socket.handle, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return socket;
+}
+
+Socket Socket::Accept()
+{
+    Socket socket(accept(handle, nullptr, nullptr));
+    if (socket.IsValid())
+    {
+        int noDelay = 1;
+        setsockopt(socket.handle, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    return socket;
+}
+
+void Socket::SetNonBlocking()
+{
+    fcntl(handle, F_SETFL, fcntl(handle, F_GETFL, 0) | O_NONBLOCK);
+}
+
+bool Socket::SendAll(std::span<const uint8_t> data)
+{
+    size_t nSent = 0;
+    while (nSent < data.size())
+    {
+        ssize_t n = send(handle, data.data() + nSent, data.size() - nSent, sendFlags);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            pollfd request{handle, POLLOUT, 0};
+            poll(&request, 1, -1);
+            continue;
+        }
+        if (n <= 0)
+            return false;
+        nSent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool Socket::ReceiveAll(std::span<uint8_t> data)
+{
+    size_t nReceived = 0;
+    while (nReceived < data.size())
+    {
+        ssize_t n = recv(handle, data.data() + nReceived, data.size() - nReceived, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        nReceived += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+int64_t Socket::ReceiveSome(std::span<uint8_t> data)
+{
+    while (true)
+    {
+        ssize_t n = recv(handle, data.data(), data.size(), 0);
+        if (n > 0)
+            return n;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        return -1;
+    }
+}
+
+void Socket::WaitReadable(std::span<const Socket* const> sockets, int timeoutMs, std::span<uint8_t> readable)
+{
+    std::vector<pollfd> requests(sockets.size());
+    for (size_t k = 0; k < sockets.size(); k++)
+        requests[k] = pollfd{sockets[k]->handle, POLLIN, 0};
+    int nReady = poll(requests.data(), requests.size(), timeoutMs);
+    for (size_t k = 0; k < sockets.size(); k++)
+        readable[k] = nReady > 0 && (requests[k].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+#else
+
+namespace
+{
+
+    [[noreturn]] void throwUnsupported()
+    {
+        throw std::runtime_error("distributed rendering needs posix sockets");
+    }
+
+}
+
+Socket::Socket(Socket&& other) noexcept : handle(std::exchange(other.handle, -1)) {}
+Socket& Socket::operator=(Socket&& other) noexcept { handle = std::exchange(other.handle, -1); return *this; }
+Socket::~Socket() {}
+Socket Socket::Listen(uint16_t) { throwUnsupported(); }
+Socket Socket::Connect(std::string_view, uint16_t) { throwUnsupported(); }
+Socket Socket::Accept() { throwUnsupported(); }
+void Socket::SetNonBlocking() { throwUnsupported(); }
+bool Socket::SendAll(std::span<const uint8_t>) { throwUnsupported(); }
+bool Socket::ReceiveAll(std::span<uint8_t>) { throwUnsupported(); }
+int64_t Socket::ReceiveSome(std::span<uint8_t>) { throwUnsupported(); }
+void Socket::WaitReadable(std::span<const Socket* const>, int, std::span<uint8_t>) { throwUnsupported(); }
+
+#endif
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace tracer
+{
+
+// tcp connection or listening socket, closed on destruction; every operation throws where posix sockets are missing
+class Socket
+{
+public:
+    Socket() = default;
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    Socket(Socket&& other) noexcept;
+    Socket& operator=(Socket&& other) noexcept;
+    ~Socket();
+
+    // listens on every interface
+    static Socket Listen(uint16_t port);
+    static Socket Connect(std::string_view host, uint16_t port);
+    // an invalid socket when no connection is waiting on a non-blocking listening socket
+    Socket Accept();
+    void SetNonBlocking();
+    bool IsValid() const { return handle >= 0; }
+    int GetHandle() const { return handle; }
+
+    // false once the other side is gone
+    bool SendAll(std::span<const uint8_t> data);
+    // false when the other side closed the connection before all of data arrived
+    bool ReceiveAll(std::span<uint8_t> data);
+    // reads what is available, up to data.size() bytes; -1 once the connection is closed or broken, 0 when a non-blocking
+    // socket has nothing yet
+    int64_t ReceiveSome(std::span<uint8_t> data);
+
+    // waits up to timeoutMs for any of the sockets to become readable and sets readable[k] for those that are
+    static void WaitReadable(std::span<const Socket* const> sockets, int timeoutMs, std::span<uint8_t> readable);
+private:
+    explicit Socket(int handle) : handle(handle) {}
+
+    int handle = -1;
+};
+
+}
@@ -1,10 +1,14 @@
 #include <tracer/texture.h>
 
 #include <algorithm>
+#include <stdexcept>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include "asset_cache.h"
+#include "util.h"
+
 namespace tracer
 {
 
@@ -13,6 +17,31 @@ ImageTexture::ImageTexture(std::string_view file)
     std::string str(file);
     int x, y, n;
     unsigned char* bytes = stbi_load(str.data(), &x, &y, &n, 3);
+    setPixels(bytes, x, y);
+}
+
+ImageTexture::ImageTexture(std::span<const uint8_t> encoded)
+{
+    int x, y, n;
+    unsigned char* bytes = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &x, &y, &n, 3);
+    if (!bytes)
+        throw std::runtime_error("cannot decode image");
+    setPixels(bytes, x, y);
+}
+
+std::shared_ptr<ImageTexture> ImageTexture::LoadShared(std::string_view file)
+{
+    static AssetCache<ImageTexture> cache;
+    std::string path(file);
+    return cache.GetOrLoad(hashFileAndReferences(path), [&]
+    {
+        std::string encoded = readBinaryFile(path);
+        return std::make_shared<ImageTexture>(std::span(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size()));
+    });
+}
+
+void ImageTexture::setPixels(unsigned char* bytes, int x, int y)
+{
     width = x;
     height = y;
     uint32_t pixelCount = x * y;
@@ -22,13 +51,4 @@ ImageTexture::ImageTexture(std::string_view file)
     stbi_image_free(bytes);
 }
 
-glm::vec3 ImageTexture::Sample(const glm::vec2& uv) const
-{
-    uint32_t w = static_cast<uint32_t>(uv.x * width);
-    uint32_t h = static_cast<uint32_t>((1.0f - uv.y) * height);
-    w = std::clamp(w, 0u, width - 1);
-    h = std::clamp(h, 0u, height - 1);
-    return toFloats(load(w, h));
 }
-
-}
\ No newline at end of file
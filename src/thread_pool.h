@@ -1,9 +1,204 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace tracer
 {
 
+// workers that live for the whole process and are shared by rendering, scene loading and bvh builds,
+// so a render only pays for waking them up instead of creating and joining threads
+class ThreadPool
+{
+public:
+    explicit ThreadPool(uint32_t nThreads)
+        : nBaseWorkers(nThreads)
+    {
+        std::lock_guard lock(mutex);
+        addWorkers(nThreads);
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        taskCondition.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+    // the pool of the process, starts with a worker per hardware thread and grows when more tasks have to run at once;
+    // the workers added for that leave again as soon as they run out of tasks
+    static ThreadPool& GetShared()
+    {
+        static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u));
+        return pool;
+    }
+    uint32_t GetThreadCount() const
+    {
+        std::lock_guard lock(mutex);
+        return static_cast<uint32_t>(nWorkers);
+    }
+    // queues a single task, its result or exception is delivered through the future
+    // tasks must not wait on other tasks of the pool, the pool only grows for Launch
+    template <typename Func>
+    auto Submit(Func&& func) -> std::future<std::invoke_result_t<Func>>
+    {
+        using Result = std::invoke_result_t<Func>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+        std::future<Result> future = task->get_future();
+        {
+            std::lock_guard lock(mutex);
+            tasks.emplace_back([task] { (*task)(); });
+        }
+        taskCondition.notify_one();
+        return future;
+    }
+    // runs task(0) ... task(nTasks - 1) concurrently, each on its own worker, so the tasks may synchronize with each other
+    // (barriers, condition variables); the future becomes ready as soon as the last one returns and rethrows the first exception
+    std::future<void> Launch(uint32_t nTasks, std::function<void(uint32_t)> task)
+    {
+        struct Group
+        {
+            std::function<void(uint32_t)> task;
+            std::atomic_uint32_t nRemaining;
+            std::promise<void> done;
+            std::mutex exceptionMutex;
+            std::exception_ptr exception;
+        };
+        auto group = std::make_shared<Group>();
+        group->task = std::move(task);
+        group->nRemaining = nTasks;
+        std::future<void> future = group->done.get_future();
+        if (nTasks == 0)
+        {
+            group->done.set_value();
+            return future;
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            joinLeftWorkers();
+            // every queued task and every task of the group gets an idle worker, none of them waits behind another
+            size_t nIdle = nWorkers - nBusy;
+            size_t nNeeded = tasks.size() + nTasks;
+            if (nIdle < nNeeded)
+                addWorkers(static_cast<uint32_t>(nNeeded - nIdle));
+            for (uint32_t i = 0; i < nTasks; i++)
+                tasks.emplace_back([group, i]
+                {
+                    try
+                    {
+                        group->task(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard lock(group->exceptionMutex);
+                        if (!group->exception)
+                            group->exception = std::current_exception();
+                    }
+                    if (group->nRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        if (group->exception)
+                            group->done.set_exception(group->exception);
+                        else
+                            group->done.set_value();
+                    }
+                });
+        }
+        taskCondition.notify_all();
+        return future;
+    }
+    // Launch and wait for the tasks to finish
+    void Run(uint32_t nTasks, std::function<void(uint32_t)> task)
+    {
+        Launch(nTasks, std::move(task)).get();
+    }
+    // calls func(0) ... func(n - 1) and returns once all of them have returned; they run on the pool unless the caller is
+    // a worker itself, whose task is already one of many running at once, then they run one after another on the caller
+    void ParallelFor(uint32_t n, const std::function<void(uint32_t)>& func)
+    {
+        if (isWorker)
+        {
+            for (uint32_t i = 0; i < n; i++)
+                func(i);
+            return;
+        }
+        Run(n, func);
+    }
+private:
+    // requires the lock
+    void addWorkers(uint32_t nThreads)
+    {
+        for (uint32_t i = 0; i < nThreads; i++)
+            workers.emplace_back([this] { work(); });
+        nWorkers += nThreads;
+        // reserved where threads are created anyway, so that workers leave without allocating
+        leftWorkers.reserve(workers.size());
+    }
+    // requires the lock; the workers that left no longer need it once they are on the list
+    void joinLeftWorkers()
+    {
+        for (std::thread::id id : leftWorkers)
+        {
+            auto worker = std::ranges::find(workers, id, &std::thread::get_id);
+            worker->join();
+            workers.erase(worker);
+        }
+        leftWorkers.clear();
+    }
+    void work()
+    {
+        isWorker = true;
+        std::unique_lock lock(mutex);
+        while (true)
+        {
+            taskCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            nBusy++;
+            lock.unlock();
+
+            task();
+
+            lock.lock();
+            nBusy--;
+            // a worker beyond the base size that finds nothing left to do leaves, so jobs that each Launched their own
+            // workers do not keep all of them alive once they are done
+            if (tasks.empty() && nWorkers > nBaseWorkers && !stopping)
+            {
+                nWorkers--;
+                leftWorkers.push_back(std::this_thread::get_id());
+                return;
+            }
+        }
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable taskCondition;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    std::vector<std::thread::id> leftWorkers; // still in workers until they are joined
+    size_t nBaseWorkers;
+    size_t nWorkers = 0;
+    size_t nBusy = 0;
+    bool stopping = false;
+    static inline thread_local bool isWorker = false;
+};
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,302 @@
+#include <tracer/tile_output.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "exr.h"
+#include "thread_pool.h"
+
+// deflate of stb_image_write, whose implementation is compiled into canvas.cpp
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+namespace tracer
+{
+
+namespace
+{
+
+    constexpr uint32_t tiledImageVersion = 1u;
+
+    // calls func(fileOffset, x, y, nPixels) for every run of pixels of the rectangle that is contiguous in a tiled image file,
+    // x and y are relative to the origin of the rectangle
+    template <typename Func>
+    void forEachTiledImageRun(uint32_t width, uint32_t tileSize, const glm::u32vec2& origin, const glm::u32vec2& size, const Func& func)
+    {
+        uint64_t nTilesX = (width + tileSize - 1) / tileSize;
+        uint64_t tileBytes = static_cast<uint64_t>(tileSize) * tileSize * 3 * sizeof(float);
+        for (uint32_t y = origin.y; y < origin.y + size.y; y++)
+            for (uint32_t x = origin.x; x < origin.x + size.x;)
+            {
+                uint32_t runEnd = std::min(origin.x + size.x, (x / tileSize + 1) * tileSize);
+                uint64_t tile = y / tileSize * nTilesX + x / tileSize;
+                uint64_t pixelInTile = static_cast<uint64_t>(y % tileSize) * tileSize + x % tileSize;
+                func(TiledImageFile::headerSize + tile * tileBytes + pixelInTile * 3 * sizeof(float), x - origin.x, y - origin.y, runEnd - x);
+                x = runEnd;
+            }
+    }
+
+}
+
+std::vector<uint8_t> compressExrZipBlock(std::span<const uint8_t> data)
+{
+    std::vector<uint8_t> predicted(data.size());
+    size_t half = (data.size() + 1) / 2;
+    for (size_t i = 0; i < data.size(); i++)
+        predicted[i % 2 == 0 ? i / 2 : half + i / 2] = data[i];
+    for (size_t i = predicted.size(); i-- > 1;)
+        predicted[i] = static_cast<uint8_t>(predicted[i] - predicted[i - 1] + 128);
+
+    int compressedSize = 0;
+    unsigned char* compressed = stbi_zlib_compress(predicted.data(), static_cast<int>(predicted.size()), &compressedSize, 8);
+    std::vector<uint8_t> block;
+    if (compressed && static_cast<size_t>(compressedSize) < data.size())
+        block.assign(compressed, compressed + compressedSize);
+    else
+        block.assign(data.begin(), data.end());
+    std::free(compressed);
+    return block;
+}
+
+ExrTileWriter::ExrTileWriter(std::string_view path)
+    : path(path)
+{
+}
+
+void ExrTileWriter::Begin(uint32_t width, uint32_t height)
+{
+    this->width = width;
+    this->height = height;
+    uint32_t linesPerBlock = getExrLinesPerBlock(ExrCompression::Zip);
+    uint32_t nBlocks = (height + linesPerBlock - 1) / linesPerBlock;
+    blockData.assign(nBlocks, {});
+    nBlockPixels.assign(nBlocks, 0);
+    blockOffsets.assign(nBlocks, 0);
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error(fmt::format("cannot open {} for writing", path));
+
+    // the blocks are appended in the order they complete, so readers have to follow the offset table
+    std::string channelNames[3] = {"B", "G", "R"};
+    writeExrHeader(file, channelNames, width, height, ExrCompression::Zip, ExrLineOrder::RandomY);
+    offsetTablePos = static_cast<uint64_t>(file.tellp());
+    for (uint32_t i = 0; i < nBlocks; i++)
+        writeBinary(file, uint64_t(0));
+}
+
+void ExrTileWriter::WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb)
+{
+    uint32_t linesPerBlock = getExrLinesPerBlock(ExrCompression::Zip);
+    uint32_t firstCompleted = 0, nCompleted = 0;
+    std::unique_lock lock(mutex);
+    for (uint32_t y = origin.y; y < origin.y + size.y; y++)
+    {
+        uint32_t block = y / linesPerBlock;
+        std::vector<float>& data = blockData[block];
+        if (data.empty())
+            data.resize(static_cast<size_t>(width) * linesPerBlock * 3);
+        std::memcpy(
+            data.data() + (static_cast<size_t>(y % linesPerBlock) * width + origin.x) * 3,
+            rgb.data() + static_cast<size_t>(y - origin.y) * size.x * 3,
+            static_cast<size_t>(size.x) * 3 * sizeof(float));
+
+        uint64_t nLines = std::min(linesPerBlock, height - block * linesPerBlock);
+        nBlockPixels[block] += size.x;
+        if (nBlockPixels[block] == nLines * width)
+        {
+            // the lines of a tile are consecutive, so are the blocks it completes
+            if (nCompleted == 0)
+                firstCompleted = block;
+            nCompleted++;
+        }
+    }
+    lock.unlock();
+
+    // compressed right here rather than queued on the pool, where the task would wait behind the render's workers until
+    // the render ends; the other render threads keep writing tiles meanwhile
+    for (uint32_t block = firstCompleted; block < firstCompleted + nCompleted; block++)
+        compressAndAppend(block);
+}
+
+void ExrTileWriter::compressAndAppend(uint32_t block)
+{
+    uint32_t linesPerBlock = getExrLinesPerBlock(ExrCompression::Zip);
+    uint32_t firstLine = block * linesPerBlock;
+    uint32_t nLines = std::min(linesPerBlock, height - firstLine);
+
+    std::vector<float> rgb;
+    {
+        std::lock_guard lock(mutex);
+        rgb = std::move(blockData[block]);
+    }
+
+    // every line holds its channels one after another, in the order of the channel list
+    std::vector<uint8_t> data(static_cast<size_t>(nLines) * width * 3 * sizeof(float));
+    float* out = reinterpret_cast<float*>(data.data());
+    for (uint32_t line = 0; line < nLines; line++)
+        for (uint32_t c = 0; c < 3; c++)
+            for (uint32_t i = 0; i < width; i++)
+                *out++ = rgb[(static_cast<size_t>(line) * width + i) * 3 + (2 - c)];
+    std::vector<uint8_t> compressed = compressExrZipBlock(data);
+
+    std::lock_guard lock(fileMutex);
+    blockOffsets[block] = static_cast<uint64_t>(file.tellp());
+    writeBinary(file, static_cast<int32_t>(firstLine));
+    writeBinary(file, static_cast<uint32_t>(compressed.size()));
+    file.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+}
+
+void ExrTileWriter::End()
+{
+    // blocks no tile reached (a render cut short) are written black, the render is over so they use the whole pool
+    std::vector<uint32_t> missingBlocks;
+    {
+        std::lock_guard lock(mutex);
+        uint32_t linesPerBlock = getExrLinesPerBlock(ExrCompression::Zip);
+        for (uint32_t block = 0; block < nBlockPixels.size(); block++)
+        {
+            uint64_t nLines = std::min(linesPerBlock, height - block * linesPerBlock);
+            if (nBlockPixels[block] == nLines * width)
+                continue;
+            blockData[block].resize(static_cast<size_t>(width) * linesPerBlock * 3);
+            nBlockPixels[block] = nLines * width;
+            missingBlocks.push_back(block);
+        }
+    }
+    ThreadPool::GetShared().ParallelFor(static_cast<uint32_t>(missingBlocks.size()), [&](uint32_t i) { compressAndAppend(missingBlocks[i]); });
+
+    file.seekp(static_cast<std::streamoff>(offsetTablePos));
+    for (uint64_t offset : blockOffsets)
+        writeBinary(file, offset);
+    file.close();
+    if (!file)
+        throw std::runtime_error(fmt::format("failed to write {}", path));
+}
+
+TiledImageFile::TiledImageFile(std::string_view path, uint32_t tileSize)
+    : path(path), tileSize(tileSize)
+{
+    if (tileSize == 0)
+        throw std::runtime_error("tile size of a tiled image must not be zero");
+}
+
+void TiledImageFile::Begin(uint32_t width, uint32_t height)
+{
+    this->width = width;
+    this->height = height;
+    file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error(fmt::format("cannot open {} for writing", path));
+
+    file.write("TRTI", 4);
+    for (uint32_t value : {tiledImageVersion, width, height, tileSize})
+        writeBinary(file, value);
+
+    // the file gets its full size right away (sparse where the file system allows), tiles never written read as black
+    uint64_t nTiles = static_cast<uint64_t>((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize);
+    uint64_t fileSize = headerSize + nTiles * tileSize * tileSize * 3 * sizeof(float);
+    file.seekp(static_cast<std::streamoff>(fileSize - 1));
+    file.put('\0');
+    if (!file)
+        throw std::runtime_error(fmt::format("cannot allocate {} bytes for {}", fileSize, path));
+}
+
+void TiledImageFile::WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb)
+{
+    std::lock_guard lock(mutex);
+    forEachTiledImageRun(width, tileSize, origin, size, [&](uint64_t offset, uint32_t x, uint32_t y, uint32_t nPixels)
+    {
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char*>(rgb.data() + (static_cast<size_t>(y) * size.x + x) * 3), nPixels * 3 * sizeof(float));
+    });
+}
+
+void TiledImageFile::End()
+{
+    std::lock_guard lock(mutex);
+    file.close();
+    if (!file)
+        throw std::runtime_error(fmt::format("failed to write {}", path));
+}
+
+void TiledImageFile::ReadRegion(std::string_view path, const glm::u32vec2& origin, const glm::u32vec2& size, std::span<float> rgb)
+{
+    std::ifstream file(std::string(path), std::ios::binary);
+    if (!file)
+        throw std::runtime_error(fmt::format("cannot open {}", path));
+
+    char magic[4]{};
+    uint32_t header[4]{};
+    file.read(magic, 4);
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!file || std::string_view(magic, 4) != "TRTI" || header[0] != tiledImageVersion || header[3] == 0)
+        throw std::runtime_error(fmt::format("{} is not a tiled image", path));
+    uint32_t width = header[1], height = header[2], tileSize = header[3];
+    if (origin.x + size.x > width || origin.y + size.y > height || rgb.size() < static_cast<size_t>(size.x) * size.y * 3)
+        throw std::runtime_error(fmt::format("region is outside of {}", path));
+
+    forEachTiledImageRun(width, tileSize, origin, size, [&](uint64_t offset, uint32_t x, uint32_t y, uint32_t nPixels)
+    {
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(reinterpret_cast<char*>(rgb.data() + (static_cast<size_t>(y) * size.x + x) * 3), nPixels * 3 * sizeof(float));
+    });
+    if (!file)
+        throw std::runtime_error(fmt::format("failed to read {}", path));
+}
+
+void TileStreamWriter::Begin(uint32_t width, uint32_t height)
+{
+    std::lock_guard lock(mutex);
+    uint32_t header[2] = {width, height};
+    std::fwrite("TRTS", 1, 4, stream);
+    std::fwrite(header, sizeof(uint32_t), 2, stream);
+    std::fflush(stream);
+}
+
+void TileStreamWriter::WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb)
+{
+    std::lock_guard lock(mutex);
+    uint32_t tileHeader[4] = {origin.x, origin.y, size.x, size.y};
+    std::fwrite(tileHeader, sizeof(uint32_t), 4, stream);
+    std::fwrite(rgb.data(), sizeof(float), rgb.size(), stream);
+    // consumers should see every tile as soon as it is done
+    std::fflush(stream);
+}
+
+void TileStreamWriter::End()
+{
+    std::lock_guard lock(mutex);
+    uint32_t endMarker[4] = {0, 0, 0, 0};
+    std::fwrite(endMarker, sizeof(uint32_t), 4, stream);
+    std::fflush(stream);
+}
+
+void FramebufferTileWriter::Begin(uint32_t width, uint32_t height)
+{
+    std::lock_guard lock(mutex);
+    framebuffer.SetSize(width, height);
+    framebuffer.AddLayer(beautyLayerName, 3);
+}
+
+void FramebufferTileWriter::WriteTile(const glm::u32vec2& origin, const glm::u32vec2& size, std::span<const float> rgb)
+{
+    std::lock_guard lock(mutex);
+    std::span<float> beauty = framebuffer.GetLayer(beautyLayerName);
+    for (uint32_t y = 0; y < size.y; y++)
+        std::memcpy(
+            beauty.data() + (static_cast<size_t>(origin.y + y) * framebuffer.GetWidth() + origin.x) * 3,
+            rgb.data() + static_cast<size_t>(y) * size.x * 3,
+            static_cast<size_t>(size.x) * 3 * sizeof(float));
+}
+
+Framebuffer FramebufferTileWriter::GetFramebuffer() const
+{
+    std::lock_guard lock(mutex);
+    return framebuffer;
+}
+
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <tracer/tracer.h>
+
+namespace tracer
+{
+
+struct Tile
+{
+    glm::u32vec2 origin;
+    glm::u32vec2 size;
+};
+
+// interleaves the bits of x and y, tiles close on the curve are close on the image
+inline uint64_t calcMortonIndex(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint64_t v)
+    {
+        v &= 0xffffffffull;
+        v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+        v = (v | (v << 2)) & 0x3333333333333333ull;
+        v = (v | (v << 1)) & 0x5555555555555555ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// distance along the hilbert curve filling a square of side n (a power of two),
+// unlike morton order consecutive cells are always neighbors
+inline uint64_t calcHilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) > 0 ? 1u : 0u;
+        uint32_t ry = (y & s) > 0 ? 1u : 0u;
+        d += static_cast<uint64_t>(s) * s * ((3u * rx) ^ ry);
+        // rotate the quadrant so that the curve inside it starts where the previous one ended
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// splits the image into tiles of tileSize pixels (smaller at the right and bottom edges), in the given order
+inline std::vector<Tile> generateTiles(const glm::u32vec2& dim, uint32_t tileSize, TileOrder order)
+{
+    tileSize = std::max(tileSize, 1u);
+    glm::u32vec2 nTiles = (dim + glm::u32vec2(tileSize - 1)) / tileSize;
+    uint32_t curveSize = std::bit_ceil(std::max(nTiles.x, nTiles.y));
+
+    std::vector<std::pair<uint64_t, Tile>> keyedTiles;
+    keyedTiles.reserve(static_cast<size_t>(nTiles.x) * nTiles.y);
+    for (uint32_t j = 0; j < nTiles.y; j++)
+        for (uint32_t i = 0; i < nTiles.x; i++)
+        {
+            Tile tile{};
+            tile.origin = glm::u32vec2(i, j) * tileSize;
+            tile.size = glm::min(glm::u32vec2(tileSize), dim - tile.origin);
+
+            uint64_t key = static_cast<uint64_t>(j) * nTiles.x + i;
+            if (order == TileOrder::Morton)
+                key = calcMortonIndex(i, j);
+            else if (order == TileOrder::Hilbert)
+                key = calcHilbertIndex(curveSize, i, j);
+            keyedTiles.emplace_back(key, tile);
+        }
+    std::ranges::sort(keyedTiles, {}, &std::pair<uint64_t, Tile>::first);
+
+    std::vector<Tile> tiles;
+    tiles.reserve(keyedTiles.size());
+    for (const auto& [key, tile] : keyedTiles)
+        tiles.push_back(tile);
+    return tiles;
+}
+
+// hands out tile indices to the render threads, every thread starts with its own contiguous stretch of the curve
+// and takes from the front of its queue, once that runs dry it steals from the back of the others'
+// with threadNodes (the numa node of every thread) threads steal from their own node first
+class TileScheduler
+{
+public:
+    TileScheduler(uint32_t nTiles, uint32_t nThreads, std::span<const uint32_t> threadNodes = {})
+        : queues(std::max(nThreads, 1u))
+    {
+        uint32_t nQueues = static_cast<uint32_t>(queues.size());
+        for (uint32_t t = 0; t < nQueues; t++)
+        {
+            queues[t].begin = static_cast<uint32_t>(static_cast<uint64_t>(nTiles) * t / nQueues);
+            queues[t].end = static_cast<uint32_t>(static_cast<uint64_t>(nTiles) * (t + 1) / nQueues);
+        }
+
+        victimOrders.resize(nQueues);
+        for (uint32_t t = 0; t < nQueues; t++)
+        {
+            for (uint32_t k = 1; k < nQueues; k++)
+                victimOrders[t].push_back((t + k) % nQueues);
+            if (threadNodes.size() == nQueues)
+                std::ranges::stable_partition(victimOrders[t], [&](uint32_t victim) { return threadNodes[victim] == threadNodes[t]; });
+        }
+    }
+    std::optional<uint32_t> Next(uint32_t thread)
+    {
+        uint32_t nQueues = static_cast<uint32_t>(queues.size());
+        thread %= nQueues;
+        {
+            Queue& own = queues[thread];
+            std::scoped_lock lock(own.mutex);
+            if (own.begin < own.end)
+                return own.begin++;
+        }
+        // the owner only ever contends for its lock with thieves, so the lock stays uncontended until the work runs out
+        for (uint32_t victimIndex : victimOrders[thread])
+        {
+            Queue& victim = queues[victimIndex];
+            std::scoped_lock lock(victim.mutex);
+            if (victim.begin < victim.end)
+                return --victim.end;
+        }
+        return std::nullopt;
+    }
+private:
+    // a cache line each, so the owners do not invalidate each other's queue; taking from either end keeps the tiles
+    // left in a queue contiguous, so a queue is just the range [begin, end) and its size does not depend on the image
+    struct alignas(64) Queue
+    {
+        std::mutex mutex;
+        uint32_t begin = 0, end = 0;
+    };
+    std::vector<Queue> queues;
+    std::vector<std::vector<uint32_t>> victimOrders;
+};
+
+}
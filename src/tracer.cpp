@@ -1,254 +1,2267 @@
 #include <tracer/tracer.h>
 
+#include <algorithm>
 #include <array>
+#include <barrier>
+#include <bit>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <ctime>
+#include <deque>
+#include <filesystem>
 #include <fmt/chrono.h>
 #include <fmt/core.h>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <random>
 #include <ranges>
+#include <spanstream>
 #include <thread>
+#include <utility>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/color_space.hpp>
 
-#include <tracer/emission_profile.h>
+#include <tracer/light_sampler.h>
+#include "denoiser.h"
+#include "numa.h"
+#include "reservoir.h"
+#include "shading.h"
+#include "socket.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
 #include "util.h"
 
 namespace tracer
 {
 
-static glm::vec3 calcToFrustumPlane(const glm::vec2& on2DFrustumPlane, const glm::vec3& lookVec, float fov)
+// stages of a pass that draw from independent streams for the same pixel sample use different seeds
+static std::unique_ptr<Sampler> createSampler(const TracerConfiguration& config, uint32_t stage = 0)
+{
+    uint32_t seed = config.seed + stage * 0x9e3779b9u;
+    switch (config.samplerType)
+    {
+        case SamplerType::Independent:
+            return std::make_unique<IndependentSampler>(seed, config.firstSample);
+        case SamplerType::Sobol:
+            return std::make_unique<SobolSampler>(seed, config.firstSample);
+    }
+    throw std::runtime_error("unknown sampler type");
+}
+
+// material of a hit, dispatched through the material table when the hit has a record and through the material otherwise
+struct SurfaceShader
+{
+    const Material* material;
+    const MaterialRecord* record;
+
+    SurfaceShader(const SurfaceData& surface, const TracerConfiguration& config)
+        : material(surface.material), record(config.staticMaterialDispatch ? surface.materialRecord : nullptr)
+    {}
+    glm::vec3 GetEmissivity(const std::optional<glm::vec2>& texCoords) const
+    {
+        if (record)
+            return getMaterialEmissivity(*record, texCoords);
+        return material->GetEmissivity(texCoords);
+    }
+    bool Shade(Sampler& sampler, const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, glm::vec3& wi, glm::vec3& attenuation, float& pdf, float& currentIor, bool& isInside) const
+    {
+        if (record)
+            return shadeMaterial(*record, sampler, rayDir, frame, texCoords, wi, attenuation, pdf, currentIor, isInside);
+        return material->Shade(sampler, rayDir, frame, texCoords, wi, attenuation, pdf, currentIor, isInside);
+    }
+    bool Evaluate(const glm::vec3& rayDir, const Frame& frame, const std::optional<glm::vec2>& texCoords, const glm::vec3& wi, float currentIor, glm::vec3& brdf, float& pdf) const
+    {
+        if (record)
+            return evaluateMaterial(*record, rayDir, frame, texCoords, wi, currentIor, brdf, pdf);
+        return material->Evaluate(rayDir, frame, texCoords, wi, currentIor, brdf, pdf);
+    }
+};
+
+// unshadowed radiance a point on a light sends through the surface towards -rayDir, per unit area of the light
+static glm::vec3 calcLightContribution(const LightSampler& lights, uint32_t lightId, const glm::vec3& lightPoint, const glm::vec3& emission,
+    const SurfaceShader& material, const glm::vec3& rayDir, const glm::vec3& point, const Frame& frame, const std::optional<glm::vec2>& texCoords, float currentIor)
+{
+    using namespace glm;
+
+    vec3 toLight = lightPoint - point;
+    float distance2 = dot(toLight, toLight);
+    if (distance2 <= 0.0f)
+        return vec3(0.0f);
+    vec3 wi = toLight / sqrt(distance2);
+
+    const EmissiveTriangle& triangle = lights.GetTriangle(lightId);
+    float cosLight = dot(-wi, triangle.normal);
+    if (triangle.doubleFaced)
+        cosLight = abs(cosLight);
+    float cosSurface = dot(wi, frame.normal);
+    if (cosLight <= 0.0f || cosSurface <= 0.0f)
+        return vec3(0.0f);
+
+    vec3 brdf;
+    float pdf;
+    if (!material.Evaluate(rayDir, frame, texCoords, wi, currentIor, brdf, pdf))
+        return vec3(0.0f);
+
+    return brdf * emission * cosSurface * cosLight / distance2;
+}
+
+// state a path carries from one vertex to the next
+struct PathState
+{
+    glm::vec3 orig, dir; // next ray of the path
+    glm::vec3 throughput{1.0f};
+    glm::vec3 color{0.0f};
+    float currentIor = 1.0f;
+    bool isInsideObject = false;
+    float dirPdf = 0.0f; // pdf of the material sample that produced dir, zero for camera rays and specular bounces
+    glm::vec3 prevPoint{0.0f}, prevNormal{0.0f}; // vertex the light pdf has to be evaluated from
+    bool prevLightResampled = false; // lights hit from the previous vertex are already accounted for by its reservoir
+    uint32_t nBounces = 0;
+    SampleAovs aovs; // filled in at the first vertex
+};
+
+// shadow ray from a surface point to a point on a light, both ends are pulled in by the same bias
+template <typename ShadowFunc>
+static void traceShadowTo(const glm::vec3& point, const glm::vec3& normal, const glm::vec3& lightPoint, float bias, const glm::vec3& contribution, const ShadowFunc& traceShadow)
+{
+    using namespace glm;
+
+    vec3 shadowOrig = point + normal * bias;
+    vec3 toLight = lightPoint - shadowOrig;
+    float distance = length(toLight);
+    if (distance <= bias)
+        return;
+    traceShadow(shadowOrig, toLight / distance, distance - bias, contribution);
+}
+
+// shades the vertex the path's ray hit and sets up its next ray, returns false once the path terminates
+// shadow rays are handed to traceShadow(orig, dir, maxDistance, contribution), which adds contribution to the path's color unless occluded
+// resampledLight replaces next event estimation at this vertex with a resampled light sample
+template <typename ShadowFunc>
+static bool shadeVertex(PathState& path, const HitResult& hit, const Scene& scene, const TracerConfiguration& config, Sampler& sampler, const LightReservoir* resampledLight, const ShadowFunc& traceShadow)
+{
+    using namespace glm;
+
+    const LightSampler& lights = scene.GetLights();
+    bool sampleLights = config.nextEventEstimation && !lights.IsEmpty();
+
+    const SurfaceData& surface = hit.surfaceData;
+    vec3 dir = path.dir;
+    vec3 point = path.orig + dir * hit.distance;
+    vec3 normal = surface.normal;
+    Frame frame(normal); // shading basis shared by every material call at this vertex
+
+    SurfaceShader material(surface, config);
+    vec3 emissive;
+    emissive = material.GetEmissivity(surface.texCoords);
+
+    if (path.nBounces == 0)
+    {
+        path.aovs.albedo = surface.materialRecord ? getMaterialAlbedo(*surface.materialRecord, surface.texCoords) : vec3(1.0f);
+        path.aovs.normal = normal;
+        path.aovs.emission = emissive;
+        path.aovs.depth = hit.distance;
+    }
+
+    // the light may also have been reached by next event estimation from the previous vertex
+    float emissionWeight = 1.0f;
+    if (path.dirPdf > 0.0f && surface.lightId != invalidLightId)
+    {
+        if (path.prevLightResampled)
+            emissionWeight = 0.0f;
+        else if (sampleLights)
+            emissionWeight = powerHeuristic(path.dirPdf, lights.GetPdf(config.lightSelection, surface.lightId, path.prevPoint, path.prevNormal, dir, hit.distance));
+    }
+    path.color += path.throughput * emissive * emissionWeight;
+
+    if (resampledLight)
+    {
+        if (resampledLight->IsValid())
+        {
+            vec3 contribution = calcLightContribution(lights, resampledLight->lightId, resampledLight->lightPoint, resampledLight->emission,
+                material, dir, point, frame, surface.texCoords, path.currentIor);
+            traceShadowTo(point, normal, resampledLight->lightPoint, config.bias, path.throughput * contribution * resampledLight->weight, traceShadow);
+        }
+    }
+    else if (sampleLights)
+    {
+        EmissionSample lightSample;
+        vec3 brdf;
+        float brdfPdf;
+        if (lights.Sample(sampler, config.lightSelection, point, normal, lightSample) &&
+            material.Evaluate(dir, frame, surface.texCoords, lightSample.sample, path.currentIor, brdf, brdfPdf))
+        {
+            float cosTheta = dot(lightSample.sample, normal);
+            if (cosTheta > 0.0f)
+            {
+                float weight = powerHeuristic(lightSample.pdf, brdfPdf);
+                traceShadowTo(point, normal, point + lightSample.sample * lightSample.distance, config.bias,
+                    path.throughput * brdf * cosTheta * lightSample.emission * weight / lightSample.pdf, traceShadow);
+            }
+        }
+    }
+
+    vec3 sample;
+    bool insidePrev = path.isInsideObject;
+    bool generateNewRays = material.Shade(sampler, dir, frame, surface.texCoords, sample, path.throughput, path.dirPdf, path.currentIor, path.isInsideObject);
+    bool mediumChanged = insidePrev != path.isInsideObject;
+    if (!generateNewRays)
+        return false;
+    path.prevPoint = point;
+    path.prevNormal = normal;
+    path.prevLightResampled = resampledLight != nullptr;
+
+    if (path.nBounces++ == config.nMaxBounces)
+        return false;
+
+    if (path.nBounces > config.nMinBounces)
+    {
+        // russian roulette
+        float p = max(path.throughput.r, max(path.throughput.g, path.throughput.b));
+        if (sampler.Get1D() > p)
+            return false;
+        
+        path.throughput *= 1.0f / p;
+    }
+    
+    vec3 biasedP = point;
+    if (mediumChanged)
+        biasedP -= normal * config.bias;
+    else
+        biasedP += normal * config.bias;
+    path.orig = biasedP;
+    path.dir = sample;
+    return true;
+}
+
+// rays traced by the current thread, collected by the render loops when their workers finish
+static thread_local uint64_t nThreadRaysTraced = 0;
+
+static uint64_t takeThreadRayCount()
+{
+    return std::exchange(nThreadRaysTraced, 0);
+}
+
+// continues a path from the hit of its current ray to completion, the megakernel counterpart of the wavefront stages
+// primaryLight replaces next event estimation at the first vertex with a resampled light sample
+static glm::vec3 tracePath(PathState& path, HitResult hit, const Scene& scene, const TracerConfiguration& config, Sampler& sampler, const LightReservoir* primaryLight = nullptr)
+{
+    using namespace glm;
+
+    auto traceShadow = [&](const vec3& shadowOrig, const vec3& shadowDir, float maxDistance, const vec3& contribution)
+    {
+        nThreadRaysTraced++;
+        if (!scene.Occluded(shadowOrig, shadowDir, maxDistance))
+            path.color += contribution;
+    };
+
+    while (true)
+    {
+        if (!hit.valid)
+        {
+            path.color += path.throughput * scene.GetAmbientColor();
+            break;
+        }
+
+        const LightReservoir* resampledLight = path.nBounces == 0 ? primaryLight : nullptr;
+        if (!shadeVertex(path, hit, scene, config, sampler, resampledLight, traceShadow))
+            break;
+
+        hit = HitResult{};
+        scene.Trace(path.orig, path.dir, hit);
+        nThreadRaysTraced++;
+    }
+    return path.color;
+}
+
+// traces a path to completion
+static glm::vec3 castRay(const glm::vec3& orig, const glm::vec3& dir, const Scene& scene, const TracerConfiguration& config, Sampler& sampler, SampleAovs& aovs)
+{
+    PathState path{};
+    path.orig = orig;
+    path.dir = dir;
+
+    HitResult hit{};
+    scene.Trace(path.orig, path.dir, hit);
+    nThreadRaysTraced++;
+
+    glm::vec3 color = tracePath(path, hit, scene, config, sampler);
+    aovs = path.aovs;
+    return color;
+}
+
+// turns pixel samples into camera rays, the basis, field of view and aspect ratio of the camera are set up once per render
+class CameraRayGenerator
+{
+public:
+    CameraRayGenerator(const Camera& camera, const glm::u32vec2& dim)
+    {
+        using namespace glm;
+
+        // the frustum plane one unit in front of the camera, with a half width (or half height when the image is taller
+        // than wide) of tan(fov / 2), pushed out to the focal plane
+        float aspect = static_cast<float>(dim.x) / static_cast<float>(dim.y);
+        vec2 planeScale = aspect > 1.0f ? vec2(1.0f, 1.0f / aspect) : vec2(aspect, 1.0f);
+        planeScale *= tan(camera.lens.fov / 2.0f) * camera.lens.focalPointDistance;
+        vec3 camRightInWorld = normalize(cross(camera.dir, vec3(0.0f, 1.0f, 0.0f)));
+        vec3 camUpInWorld = normalize(cross(camRightInWorld, camera.dir));
+
+        // pixel coordinates map to [-1, 1] with the vertical axis flipped
+        vec2 ndcScale = vec2(2.0f, -2.0f) / vec2(dim);
+        right = camRightInWorld * planeScale.x * ndcScale.x;
+        down = camUpInWorld * planeScale.y * ndcScale.y;
+        topLeft = camera.dir * camera.lens.focalPointDistance - camRightInWorld * planeScale.x + camUpInWorld * planeScale.y;
+
+        vec3 axis1, axis2;
+        createCoordSystemWithUpVec(camera.dir, axis1, axis2); // coord system of the defocus disk
+        diskAxis1 = axis1 * camera.lens.defocusDiskRadius;
+        diskAxis2 = axis2 * camera.lens.defocusDiskRadius;
+        pos = camera.pos;
+    }
+    void Generate(const glm::u32vec2& pixel, Sampler& sampler, glm::vec3& orig, glm::vec3& dir) const
+    {
+        using namespace glm;
+
+        vec2 onPixel = vec2(pixel) + sampler.Get2D(); // jittered inside the pixel
+        vec3 focusPoint = topLeft + onPixel.x * right + onPixel.y * down;
+
+        vec2 lensSample = sampler.Get2D();
+        vec2 diskSample = samplePointOnDisk(lensSample.x, lensSample.y);
+        vec3 defocused = diskSample.x * diskAxis1 + diskSample.y * diskAxis2;
+
+        orig = pos + defocused;
+        dir = normalize(focusPoint - defocused);
+    }
+private:
+    glm::vec3 pos;
+    glm::vec3 topLeft, right, down; // the focal plane relative to the camera, right and down span a pixel
+    glm::vec3 diskAxis1, diskAxis2;
+};
+
+// nan samples are discarded as black
+static glm::vec3 discardNan(const glm::vec3& color)
+{
+    if (std::isnan(color.x) ||
+        std::isnan(color.y) ||
+        std::isnan(color.z))
+        return glm::vec3(0.0f);
+    return color;
+}
+
+// traces one camera sample through the pixel
+static glm::vec3 tracePixelSample(const glm::u32vec2& pixel, uint32_t sampleIndex, const CameraRayGenerator& cameraRays, const Scene& scene, const TracerConfiguration& config, Sampler& sampler, SampleAovs& aovs)
+{
+    using namespace glm;
+
+    sampler.StartPixelSample(pixel, sampleIndex);
+
+    vec3 orig, dir;
+    cameraRays.Generate(pixel, sampler, orig, dir);
+
+    return discardNan(castRay(orig, dir, scene, config, sampler, aovs));
+}
+
+// traces rayPacketSize consecutive camera samples of the pixel, starting at sampleIndex, with their first hits found as one packet
+// every lane has its own sampler so that it draws the same numbers as when the samples are traced one by one
+static void tracePixelSamplePacket(const glm::u32vec2& pixel, uint32_t sampleIndex, const CameraRayGenerator& cameraRays, const Scene& scene, const TracerConfiguration& config,
+    std::span<const std::unique_ptr<Sampler>, rayPacketSize> laneSamplers, std::span<glm::vec3, rayPacketSize> colors, std::span<SampleAovs, rayPacketSize> aovs)
+{
+    RayPacket packet;
+    std::array<PathState, rayPacketSize> paths{};
+    for (uint32_t i = 0; i < rayPacketSize; i++)
+    {
+        laneSamplers[i]->StartPixelSample(pixel, sampleIndex + i);
+        cameraRays.Generate(pixel, *laneSamplers[i], paths[i].orig, paths[i].dir);
+        packet.SetRay(i, paths[i].orig, paths[i].dir);
+    }
+
+    std::array<HitResult, rayPacketSize> hits{};
+    if (packet.IsCoherent(allLanes))
+        scene.Trace(packet, allLanes, hits);
+    else
+        for (uint32_t i = 0; i < rayPacketSize; i++)
+            scene.Trace(paths[i].orig, paths[i].dir, hits[i]);
+    nThreadRaysTraced += rayPacketSize;
+
+    // the bounces scatter, so the paths are continued one at a time
+    for (uint32_t i = 0; i < rayPacketSize; i++)
+    {
+        colors[i] = discardNan(tracePath(paths[i], hits[i], scene, config, *laneSamplers[i]));
+        aovs[i] = paths[i].aovs;
+    }
+}
+
+// first hit of a pixel sample, kept between the stages of a resampled pass
+struct PrimaryHit
+{
+    glm::vec3 orig, dir;
+    bool valid;
+    glm::vec3 point;
+    Frame frame;
+    std::optional<glm::vec2> texCoords;
+    std::optional<SurfaceShader> material;
+    float distance;
+    HitResult result; // the path of the sample continues from it
+};
+
+static glm::vec3 calcLightContribution(const LightSampler& lights, const PrimaryHit& hit, uint32_t lightId, const glm::vec3& lightPoint, const glm::vec3& emission)
+{
+    // camera rays start in the air
+    return calcLightContribution(lights, lightId, lightPoint, emission, hit.material.value(), hit.dir, hit.point, hit.frame, hit.texCoords, 1.0f);
+}
+
+// reservoirs are only shared between hits on similar surfaces, otherwise the reused samples are too far off
+static bool areHitsSimilar(const PrimaryHit& a, const PrimaryHit& b)
+{
+    return a.valid && b.valid &&
+        glm::dot(a.frame.normal, b.frame.normal) > 0.9f &&
+        glm::abs(a.distance - b.distance) < 0.1f * a.distance;
+}
+
+// traces the primary hit of the pixel sample and picks one of nLightCandidates light samples by resampled importance sampling
+// the reservoir the pixel ended up with in the previous pass is merged in as well
+static void generateLightReservoir(const glm::u32vec2& pixel, uint32_t sampleIndex, const CameraRayGenerator& cameraRays, const Scene& scene, const TracerConfiguration& config, Sampler& sampler,
+    PrimaryHit& hit, LightReservoir& reservoir, const LightReservoir* prevReservoir)
+{
+    using namespace glm;
+
+    // caps how many candidates the reservoir of the previous pass counts for, so stale samples keep getting replaced
+    constexpr uint32_t temporalHistoryLength = 20u;
+
+    PrimaryHit prevHit = hit;
+
+    sampler.StartPixelSample(pixel, sampleIndex);
+    cameraRays.Generate(pixel, sampler, hit.orig, hit.dir);
+
+    HitResult& result = hit.result;
+    result = HitResult{};
+    scene.Trace(hit.orig, hit.dir, result);
+    nThreadRaysTraced++;
+    hit.valid = result.valid;
+    reservoir = LightReservoir{};
+    if (!hit.valid)
+        return;
+
+    hit.point = hit.orig + hit.dir * result.distance;
+    hit.frame = Frame(result.surfaceData.normal);
+    hit.texCoords = result.surfaceData.texCoords;
+    hit.material.emplace(result.surfaceData, config);
+    hit.distance = result.distance;
+
+    const LightSampler& lights = scene.GetLights();
+    if (lights.IsEmpty())
+        return;
+
+    for (uint32_t k = 0; k < config.nLightCandidates; k++)
+    {
+        reservoir.nCandidates += 1.0f;
+
+        EmissionSample lightSample;
+        bool found = lights.Sample(sampler, config.lightSelection, hit.point, hit.frame.normal, lightSample);
+        float u = sampler.Get1D();
+        if (!found)
+            continue;
+
+        vec3 lightPoint = hit.point + lightSample.sample * lightSample.distance;
+        float targetPdf = luminance(calcLightContribution(lights, hit, lightSample.lightId, lightPoint, lightSample.emission));
+
+        // candidates are weighted against the area pdf, the domain all reservoirs share
+        const EmissiveTriangle& triangle = lights.GetTriangle(lightSample.lightId);
+        float cosLight = abs(dot(lightSample.sample, triangle.normal));
+        float areaPdf = lightSample.pdf * cosLight / (lightSample.distance * lightSample.distance);
+
+        reservoir.Update(lightSample.lightId, lightPoint, lightSample.emission, targetPdf, targetPdf / areaPdf, u);
+    }
+    reservoir.Finalize();
+
+    if (prevReservoir && prevReservoir->IsValid() && areHitsSimilar(hit, prevHit))
+    {
+        float nPrevCandidates = std::min(prevReservoir->nCandidates, static_cast<float>(temporalHistoryLength * config.nLightCandidates));
+        float targetPdf = luminance(calcLightContribution(lights, hit, prevReservoir->lightId, prevReservoir->lightPoint, prevReservoir->emission));
+        reservoir.Update(prevReservoir->lightId, prevReservoir->lightPoint, prevReservoir->emission, targetPdf, targetPdf * prevReservoir->weight * nPrevCandidates, sampler.Get1D());
+        reservoir.nCandidates += nPrevCandidates;
+        reservoir.Finalize();
+    }
+}
+
+// merges the reservoirs of random neighbors within spatialReuseRadius into the pixel's own
+// neighbors are assumed to see the same lights, so the result is slightly biased near occluders
+// isSampled(q) tells whether pixel q's hit and reservoir are from this pass, those of pixels adaptive sampling skipped are stale
+template <typename IsSampledFunc>
+static LightReservoir reuseNeighborReservoirs(const glm::u32vec2& pixel, const glm::u32vec2& dim, uint32_t sampleIndex, const Scene& scene, const TracerConfiguration& config, Sampler& sampler,
+    std::span<const PrimaryHit> hits, std::span<const LightReservoir> reservoirs, const IsSampledFunc& isSampled)
+{
+    using namespace glm;
+
+    uint64_t p = static_cast<uint64_t>(pixel.y) * dim.x + pixel.x;
+    const PrimaryHit& hit = hits[p];
+    LightReservoir reservoir = reservoirs[p];
+    if (!hit.valid)
+        return reservoir;
+
+    const LightSampler& lights = scene.GetLights();
+
+    sampler.StartPixelSample(pixel, sampleIndex);
+    for (uint32_t k = 0; k < config.nSpatialNeighbors; k++)
+    {
+        vec2 u = sampler.Get2D();
+        float v = sampler.Get1D();
+
+        vec2 offset = samplePointOnDisk(u.x, u.y) * config.spatialReuseRadius;
+        ivec2 neighbor = clamp(ivec2(vec2(pixel) + offset), ivec2(0), ivec2(dim) - 1);
+        uint64_t q = static_cast<uint64_t>(neighbor.y) * dim.x + neighbor.x;
+        if (q == p || !isSampled(q))
+            continue;
+
+        const LightReservoir& neighborReservoir = reservoirs[q];
+        if (!neighborReservoir.IsValid() || !areHitsSimilar(hit, hits[q]))
+            continue;
+
+        float targetPdf = luminance(calcLightContribution(lights, hit, neighborReservoir.lightId, neighborReservoir.lightPoint, neighborReservoir.emission));
+        reservoir.Update(neighborReservoir.lightId, neighborReservoir.lightPoint, neighborReservoir.emission,
+            targetPdf, targetPdf * neighborReservoir.weight * neighborReservoir.nCandidates, v);
+        reservoir.nCandidates += neighborReservoir.nCandidates;
+    }
+    reservoir.Finalize();
+
+    return reservoir;
+}
+
+static void printProgress(const RenderProgress& progress, std::string_view unit)
+{
+    if (progress.nCompleted == 0)
+        return;
+
+    std::chrono::seconds remainingDuration = std::chrono::duration_cast<std::chrono::seconds>(progress.estimatedRemaining);
+    int64_t remainingSeconds = remainingDuration.count();
+    int64_t remainingMinutes = remainingSeconds / 60;
+    int64_t remainingHours = remainingMinutes / 60;
+    uint64_t secondsDisp = remainingSeconds % 60;
+    uint64_t minutesDisp = remainingMinutes % 60;
+    uint64_t hoursDisp = remainingHours;
+
+    auto time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    fmt::println("[{:%T}]: {} out of {} {} completed ({:.2f}%); Estimated time remaining: {:02}:{:02}:{:02}",
+        fmt::localtime(time),
+        progress.nCompleted,
+        progress.nTotal,
+        unit,
+        static_cast<double>(progress.nCompleted) / static_cast<double>(progress.nTotal) * 100.0,
+        hoursDisp, minutesDisp, secondsDisp);
+}
+
+static void resolve(std::span<const glm::vec3> accumBuffer, std::span<const uint32_t> sampleCounts, Canvas& canvas)
+{
+    uint32_t width = canvas.GetWidth();
+    for (uint64_t p = 0; p < accumBuffer.size(); p++)
+    {
+        uint32_t i = p % width;
+        uint32_t j = static_cast<uint32_t>(p / width);
+        glm::vec3 color = sampleCounts[p] > 0 ?
+            accumBuffer[p] / static_cast<float>(sampleCounts[p]) :
+            glm::vec3(0.0f);
+        for (uint32_t k = 0; k < 3; k++)
+            canvas.Store(i, j, k, color[k]);
+    }
+}
+
+// rays waiting for one of the wavefront stages, kept as structure of arrays so that a stage streams through them
+// holds at most one ray per path in flight
+struct RayQueue
+{
+    std::vector<glm::vec3> origs, dirs;
+    std::vector<uint32_t> paths; // path each ray belongs to
+    std::atomic_uint32_t size{};
+
+    void Resize(uint32_t capacity)
+    {
+        origs.resize(capacity);
+        dirs.resize(capacity);
+        paths.resize(capacity);
+        size.store(0, std::memory_order_relaxed);
+    }
+    // claims n consecutive entries with a single atomic add, returns the first
+    uint32_t Claim(uint32_t n)
+    {
+        return size.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
+struct ShadowRayQueue : RayQueue
+{
+    std::vector<float> maxDistances;
+    std::vector<glm::vec3> contributions; // added to the path's color unless the ray is occluded
+
+    void Resize(uint32_t capacity)
+    {
+        RayQueue::Resize(capacity);
+        maxDistances.resize(capacity);
+        contributions.resize(capacity);
+    }
+};
+
+// holds a core of the gate until it is released or goes out of scope, workers release it before waiting at a barrier
+class HeldCore
+{
+public:
+    explicit HeldCore(CoreGate* gate) : gate(gate)
+    {
+        if (gate)
+            gate->Acquire();
+    }
+    HeldCore(const HeldCore&) = delete;
+    HeldCore& operator=(const HeldCore&) = delete;
+    ~HeldCore()
+    {
+        Release();
+    }
+    void Release()
+    {
+        if (gate)
+            gate->Release();
+        gate = nullptr;
+    }
+private:
+    CoreGate* gate;
+};
+
+void Tracer::Render(Canvas& canvas, const Scene& scene)
+{
+    const Scene* nodeScenes[]{&scene};
+    Render(canvas, nodeScenes);
+}
+
+std::unique_ptr<RenderJob> Tracer::Submit(Canvas& canvas, const Scene& scene)
+{
+    std::unique_ptr<RenderJob> newJob(new RenderJob());
+    newJob->partial = std::make_shared<FramebufferTileWriter>();
+    config.tileOutputs.push_back(newJob->partial);
+    job = newJob.get();
+
+    // the render waits for the pool's workers, so it runs on a thread of its own instead of a task of the pool
+    newJob->done = std::async(std::launch::async, [this, &canvas, &scene]
+    {
+        auto detachJob = [this]
+        {
+            std::erase(config.tileOutputs, std::static_pointer_cast<TileOutput>(job->partial));
+            job = nullptr;
+        };
+        try
+        {
+            Render(canvas, scene);
+        }
+        catch (...)
+        {
+            detachJob();
+            throw;
+        }
+        detachJob();
+    }).share();
+    return newJob;
+}
+
+void Tracer::RenderSequence(Scene& scene, std::span<const Camera> cameras, const FrameCallback& onFrame)
+{
+    renderSequence(scene, static_cast<uint32_t>(cameras.size()), [&](uint32_t frame) { scene.SetCamera(cameras[frame]); }, onFrame);
+}
+
+void Tracer::RenderSequence(Scene& scene, const Animation& animation, std::span<const float> frameTimes, const FrameCallback& onFrame)
+{
+    renderSequence(scene, static_cast<uint32_t>(frameTimes.size()), [&](uint32_t frame) { scene.Animate(animation, frameTimes[frame]); }, onFrame);
+}
+
+void Tracer::renderSequence(Scene& scene, uint32_t nFrames, const std::function<void(uint32_t)>& setFrame, const FrameCallback& onFrame)
+{
+    // one frame is handed over while the next one renders, a frame that is done first waits for the handover before it
+    std::future<void> handingOver;
+    try
+    {
+        for (uint32_t frame = 0; frame < nFrames; frame++)
+        {
+            setFrame(frame);
+            Canvas canvas;
+            Render(canvas, scene);
+
+            if (handingOver.valid())
+                handingOver.get();
+            handingOver = ThreadPool::GetShared().Submit(
+                [&onFrame, frame, canvas = std::move(canvas), frameFramebuffer = std::move(framebuffer)]
+                {
+                    onFrame(frame, canvas, frameFramebuffer);
+                });
+            framebuffer = Framebuffer();
+        }
+    }
+    catch (...)
+    {
+        // onFrame must not outlive the call
+        if (handingOver.valid())
+            handingOver.wait();
+        throw;
+    }
+    if (handingOver.valid())
+        handingOver.get();
+}
+
+RenderJob::~RenderJob()
+{
+    Cancel();
+    if (done.valid())
+        done.wait();
+}
+
+void RenderJob::Wait()
+{
+    done.get();
+}
+
+bool RenderJob::IsDone() const
+{
+    return done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void RenderJob::Cancel()
+{
+    isCancelled.store(true, std::memory_order_relaxed);
+}
+
+RenderProgress RenderJob::GetProgress() const
+{
+    std::lock_guard lock(progressMutex);
+    return progress;
+}
+
+void Tracer::Render(Canvas& canvas, std::span<const Scene* const> nodeScenes)
+{
+    using namespace glm;
+
+    if (nodeScenes.empty())
+        throw std::runtime_error("no scene to render");
+    const Scene& scene = *nodeScenes.front();
+
+    bool outOfCore = config.outOfCore;
+    if (outOfCore && (config.resampledDirectLighting || config.wavefront || config.progressive))
+        throw std::runtime_error("out of core rendering needs the default render mode");
+    if (outOfCore && config.tileSize == 0)
+        throw std::runtime_error("out of core rendering needs a tile size");
+    u32vec2 cropSize = getCropSize();
+    if (any(greaterThan(config.cropOrigin + cropSize, u32vec2(config.width, config.height))))
+        throw std::runtime_error("crop window is outside of the image");
+    bool isCropped = cropSize != u32vec2(config.width, config.height);
+    if (isCropped && (config.resampledDirectLighting || config.wavefront || config.progressive))
+        throw std::runtime_error("crop windows need the default render mode");
+
+    canvas.SetBuffer(outOfCore ? 0u : config.width, outOfCore ? 0u : config.height, 3u);
+
+    u32vec2 dim(config.width, config.height);
+    CameraRayGenerator cameraRays(scene.GetCamera(), dim);
+    uint64_t nPixels = static_cast<uint64_t>(dim.x) * dim.y;
+    // out of core every worker reuses its own stretch of the buffers, a tile's worth of pixels, for each of its tiles
+    uint64_t nTilePixels = static_cast<uint64_t>(config.tileSize) * config.tileSize;
+    uint64_t nBufferPixels = outOfCore ? config.nThreads * nTilePixels : nPixels;
+
+    accumBuffer.assign(nBufferPixels, vec3(0.0f));
+    sampleCounts.assign(nBufferPixels, 0u);
+    luminanceMoments.assign(nBufferPixels, vec2(0.0f));
+    aovBuffer.assign(nBufferPixels, SampleAovs{});
+
+    statistics = RenderStatistics{};
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (const std::shared_ptr<TileOutput>& output : config.tileOutputs)
+        output->Begin(dim.x, dim.y);
+
+    auto traceSample = [&, this](Sampler& sampler, uint64_t p)
+    {
+        uint32_t i = p % dim.x;
+        uint32_t j = static_cast<uint32_t>(p / dim.x);
+        SampleAovs aovs;
+        vec3 rayColor = tracePixelSample(u32vec2(i, j), sampleCounts[p], cameraRays, scene, config, sampler, aovs);
+        accumulateSample(p, rayColor, aovs);
+    };
+
+    if (config.resampledDirectLighting)
+    {
+        // each pass is split into stages over the whole frame, neighbors' reservoirs are only complete after a barrier
+        std::vector<PrimaryHit> primaryHits(nPixels, PrimaryHit{});
+        std::vector<LightReservoir> initialReservoirs(nPixels);
+        std::vector<LightReservoir> reservoirs(nPixels);
+
+        std::array<std::function<void(Sampler&, uint64_t)>, 3> stages
+        {
+            [&, this](Sampler& sampler, uint64_t p)
+            {
+                u32vec2 pixel(p % dim.x, static_cast<uint32_t>(p / dim.x));
+                const LightReservoir* prevReservoir = config.temporalReuse && sampleCounts[p] > 0 ? &reservoirs[p] : nullptr;
+                generateLightReservoir(pixel, sampleCounts[p], cameraRays, scene, config, sampler, primaryHits[p], initialReservoirs[p], prevReservoir);
+            },
+            [&, this](Sampler& sampler, uint64_t p)
+            {
+                u32vec2 pixel(p % dim.x, static_cast<uint32_t>(p / dim.x));
+                // the first stage ran for the pixels that still need samples, nothing has been accumulated since
+                reservoirs[p] = reuseNeighborReservoirs(pixel, dim, sampleCounts[p], scene, config, sampler, primaryHits, initialReservoirs,
+                    [this](uint64_t q) { return needsSamples(q); });
+            },
+            [&, this](Sampler& sampler, uint64_t p)
+            {
+                u32vec2 pixel(p % dim.x, static_cast<uint32_t>(p / dim.x));
+                sampler.StartPixelSample(pixel, sampleCounts[p]);
+                // the primary ray was traced by the first stage
+                const PrimaryHit& hit = primaryHits[p];
+                PathState path{};
+                path.orig = hit.orig;
+                path.dir = hit.dir;
+                vec3 color = discardNan(tracePath(path, hit.result, scene, config, sampler, &reservoirs[p]));
+                accumulateSample(p, color, path.aovs);
+            }
+        };
+        renderProgressive(nPixels, stages);
+    }
+    else if (config.wavefront)
+    {
+        renderWavefront(cameraRays, scene, dim);
+    }
+    else if (config.progressive)
+    {
+        std::array<std::function<void(Sampler&, uint64_t)>, 1> stages{traceSample};
+        renderProgressive(nPixels, stages);
+    }
+    else
+    {
+        // workers of a node are consecutive, so every node covers a contiguous part of the curve
+        const std::vector<NumaNode>& nodes = getNumaNodes();
+        uint32_t nNodes = config.pinThreads ? static_cast<uint32_t>(nodes.size()) : 1u;
+        std::vector<uint32_t> threadNodes(config.nThreads);
+        std::vector<uint32_t> threadCpus(config.nThreads);
+        std::vector<uint32_t> nNodeThreads(nNodes, 0u);
+        for (uint32_t t = 0; t < config.nThreads; t++)
+        {
+            uint32_t node = getWorkerNode(t, config.nThreads, nNodes);
+            const std::vector<uint32_t>& cpus = nodes[node].cpus;
+            threadNodes[t] = node;
+            threadCpus[t] = cpus[nNodeThreads[node]++ % cpus.size()];
+        }
+
+        std::vector<Tile> tiles = generateImageTiles();
+        // out of core nothing is kept per tile but the tile list, no statistics and no checkpoint flags
+        if (!outOfCore)
+            statistics.tiles.assign(tiles.size(), TileStatistics{});
+
+        // tiles restored from a checkpoint are done, the others are scheduled in curve order as usual
+        bool checkpoints = !outOfCore && !config.checkpointPath.empty();
+        std::vector<uint8_t> isTileRestored(checkpoints ? tiles.size() : 0u, 0u);
+        std::vector<uint32_t> restoredTiles;
+        if (checkpoints && config.resume)
+            restoredTiles = loadCheckpoint(tiles);
+        for (uint32_t tileIndex : restoredTiles)
+        {
+            const Tile& tile = tiles[tileIndex];
+            isTileRestored[tileIndex] = 1u;
+            streamTile(tile.origin, tile.size, static_cast<uint64_t>(tile.origin.y) * dim.x + tile.origin.x, dim.x);
+        }
+        // without restored tiles the scheduler's indices are the tile indices
+        std::vector<uint32_t> pendingTiles;
+        if (!restoredTiles.empty())
+            for (uint32_t tileIndex = 0; tileIndex < tiles.size(); tileIndex++)
+                if (!isTileRestored[tileIndex])
+                    pendingTiles.push_back(tileIndex);
+        uint32_t nPendingTiles = static_cast<uint32_t>(restoredTiles.empty() ? tiles.size() : pendingTiles.size());
+        TileScheduler scheduler(nPendingTiles, config.nThreads, threadNodes);
+
+        // the checkpoint reads the tiles flagged finished
+        std::vector<std::atomic_bool> isTileFinished(checkpoints ? tiles.size() : 0u);
+        for (uint32_t tileIndex = 0; tileIndex < isTileFinished.size(); tileIndex++)
+            isTileFinished[tileIndex].store(isTileRestored[tileIndex] != 0u, std::memory_order_relaxed);
+        std::atomic_uint64_t nTilesCompleted{tiles.size() - nPendingTiles};
+        std::atomic_uint64_t nRaysTraced{};
+
+        auto callable = [&, this](uint32_t thread)
+        {
+            if (config.pinThreads)
+                pinCurrentThread(std::span(&threadCpus[thread], 1));
+            const Scene& nodeScene = *nodeScenes[std::min<size_t>(threadNodes[thread], nodeScenes.size() - 1)];
+
+            std::array<std::unique_ptr<Sampler>, rayPacketSize> laneSamplers;
+            for (std::unique_ptr<Sampler>& sampler : laneSamplers)
+                sampler = createSampler(config);
+            uint64_t nThreadTileRays = 0;
+            while (std::optional<uint32_t> next = scheduler.Next(thread))
+            {
+                // a cancelled render leaves the remaining tiles black
+                if (isCancelled())
+                    break;
+                HeldCore core(config.coreGate.get());
+                uint32_t tileIndex = restoredTiles.empty() ? next.value() : pendingTiles[next.value()];
+                const Tile& tile = tiles[tileIndex];
+                auto tileStartTime = std::chrono::steady_clock::now();
+
+                uint64_t firstBuffer = static_cast<uint64_t>(tile.origin.y) * dim.x + tile.origin.x;
+                uint64_t bufferStride = dim.x;
+                if (outOfCore)
+                {
+                    firstBuffer = thread * nTilePixels;
+                    bufferStride = tile.size.x;
+                    clearPixels(firstBuffer, nTilePixels);
+                }
+
+                uint64_t nTileSamples = renderTile(tile, firstBuffer, bufferStride, cameraRays, nodeScene, laneSamplers);
+
+                uint64_t nTileRays = takeThreadRayCount();
+                nThreadTileRays += nTileRays;
+                if (!outOfCore)
+                {
+                    // every tile is written by exactly one thread
+                    TileStatistics& tileStatistics = statistics.tiles[tileIndex];
+                    tileStatistics.origin = tile.origin;
+                    tileStatistics.size = tile.size;
+                    tileStatistics.thread = thread;
+                    tileStatistics.nSamples = nTileSamples;
+                    tileStatistics.nRaysTraced = nTileRays;
+                    tileStatistics.duration = std::chrono::steady_clock::now() - tileStartTime;
+                }
+                streamTile(tile.origin, tile.size, firstBuffer, bufferStride);
+
+                // the checkpoint reads the tile's pixels once it sees the flag
+                if (checkpoints)
+                    isTileFinished[tileIndex].store(true, std::memory_order_release);
+                nTilesCompleted.fetch_add(1, std::memory_order_relaxed);
+            }
+            nRaysTraced.fetch_add(nThreadTileRays, std::memory_order_relaxed);
+            // the pool's workers are shared, they must not stay bound to this render's cpus
+            if (config.pinThreads)
+                unpinCurrentThread();
+        };
+
+        std::future<void> rendered = ThreadPool::GetShared().Launch(config.nThreads, callable);
+
+        // returns as soon as the last tile is done, progress is printed every second until then
+        // and the finished tiles are saved every checkpointInterval
+        using namespace std::chrono_literals;
+        auto lastCheckpointTime = std::chrono::steady_clock::now();
+        while (rendered.wait_for(1s) != std::future_status::ready)
+        {
+            reportProgress(startTime, nTilesCompleted.load(std::memory_order_relaxed), tiles.size(), "tiles");
+            if (!checkpoints || std::chrono::steady_clock::now() - lastCheckpointTime < config.checkpointInterval)
+                continue;
+            std::vector<uint32_t> finishedTiles;
+            for (uint32_t tileIndex = 0; tileIndex < tiles.size(); tileIndex++)
+                if (isTileFinished[tileIndex].load(std::memory_order_acquire))
+                    finishedTiles.push_back(tileIndex);
+            saveCheckpoint(tiles, finishedTiles);
+            lastCheckpointTime = std::chrono::steady_clock::now();
+        }
+        rendered.get();
+        statistics.nRaysTraced = nRaysTraced.load();
+        reportProgress(startTime, nTilesCompleted.load(), tiles.size(), "tiles");
+
+        // a resumed render picks up where the cancelled one stopped
+        if (checkpoints && isCancelled())
+        {
+            std::vector<uint32_t> finishedTiles;
+            for (uint32_t tileIndex = 0; tileIndex < tiles.size(); tileIndex++)
+                if (isTileFinished[tileIndex].load(std::memory_order_relaxed))
+                    finishedTiles.push_back(tileIndex);
+            saveCheckpoint(tiles, finishedTiles);
+        }
+    }
+    if (config.resampledDirectLighting || config.wavefront || config.progressive)
+        streamTile(u32vec2(0u), dim, 0u, dim.x);
+    for (const std::shared_ptr<TileOutput>& output : config.tileOutputs)
+        output->End();
+
+    if (outOfCore)
+    {
+        // the image only exists in the tile outputs
+        framebuffer.SetSize(0u, 0u);
+    }
+    else
+    {
+        resolveFramebuffer(dim);
+        resolveCanvas(canvas);
+    }
+
+    statistics.duration = std::chrono::steady_clock::now() - startTime;
+    if (config.logProgress)
+        fmt::println("Traced {} rays in {:.2f}s ({:.2f} Mrays/s)",
+        statistics.nRaysTraced,
+        statistics.duration.count(),
+        static_cast<double>(statistics.nRaysTraced) / statistics.duration.count() * 1e-6);
+}
+
+uint64_t Tracer::renderTile(const Tile& tile, uint64_t firstBuffer, uint64_t bufferStride, const CameraRayGenerator& cameraRays, const Scene& scene,
+    std::span<const std::unique_ptr<Sampler>, rayPacketSize> samplers)
 {
     using namespace glm;
 
-    // both are in world space
-    vec3 camRightInWorld = normalize(
-        cross(lookVec, vec3(0.0f, 1.0f, 0.0f)));
-    vec3 camUpInWorld = normalize(
-        cross(camRightInWorld, lookVec));
-    
-    vec3 toFrustumPlane =
-        (on2DFrustumPlane.x * camRightInWorld + on2DFrustumPlane.y * camUpInWorld) // translate the point on the view frustum to a plane in world space
-        * tan(fov / 2.0f) // scale the plane based on fov
-        + lookVec; // push it in the direction the camera is facing
-    
-    return toFrustumPlane;
+    uint64_t nTileSamples = 0;
+    for (uint32_t j = tile.origin.y; j < tile.origin.y + tile.size.y; j++)
+        for (uint32_t i = tile.origin.x; i < tile.origin.x + tile.size.x; i++)
+        {
+            uint64_t p = firstBuffer + (j - tile.origin.y) * bufferStride + (i - tile.origin.x);
+            uint32_t nPrevSamples = sampleCounts[p];
+
+            // the samples every pixel takes anyway go in packets, adaptive ones one by one
+            while (config.rayPackets && sampleCounts[p] + rayPacketSize <= getMinSamplesPerPixel())
+            {
+                std::array<vec3, rayPacketSize> colors;
+                std::array<SampleAovs, rayPacketSize> aovs;
+                tracePixelSamplePacket(u32vec2(i, j), sampleCounts[p], cameraRays, scene, config, samplers, colors, aovs);
+                for (uint32_t lane = 0; lane < rayPacketSize; lane++)
+                    accumulateSample(p, colors[lane], aovs[lane]);
+            }
+            while (needsSamples(p))
+            {
+                SampleAovs aovs;
+                vec3 color = tracePixelSample(u32vec2(i, j), sampleCounts[p], cameraRays, scene, config, *samplers[0], aovs);
+                accumulateSample(p, color, aovs);
+            }
+
+            nTileSamples += sampleCounts[p] - nPrevSamples;
+        }
+    return nTileSamples;
+}
+
+void Tracer::clearPixels(uint64_t firstPixel, uint64_t nPixels)
+{
+    std::fill_n(accumBuffer.begin() + firstPixel, nPixels, glm::vec3(0.0f));
+    std::fill_n(sampleCounts.begin() + firstPixel, nPixels, 0u);
+    std::fill_n(luminanceMoments.begin() + firstPixel, nPixels, glm::vec2(0.0f));
+    std::fill_n(aovBuffer.begin() + firstPixel, nPixels, SampleAovs{});
+}
+
+void Tracer::streamTile(const glm::u32vec2& origin, const glm::u32vec2& size, uint64_t firstBuffer, uint64_t bufferStride) const
+{
+    using namespace glm;
+
+    if (config.tileOutputs.empty())
+        return;
+    std::vector<float> rgb(static_cast<size_t>(size.x) * size.y * 3);
+    for (uint32_t j = 0; j < size.y; j++)
+        for (uint32_t i = 0; i < size.x; i++)
+        {
+            uint64_t p = firstBuffer + j * bufferStride + i;
+            vec3 color = sampleCounts[p] > 0 ? accumBuffer[p] / static_cast<float>(sampleCounts[p]) : vec3(0.0f);
+            for (uint32_t k = 0; k < 3; k++)
+                rgb[(static_cast<size_t>(j) * size.x + i) * 3 + k] = color[k];
+        }
+    for (const std::shared_ptr<TileOutput>& output : config.tileOutputs)
+        output->WriteTile(origin, size, rgb);
+}
+
+glm::u32vec2 Tracer::getCropSize() const
+{
+    return config.cropSize == glm::u32vec2(0u) ? glm::u32vec2(config.width, config.height) : config.cropSize;
+}
+
+std::vector<Tile> Tracer::generateImageTiles() const
+{
+    std::vector<Tile> tiles = generateTiles(getCropSize(), config.tileSize, config.tileOrder);
+    for (Tile& tile : tiles)
+        tile.origin += config.cropOrigin;
+    return tiles;
+}
+
+void Tracer::resolveCanvas(Canvas& canvas) const
+{
+    if (!config.denoise)
+    {
+        resolve(accumBuffer, sampleCounts, canvas);
+        return;
+    }
+
+    // the canvas shows the denoised image
+    std::span<const float> denoised = framebuffer.GetLayer(denoisedLayerName);
+    uint32_t width = canvas.GetWidth();
+    for (uint64_t p = 0; p < accumBuffer.size(); p++)
+        for (uint32_t k = 0; k < 3; k++)
+            canvas.Store(p % width, static_cast<uint32_t>(p / width), k, denoised[p * 3 + k]);
+}
+
+void Tracer::renderProgressive(uint64_t nPixels, std::span<const std::function<void(Sampler&, uint64_t)>> stages)
+{
+    using namespace std::chrono_literals;
+
+    uint32_t nMaxPasses = getMaxSamplesPerPixel();
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto isOverBudget = [&]
+    {
+        return config.timeBudget.count() > 0 &&
+            std::chrono::steady_clock::now() - startTime >= config.timeBudget;
+    };
+
+    std::atomic_uint64_t pixel{};
+    std::atomic_bool anyPixelSampled{};
+    std::atomic_bool finished{};
+    std::atomic_uint64_t nRaysTraced{};
+    uint32_t nPassesCompleted = 0;
+    size_t nStagesCompleted = 0;
+
+    // snapshots are copied out between passes and resolved by the calling thread while the next pass runs
+    std::mutex snapshotMutex;
+    std::condition_variable snapshotCondition;
+    bool snapshotPending = false;
+    uint32_t snapshotPasses = 0;
+    std::vector<glm::vec3> snapshotAccumBuffer;
+    std::vector<uint32_t> snapshotSampleCounts;
+
+    auto onPassCompleted = [&]() noexcept
+    {
+        // every stage sweeps the whole frame before the next one starts
+        if (++nStagesCompleted < stages.size())
+        {
+            pixel.store(0, std::memory_order_relaxed);
+            return;
+        }
+        nStagesCompleted = 0;
+
+        std::lock_guard lock(snapshotMutex);
+        nPassesCompleted++;
+        bool done =
+            !anyPixelSampled.exchange(false, std::memory_order_relaxed) ||
+            nPassesCompleted >= nMaxPasses ||
+            isOverBudget() ||
+            isCancelled();
+
+        if (!done && config.onSnapshot && config.nPassesPerSnapshot > 0 && nPassesCompleted % config.nPassesPerSnapshot == 0)
+        {
+            snapshotAccumBuffer = accumBuffer;
+            snapshotSampleCounts = sampleCounts;
+            snapshotPasses = nPassesCompleted;
+            snapshotPending = true;
+        }
+        finished.store(done, std::memory_order_relaxed);
+        pixel.store(0, std::memory_order_relaxed);
+        snapshotCondition.notify_one();
+    };
+    std::barrier passBarrier(static_cast<std::ptrdiff_t>(config.nThreads), onPassCompleted);
+
+    auto callable = [&, this]
+    {
+        std::vector<std::unique_ptr<Sampler>> samplers;
+        for (uint32_t stage = 0; stage < stages.size(); stage++)
+            samplers.push_back(createSampler(config, stage));
+        while (!finished.load(std::memory_order_relaxed))
+        {
+            for (size_t stage = 0; stage < stages.size(); stage++)
+            {
+                bool isLastStage = stage + 1 == stages.size();
+                HeldCore core(config.coreGate.get());
+                while (true)
+                {
+                    uint64_t p = pixel.fetch_add(1, std::memory_order_relaxed);
+                    if (p >= nPixels)
+                        break;
+                    if (!needsSamples(p))
+                        continue;
+
+                    stages[stage](*samplers.at(stage), p);
+                    anyPixelSampled.store(true, std::memory_order_relaxed);
+
+                    // cut the pass short once out of time or cancelled, every pixel keeps track of its own sample count
+                    // earlier stages always finish since the last one depends on their results
+                    if (isLastStage && nPassesCompleted > 0 && (isOverBudget() || isCancelled()))
+                        break;
+                }
+                core.Release();
+                passBarrier.arrive_and_wait();
+            }
+        }
+        nRaysTraced.fetch_add(takeThreadRayCount(), std::memory_order_relaxed);
+    };
+
+    std::future<void> rendered = ThreadPool::GetShared().Launch(config.nThreads, [&](uint32_t) { callable(); });
+
+    auto lastProgressTime = startTime;
+    while (true)
+    {
+        std::unique_lock lock(snapshotMutex);
+        snapshotCondition.wait_for(lock, 1s, [&] { return snapshotPending || finished.load(std::memory_order_relaxed); });
+        if (snapshotPending)
+        {
+            std::vector<glm::vec3> accum = std::move(snapshotAccumBuffer);
+            std::vector<uint32_t> counts = std::move(snapshotSampleCounts);
+            uint32_t passes = snapshotPasses;
+            snapshotPending = false;
+            lock.unlock();
+
+            Canvas snapshot(config.width, config.height, 3u);
+            resolve(accum, counts, snapshot);
+            config.onSnapshot(snapshot, passes);
+            continue;
+        }
+        if (finished.load(std::memory_order_relaxed))
+            break;
+        uint64_t nCompleted = static_cast<uint64_t>(nPassesCompleted) * nPixels + std::min(pixel.load(std::memory_order_relaxed), nPixels);
+        lock.unlock();
+
+        if (std::chrono::steady_clock::now() - lastProgressTime >= 1s)
+        {
+            lastProgressTime = std::chrono::steady_clock::now();
+            reportProgress(startTime, nCompleted, static_cast<uint64_t>(nMaxPasses) * nPixels, "pixel samples");
+        }
+    }
+
+    rendered.get();
+    statistics.nRaysTraced += nRaysTraced.load();
+    // adaptive sampling and the time budget end renders short of the maximum, only a cancelled one is incomplete
+    uint64_t nSamples = std::accumulate(sampleCounts.begin(), sampleCounts.end(), uint64_t(0));
+    reportProgress(startTime, nSamples, isCancelled() ? static_cast<uint64_t>(nMaxPasses) * nPixels : nSamples, "pixel samples");
 }
 
-static glm::vec3 castRay(const glm::vec3& _Orig, const glm::vec3& _Dir, const Scene& scene, const TracerConfiguration& config, RNG& rng, const std::vector<std::unique_ptr<EmissionProfile>>& emissionProfiles)
+void Tracer::renderWavefront(const CameraRayGenerator& cameraRays, const Scene& scene, const glm::u32vec2& dim)
 {
     using namespace glm;
+    using namespace std::chrono_literals;
 
-    vec3 color(0.0f);
-    vec3 throughput(1.0f);
+    // entries a worker takes at a time in every stage
+    constexpr uint32_t chunkSize = 256u;
+    constexpr uint64_t noPixel = std::numeric_limits<uint64_t>::max();
+    // hits are sorted by material with a counting sort over this many bins, materials are spread over them by address
+    constexpr uint32_t nMaterialBinBits = 8u;
+    constexpr uint32_t nMaterialBins = 1u << nMaterialBinBits;
 
-    vec3 orig = _Orig;
-    vec3 dir = _Dir;
+    enum class Stage
+    {
+        Generate, Extend, Sort, Shade, Shadow
+    };
 
-    float currentIor = 1.0f;
-    bool isInsideObject = false;
+    struct QueuedShadowRay
+    {
+        glm::vec3 orig, dir;
+        float maxDistance;
+        glm::vec3 contribution;
+        uint32_t path;
+    };
 
-    uint32_t i = 0;
-    while (true)
+    uint64_t nPixels = static_cast<uint64_t>(dim.x) * dim.y;
+    uint32_t nMaxPasses = getMaxSamplesPerPixel();
+    uint32_t nPaths = std::max(config.nWavefrontPaths, 1u);
+
+    // the paths in flight, a slot takes the next pixel of the pass once its path has terminated and been accumulated
+    std::vector<PathState> paths(nPaths);
+    std::vector<uint64_t> pathPixels(nPaths, noPixel);
+    std::vector<uint8_t> pathsActive(nPaths, false);
+    std::vector<std::unique_ptr<Sampler>> samplers;
+    for (uint32_t k = 0; k < nPaths; k++)
+        samplers.push_back(createSampler(config));
+
+    // extension rays are double buffered, the shade stage queues the next rays while reading the current ones
+    std::array<RayQueue, 2> extensionRays;
+    for (RayQueue& queue : extensionRays)
+        queue.Resize(nPaths);
+    ShadowRayQueue shadowRays;
+    shadowRays.Resize(nPaths);
+    std::vector<HitResult> hits(nPaths);
+    // extend counts the hits of every material bin per chunk of rays, the counts are turned into the chunks' offsets into
+    // shadingOrder between the stages and sort scatters the rays there, so the sort runs on all workers like the other stages
+    uint32_t nMaxChunks = (nPaths + chunkSize - 1) / chunkSize;
+    std::vector<uint32_t> hitBins(nPaths);
+    std::vector<uint32_t> chunkBinCounts(static_cast<size_t>(nMaxChunks) * nMaterialBins);
+    std::vector<uint32_t> shadingOrder(nPaths); // ray indices
+    uint32_t nShadedRays = 0;
+    uint32_t current = 0;
+
+    Stage stage = Stage::Generate;
+    std::atomic_uint32_t nextEntry{};
+    std::atomic_uint64_t nextPixel{};
+    std::atomic_bool anyPixelSampled{};
+    std::atomic_uint32_t nPassesCompleted{};
+    std::atomic_bool finished{};
+    std::mutex finishedMutex;
+    std::condition_variable finishedCondition;
+    uint64_t nRaysTraced = 0;
+
+    auto takePixel = [&, this]
+    {
+        while (true)
+        {
+            uint64_t p = nextPixel.fetch_add(1, std::memory_order_relaxed);
+            if (p >= nPixels)
+                return noPixel;
+            if (needsSamples(p))
+                return p;
+        }
+    };
+
+    // paths that hit the same material are shaded next to each other so that its code and textures stay in cache,
+    // the address of the record (or of the material without one) serves as the material id
+    auto getMaterialBin = [&](const SurfaceData& surface)
+    {
+        uintptr_t key = config.staticMaterialDispatch && surface.materialRecord ?
+            reinterpret_cast<uintptr_t>(surface.materialRecord) :
+            reinterpret_cast<uintptr_t>(surface.material);
+        return static_cast<uint32_t>((static_cast<uint64_t>(key >> 4) * 0x9e3779b97f4a7c15ull) >> (64u - nMaterialBinBits));
+    };
+
+    auto getChunkBinCounts = [&](uint32_t begin)
     {
-        HitResult hit{};
-        scene.Trace(orig, dir, hit);
+        return std::span(chunkBinCounts).subspan(static_cast<size_t>(begin / chunkSize) * nMaterialBins, nMaterialBins);
+    };
 
-        if (!hit.valid)
+    auto forEachChunk = [&](uint32_t n, const auto& func)
+    {
+        while (true)
         {
-            color += throughput * scene.GetAmbientColor();
-            break;
+            uint32_t begin = nextEntry.fetch_add(chunkSize, std::memory_order_relaxed);
+            if (begin >= n)
+                break;
+            func(begin, std::min(begin + chunkSize, n));
         }
+    };
 
-        const SurfaceData& surface = hit.surfaceData;
-        vec3 point = orig + dir * hit.distance;
-        vec3 normal = surface.normal;
-
-        const Material* material = hit.surfaceData.material;
-        vec3 emissive;
-        emissive = material->GetEmissivity(surface.texCoords);
-
-        color += throughput * emissive;
-
-        std::optional<glm::vec3> emissionSample;
-        std::vector<const EmissionProfile*> selectedProfiles;
-        // if (!emissionProfiles.empty())
-        // {
-        //     std::vector<EmissionSample> emissionSamples;
-        //     for (const auto& emission : emissionProfiles)
-        //     {
-        //         auto result = emission->Sample(rng, biasedP, normal);
-        //         if (!result)
-        //             continue;
-
-        //         EmissionSample emissionSample = result.value();
-        //         emissionSamples.push_back(emissionSample);
-        //         selectedProfiles.push_back(emission.get());
-        //     }
-        //     if (!emissionSamples.empty())
-        //     {
-        //         int selectedIndex = rng.Uniform(0, static_cast<uint32_t>(emissionSamples.size()) - 1);
-        //         vec3 sample = emissionSamples.at(selectedIndex).sample;
-        //         emissionSample = sample;
-        //     }
-        // }
-        std::function<float(const glm::vec3&)> emissionPdfFunc = [&](const glm::vec3& sample) -> float
-        {
-            float accumPdf = 0.0f;
-            for (const EmissionProfile* emission : selectedProfiles)
-                accumPdf += emission->GetPdf(point, sample);
-            return accumPdf / static_cast<float>(selectedProfiles.size());
-        };
+    auto queueExtensionRays = [&](RayQueue& queue, std::span<const uint32_t> queuedPaths)
+    {
+        uint32_t first = queue.Claim(static_cast<uint32_t>(queuedPaths.size()));
+        for (size_t i = 0; i < queuedPaths.size(); i++)
+        {
+            uint32_t k = queuedPaths[i];
+            queue.origs[first + i] = paths[k].orig;
+            queue.dirs[first + i] = paths[k].dir;
+            queue.paths[first + i] = k;
+        }
+    };
 
-        vec3 sample;
-        bool insidePrev = isInsideObject;
-        bool generateNewRays = material->Shade(rng, dir, normal, surface.texCoords, emissionSample, emissionPdfFunc, sample, throughput, currentIor, isInsideObject);
-        bool mediumChanged = insidePrev != isInsideObject;        
-        if (!generateNewRays)
-            break;
+    // the serial part between two stages, run by the last worker to arrive
+    auto onStageCompleted = [&]() noexcept
+    {
+        nextEntry.store(0, std::memory_order_relaxed);
+        RayQueue& rays = extensionRays[current];
+        switch (stage)
+        {
+            case Stage::Generate:
+            {
+                if (rays.size.load(std::memory_order_relaxed) > 0)
+                {
+                    stage = Stage::Extend;
+                    break;
+                }
+
+                // every path of the pass has terminated and been accumulated, generate starts over with the next pass
+                uint32_t nPasses = nPassesCompleted.fetch_add(1, std::memory_order_relaxed) + 1;
+                bool done = !anyPixelSampled.exchange(false, std::memory_order_relaxed) || nPasses >= nMaxPasses || isCancelled();
+                nextPixel.store(0, std::memory_order_relaxed);
+                if (done)
+                {
+                    std::lock_guard lock(finishedMutex);
+                    finished.store(true, std::memory_order_relaxed);
+                    finishedCondition.notify_one();
+                }
+                break;
+            }
+            case Stage::Extend:
+            {
+                // exclusive prefix sum over the bins, and within a bin over the chunks
+                uint32_t nRays = rays.size.load(std::memory_order_relaxed);
+                uint32_t nChunks = (nRays + chunkSize - 1) / chunkSize;
+                nRaysTraced += nRays;
+                uint32_t offset = 0;
+                for (uint32_t bin = 0; bin < nMaterialBins; bin++)
+                    for (uint32_t chunk = 0; chunk < nChunks; chunk++)
+                        offset += std::exchange(chunkBinCounts[static_cast<size_t>(chunk) * nMaterialBins + bin], offset);
+                nShadedRays = offset;
+                stage = Stage::Sort;
+                break;
+            }
+            case Stage::Sort:
+                stage = Stage::Shade;
+                break;
+            case Stage::Shade:
+                stage = Stage::Shadow;
+                break;
+            case Stage::Shadow:
+                nRaysTraced += shadowRays.size.load(std::memory_order_relaxed);
+                shadowRays.size.store(0, std::memory_order_relaxed);
+                rays.size.store(0, std::memory_order_relaxed);
+                current ^= 1u;
+                stage = Stage::Generate;
+                break;
+        }
+    };
+    std::barrier stageBarrier(static_cast<std::ptrdiff_t>(config.nThreads), onStageCompleted);
+
+    auto callable = [&, this]
+    {
+        std::vector<uint32_t> queuedPaths;
+        std::vector<QueuedShadowRay> queuedShadowRays;
+        queuedPaths.reserve(chunkSize);
+        queuedShadowRays.reserve(chunkSize);
+        while (!finished.load(std::memory_order_relaxed))
+        {
+            HeldCore core(config.coreGate.get());
+            RayQueue& rays = extensionRays[current];
+            switch (stage)
+            {
+                case Stage::Generate:
+                    // accumulate the paths that terminated and start new ones in their slots
+                    forEachChunk(nPaths, [&](uint32_t begin, uint32_t end)
+                    {
+                        queuedPaths.clear();
+                        for (uint32_t k = begin; k < end; k++)
+                        {
+                            if (pathsActive[k])
+                                continue;
+                            if (pathPixels[k] != noPixel)
+                            {
+                                accumulateSample(pathPixels[k], discardNan(paths[k].color), paths[k].aovs);
+                                pathPixels[k] = noPixel;
+                            }
+
+                            uint64_t p = takePixel();
+                            if (p == noPixel)
+                                continue;
+                            u32vec2 pixel(p % dim.x, static_cast<uint32_t>(p / dim.x));
+                            Sampler& sampler = *samplers[k];
+                            sampler.StartPixelSample(pixel, sampleCounts[p]);
+                            paths[k] = PathState{};
+                            cameraRays.Generate(pixel, sampler, paths[k].orig, paths[k].dir);
+                            pathPixels[k] = p;
+                            pathsActive[k] = true;
+                            anyPixelSampled.store(true, std::memory_order_relaxed);
+                            queuedPaths.push_back(k);
+                        }
+                        queueExtensionRays(rays, queuedPaths);
+                    });
+                    break;
+                case Stage::Extend:
+                    forEachChunk(rays.size.load(std::memory_order_relaxed), [&](uint32_t begin, uint32_t end)
+                    {
+                        uint32_t n = end - begin;
+                        scene.Trace(
+                            std::span<const vec3>(rays.origs).subspan(begin, n),
+                            std::span<const vec3>(rays.dirs).subspan(begin, n),
+                            std::span(hits).subspan(begin, n));
+                        std::span<uint32_t> binCounts = getChunkBinCounts(begin);
+                        std::ranges::fill(binCounts, 0u);
+                        for (uint32_t r = begin; r < end; r++)
+                        {
+                            if (hits[r].valid)
+                            {
+                                hitBins[r] = getMaterialBin(hits[r].surfaceData);
+                                binCounts[hitBins[r]]++;
+                                continue;
+                            }
+                            uint32_t k = rays.paths[r];
+                            paths[k].color += paths[k].throughput * scene.GetAmbientColor();
+                            pathsActive[k] = false;
+                        }
+                    });
+                    break;
+                case Stage::Sort:
+                    // the chunks are the same as in extend, each one scatters its hits from its own offsets
+                    forEachChunk(rays.size.load(std::memory_order_relaxed), [&](uint32_t begin, uint32_t end)
+                    {
+                        std::span<uint32_t> binOffsets = getChunkBinCounts(begin);
+                        for (uint32_t r = begin; r < end; r++)
+                            if (hits[r].valid)
+                                shadingOrder[binOffsets[hitBins[r]]++] = r;
+                    });
+                    break;
+                case Stage::Shade:
+                    forEachChunk(nShadedRays, [&](uint32_t begin, uint32_t end)
+                    {
+                        queuedPaths.clear();
+                        queuedShadowRays.clear();
+                        for (uint32_t i = begin; i < end; i++)
+                        {
+                            uint32_t r = shadingOrder[i];
+                            uint32_t k = rays.paths[r];
+                            auto queueShadowRay = [&](const vec3& orig, const vec3& dir, float maxDistance, const vec3& contribution)
+                            {
+                                queuedShadowRays.push_back(QueuedShadowRay{orig, dir, maxDistance, contribution, k});
+                            };
+                            pathsActive[k] = shadeVertex(paths[k], hits[r], scene, config, *samplers[k], nullptr, queueShadowRay);
+                            if (pathsActive[k])
+                                queuedPaths.push_back(k);
+                        }
+                        queueExtensionRays(extensionRays[current ^ 1u], queuedPaths);
+
+                        uint32_t first = shadowRays.Claim(static_cast<uint32_t>(queuedShadowRays.size()));
+                        for (size_t i = 0; i < queuedShadowRays.size(); i++)
+                        {
+                            const QueuedShadowRay& ray = queuedShadowRays[i];
+                            shadowRays.origs[first + i] = ray.orig;
+                            shadowRays.dirs[first + i] = ray.dir;
+                            shadowRays.maxDistances[first + i] = ray.maxDistance;
+                            shadowRays.contributions[first + i] = ray.contribution;
+                            shadowRays.paths[first + i] = ray.path;
+                        }
+                    });
+                    break;
+                case Stage::Shadow:
+                    // every path queues at most one shadow ray per vertex, so the colors can be updated without locking
+                    forEachChunk(shadowRays.size.load(std::memory_order_relaxed), [&](uint32_t begin, uint32_t end)
+                    {
+                        for (uint32_t i = begin; i < end; i++)
+                            if (!scene.Occluded(shadowRays.origs[i], shadowRays.dirs[i], shadowRays.maxDistances[i]))
+                                paths[shadowRays.paths[i]].color += shadowRays.contributions[i];
+                    });
+                    break;
+            }
+            core.Release();
+            stageBarrier.arrive_and_wait();
+        }
+    };
+
+    std::future<void> rendered = ThreadPool::GetShared().Launch(config.nThreads, [&](uint32_t) { callable(); });
 
-        if (i++ == config.nMaxBounces)
+    auto startTime = std::chrono::steady_clock::now();
+    while (true)
+    {
+        std::unique_lock lock(finishedMutex);
+        if (finishedCondition.wait_for(lock, 1s, [&] { return finished.load(std::memory_order_relaxed); }))
             break;
+        lock.unlock();
+
+        uint64_t nCompleted = static_cast<uint64_t>(nPassesCompleted.load(std::memory_order_relaxed)) * nPixels + std::min(nextPixel.load(std::memory_order_relaxed), nPixels);
+        reportProgress(startTime, nCompleted, static_cast<uint64_t>(nMaxPasses) * nPixels, "pixel samples");
+    }
+
+    rendered.get();
+    statistics.nRaysTraced += nRaysTraced;
+    // adaptive sampling ends renders short of the maximum, only a cancelled one is incomplete
+    uint64_t nSamples = std::accumulate(sampleCounts.begin(), sampleCounts.end(), uint64_t(0));
+    reportProgress(startTime, nSamples, isCancelled() ? static_cast<uint64_t>(nMaxPasses) * nPixels : nSamples, "pixel samples");
+}
+
+void Tracer::reportProgress(std::chrono::steady_clock::time_point startTime, uint64_t nCompleted, uint64_t nTotal, std::string_view unit) const
+{
+    RenderProgress progress{nCompleted, nTotal, std::chrono::steady_clock::now() - startTime};
+    if (nCompleted > 0)
+        progress.estimatedRemaining = static_cast<double>(nTotal - std::min(nCompleted, nTotal)) / static_cast<double>(nCompleted) * progress.elapsed;
+
+    if (job)
+    {
+        std::lock_guard lock(job->progressMutex);
+        job->progress = progress;
+    }
+    if (config.onProgress)
+        config.onProgress(progress);
+    // the summary printed at the end follows the last report
+    if (config.logProgress && nCompleted < nTotal)
+        printProgress(progress, unit);
+}
+
+uint32_t Tracer::getMaxSamplesPerPixel() const
+{
+    return config.adaptiveSampling ?
+        std::max(config.nMaxSamplesPerPixel, config.nSamplesPerPixel) :
+        config.nSamplesPerPixel;
+}
+
+// nSamplesPerPixel is the minimum number of samples taken before the estimate is trusted
+uint32_t Tracer::getMinSamplesPerPixel() const
+{
+    return config.adaptiveSampling ?
+        std::min(std::max(config.nSamplesPerPixel, 2u), getMaxSamplesPerPixel()) :
+        config.nSamplesPerPixel;
+}
+
+bool Tracer::needsSamples(uint64_t pixel) const
+{
+    uint32_t nSamples = sampleCounts[pixel];
+    if (nSamples >= getMaxSamplesPerPixel())
+        return false;
+
+    if (nSamples < getMinSamplesPerPixel())
+        return true;
+
+    float mean = luminanceMoments[pixel].x;
+    float m2 = luminanceMoments[pixel].y;
+    float variance = m2 / static_cast<float>(nSamples - 1);
+    float standardError = glm::sqrt(variance / static_cast<float>(nSamples));
+    return standardError > config.adaptiveTargetError * (mean + 1e-3f);
+}
+
+void Tracer::accumulateSample(uint64_t pixel, const glm::vec3& color, const SampleAovs& aovs)
+{
+    accumBuffer[pixel] += color;
+    aovBuffer[pixel].albedo += aovs.albedo;
+    aovBuffer[pixel].normal += aovs.normal;
+    aovBuffer[pixel].emission += aovs.emission;
+    aovBuffer[pixel].depth += aovs.depth;
+    uint32_t nSamples = ++sampleCounts[pixel];
+
+    // running mean and variance of the luminance (welford)
+    glm::vec2& moments = luminanceMoments[pixel];
+    float l = luminance(color);
+    float delta = l - moments.x;
+    moments.x += delta / static_cast<float>(nSamples);
+    moments.y += delta * (l - moments.x);
+}
 
-        if (i > config.nMinBounces)
+void Tracer::resolveFramebuffer(const glm::u32vec2& dim)
+{
+    framebuffer.SetSize(dim.x, dim.y);
+    std::span<float> beauty = framebuffer.AddLayer(beautyLayerName, 3);
+    std::span<float> albedo = framebuffer.AddLayer(albedoLayerName, 3);
+    std::span<float> normal = framebuffer.AddLayer(normalLayerName, 3);
+    std::span<float> emission = framebuffer.AddLayer(emissionLayerName, 3);
+    std::span<float> depth = framebuffer.AddLayer(depthLayerName, 1);
+    std::span<float> sampleCount = framebuffer.AddLayer(sampleCountLayerName, 1);
+    for (uint64_t p = 0; p < accumBuffer.size(); p++)
+    {
+        sampleCount[p] = static_cast<float>(sampleCounts[p]);
+        if (sampleCounts[p] == 0)
+            continue;
+        float weight = 1.0f / static_cast<float>(sampleCounts[p]);
+        glm::vec3 meanNormal = aovBuffer[p].normal * weight;
+        for (uint32_t k = 0; k < 3; k++)
         {
-            // russian roulette
-            float p = max(throughput.r, max(throughput.g, throughput.b));
-            if (rng.Uniform() > p)
-                break;
-            
-            throughput *= 1.0f / p;
+            beauty[p * 3 + k] = accumBuffer[p][k] * weight;
+            albedo[p * 3 + k] = aovBuffer[p].albedo[k] * weight;
+            normal[p * 3 + k] = meanNormal[k];
+            emission[p * 3 + k] = aovBuffer[p].emission[k] * weight;
         }
-        
-        vec3 biasedP = point;
-        if (mediumChanged)
-            biasedP -= normal * config.bias;
-        else
-            biasedP += normal * config.bias;
-        orig = biasedP;
-        dir = sample;
+        depth[p] = aovBuffer[p].depth * weight;
     }
-    return color;
+
+    if (!config.denoise)
+        return;
+
+    uint64_t nPixels = accumBuffer.size();
+    std::vector<glm::vec3> colors(nPixels), albedos(nPixels), normals(nPixels), emissions(nPixels), denoisedColors(nPixels);
+    std::vector<float> variance(nPixels);
+    for (uint64_t p = 0; p < nPixels; p++)
+    {
+        // lights seen directly are noise free, they are left out of the filter so that they do not bleed into their surroundings
+        emissions[p] = glm::vec3(emission[p * 3], emission[p * 3 + 1], emission[p * 3 + 2]);
+        colors[p] = glm::vec3(beauty[p * 3], beauty[p * 3 + 1], beauty[p * 3 + 2]) - emissions[p];
+        albedos[p] = glm::vec3(albedo[p * 3], albedo[p * 3 + 1], albedo[p * 3 + 2]);
+        normals[p] = glm::vec3(normal[p * 3], normal[p * 3 + 1], normal[p * 3 + 2]);
+
+        // variance of the pixel's mean, pixels with a single sample are trusted as little as their own luminance
+        uint32_t nSamples = sampleCounts[p];
+        float l = luminanceMoments[p].x;
+        variance[p] = nSamples >= 2 ?
+            luminanceMoments[p].y / static_cast<float>(nSamples - 1) / static_cast<float>(nSamples) :
+            l * l;
+    }
+
+    DenoiserSettings settings{};
+    settings.nIterations = config.nDenoiseIterations;
+    settings.nThreads = config.nThreads;
+    settings.colorSigma = config.denoiseColorSigma;
+    denoise(dim, colors, variance, albedos, normals, settings, denoisedColors);
+
+    std::span<float> denoised = framebuffer.AddLayer(denoisedLayerName, 3);
+    for (uint64_t p = 0; p < nPixels; p++)
+        for (uint32_t k = 0; k < 3; k++)
+            denoised[p * 3 + k] = denoisedColors[p][k] + emissions[p][k];
 }
 
-void Tracer::Render(Canvas& canvas, const Scene& scene)
+namespace
 {
-    using namespace glm;
-    
-    canvas.SetBuffer(config.width, config.height, 3u);
 
-    Camera camera = scene.GetCamera();
+    constexpr uint32_t checkpointVersion = 1u;
+    constexpr uint32_t partialVersion = 1u;
+    constexpr uint32_t distributedVersion = 1u;
 
-    std::vector<std::unique_ptr<EmissionProfile>> emissionProfiles;
-    for (const Object* obj : scene.GetObjects())
+    // sent by the coordinator instead of a tile index once every tile is finished
+    constexpr uint32_t noMoreTiles = ~0u;
+
+    // bytes per pixel written by Tracer::writePixelState
+    constexpr size_t pixelStateSize = sizeof(glm::vec3) + sizeof(uint32_t) + sizeof(glm::vec2) + sizeof(SampleAovs);
+
+    // everything that changes the value of a given sample of a pixel, the image size comes first
+    std::vector<uint32_t> getSampleSettings(const TracerConfiguration& config)
     {
-        obj->GetEmissionProfiles(std::back_inserter(emissionProfiles));
+        return {
+            config.width, config.height, static_cast<uint32_t>(config.samplerType), config.seed,
+            config.nMinBounces, config.nMaxBounces, std::bit_cast<uint32_t>(config.bias),
+            config.nextEventEstimation, static_cast<uint32_t>(config.lightSelection)};
     }
 
-    u32vec2 dim(canvas.GetWidth(), canvas.GetHeight());
-    uint64_t nPixels = dim.x * dim.y;
+    // a checkpoint is only resumed, and a distributed worker only accepted, with the same sample settings, tiles and samples per pixel
+    std::vector<uint32_t> getCheckpointSettings(const TracerConfiguration& config)
+    {
+        std::vector<uint32_t> settings = getSampleSettings(config);
+        settings.insert(settings.end(), {
+            config.tileSize, static_cast<uint32_t>(config.tileOrder),
+            config.nSamplesPerPixel, config.adaptiveSampling, config.nMaxSamplesPerPixel, std::bit_cast<uint32_t>(config.adaptiveTargetError),
+            config.firstSample, config.cropOrigin.x, config.cropOrigin.y, config.cropSize.x, config.cropSize.y});
+        return settings;
+    }
 
-    std::vector<std::thread> threadPool(config.nThreads);
-    std::atomic_uint64_t pixel;
+    // the part of an image and the sample indices [firstSample, firstSample + nSamples) a partial render covers
+    struct PartialHeader
+    {
+        std::vector<uint32_t> sampleSettings;
+        glm::u32vec2 cropOrigin{};
+        glm::u32vec2 cropSize{};
+        uint32_t firstSample = 0u;
+        uint32_t nSamples = 0u;
+    };
 
-    auto callable = [&, this]
+    template <typename T>
+    void writeBinaryValue(std::ostream& stream, const T& value)
     {
-        while (true)
+        stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void readBinaryValue(std::istream& stream, T& value)
+    {
+        stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+}
+
+void Tracer::writePixelState(std::ostream& stream, uint64_t pixel) const
+{
+    writeBinaryValue(stream, accumBuffer[pixel]);
+    writeBinaryValue(stream, sampleCounts[pixel]);
+    writeBinaryValue(stream, luminanceMoments[pixel]);
+    writeBinaryValue(stream, aovBuffer[pixel]);
+}
+
+void Tracer::readPixelState(std::istream& stream, uint64_t pixel)
+{
+    readBinaryValue(stream, accumBuffer[pixel]);
+    readBinaryValue(stream, sampleCounts[pixel]);
+    readBinaryValue(stream, luminanceMoments[pixel]);
+    readBinaryValue(stream, aovBuffer[pixel]);
+}
+
+// "TRCP", the version and the settings, then every finished tile as its index followed by the state of its pixels;
+// written next to the previous checkpoint and renamed over it, so a crash while saving keeps the previous one
+void Tracer::saveCheckpoint(std::span<const Tile> tiles, std::span<const uint32_t> finishedTiles) const
+{
+    std::filesystem::path path(config.checkpointPath);
+    std::filesystem::path tempPath(path);
+    tempPath += ".tmp";
+    {
+        std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+        if (!stream)
+            throw std::runtime_error(fmt::format("cannot open {} for writing", tempPath.string()));
+
+        stream.write("TRCP", 4);
+        writeBinaryValue(stream, checkpointVersion);
+        for (uint32_t setting : getCheckpointSettings(config))
+            writeBinaryValue(stream, setting);
+        writeBinaryValue(stream, static_cast<uint32_t>(tiles.size()));
+        writeBinaryValue(stream, static_cast<uint32_t>(finishedTiles.size()));
+        for (uint32_t tileIndex : finishedTiles)
         {
-            uint64_t p = pixel.fetch_add(1, std::memory_order_relaxed);
+            const Tile& tile = tiles[tileIndex];
+            writeBinaryValue(stream, tileIndex);
+            for (uint32_t j = tile.origin.y; j < tile.origin.y + tile.size.y; j++)
+                for (uint32_t i = tile.origin.x; i < tile.origin.x + tile.size.x; i++)
+                    writePixelState(stream, static_cast<uint64_t>(j) * config.width + i);
+        }
+        if (!stream.flush())
+            throw std::runtime_error(fmt::format("failed to write {}", tempPath.string()));
+    }
+    std::filesystem::rename(tempPath, path);
+}
 
-            float aspect = static_cast<float>(dim.x) / static_cast<float>(dim.y);
+std::vector<uint32_t> Tracer::loadCheckpoint(std::span<const Tile> tiles)
+{
+    std::ifstream stream(std::filesystem::path(config.checkpointPath), std::ios::binary);
+    if (!stream)
+    {
+        fmt::println("No checkpoint at {}, starting from scratch", config.checkpointPath);
+        return {};
+    }
 
-            if (p >= nPixels)
-                return;
+    char magic[4]{};
+    uint32_t version = 0;
+    stream.read(magic, 4);
+    readBinaryValue(stream, version);
+    if (!stream || std::string_view(magic, 4) != "TRCP" || version != checkpointVersion)
+        throw std::runtime_error(fmt::format("{} is not a checkpoint", config.checkpointPath));
+    for (uint32_t setting : getCheckpointSettings(config))
+    {
+        uint32_t savedSetting = 0;
+        readBinaryValue(stream, savedSetting);
+        if (savedSetting != setting)
+            throw std::runtime_error(fmt::format("checkpoint {} was written with different settings", config.checkpointPath));
+    }
+    uint32_t nTiles = 0, nFinishedTiles = 0;
+    readBinaryValue(stream, nTiles);
+    readBinaryValue(stream, nFinishedTiles);
+    if (nTiles != tiles.size() || nFinishedTiles > nTiles)
+        throw std::runtime_error(fmt::format("checkpoint {} does not match the tiles of the image", config.checkpointPath));
+
+    std::vector<uint32_t> finishedTiles(nFinishedTiles);
+    for (uint32_t& tileIndex : finishedTiles)
+    {
+        readBinaryValue(stream, tileIndex);
+        if (!stream || tileIndex >= tiles.size())
+            throw std::runtime_error(fmt::format("checkpoint {} is corrupt", config.checkpointPath));
+        const Tile& tile = tiles[tileIndex];
+        for (uint32_t j = tile.origin.y; j < tile.origin.y + tile.size.y; j++)
+            for (uint32_t i = tile.origin.x; i < tile.origin.x + tile.size.x; i++)
+                readPixelState(stream, static_cast<uint64_t>(j) * config.width + i);
+    }
+    if (!stream)
+        throw std::runtime_error(fmt::format("checkpoint {} is truncated", config.checkpointPath));
+    fmt::println("Resuming from {} with {} of {} tiles done", config.checkpointPath, nFinishedTiles, nTiles);
+    return finishedTiles;
+}
+
+// "TRPR", the version, the sample settings, crop window and sample range, then the state of every pixel in the crop window
+void Tracer::SavePartial(std::string_view path) const
+{
+    if (sampleCounts.size() != static_cast<size_t>(config.width) * config.height)
+        throw std::runtime_error("nothing rendered to save, out of core renders have no partial");
+    glm::u32vec2 cropSize = getCropSize();
 
-            uint32_t i = p % dim.x;
-            uint32_t j = static_cast<uint32_t>(p / dim.x);
-            vec2 ndc = (vec2(i, j) / vec2(dim) - vec2(0.5f)) * 2.0f;
-                ndc.y = -ndc.y; // flip the vertical axis;
+    std::ofstream stream(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!stream)
+        throw std::runtime_error(fmt::format("cannot open {} for writing", path));
+    stream.write("TRPR", 4);
+    writeBinaryValue(stream, partialVersion);
+    for (uint32_t setting : getSampleSettings(config))
+        writeBinaryValue(stream, setting);
+    writeBinaryValue(stream, config.cropOrigin);
+    writeBinaryValue(stream, cropSize);
+    writeBinaryValue(stream, config.firstSample);
+    writeBinaryValue(stream, getMaxSamplesPerPixel());
+    for (uint32_t j = config.cropOrigin.y; j < config.cropOrigin.y + cropSize.y; j++)
+        for (uint32_t i = config.cropOrigin.x; i < config.cropOrigin.x + cropSize.x; i++)
+            writePixelState(stream, static_cast<uint64_t>(j) * config.width + i);
+    if (!stream.flush())
+        throw std::runtime_error(fmt::format("failed to write {}", path));
+}
+
+void Tracer::MergePartials(Canvas& canvas, std::span<const std::string> paths)
+{
+    using namespace glm;
 
-            // viewport space projected on the view frustum plane
-            // vec2 onFrustumPlane2D = aspect > 1.0f ?
-            //     vec2(ndc.x * aspect, ndc.y         ) :
-            //     vec2(ndc.x         , ndc.y / aspect);
-            vec2 onFrustumPlane2D = aspect > 1.0f ?
-                vec2(ndc.x         , ndc.y / aspect) :
-                vec2(ndc.x * aspect, ndc.y         );
+    if (paths.empty())
+        throw std::runtime_error("no partial renders to merge");
 
-            vec3 camLookVec = camera.dir;
-            vec3 toFustumPlane = calcToFrustumPlane(onFrustumPlane2D, camLookVec, camera.lens.fov);
-            
-            vec3 color(0.0f);
-            vec3 accumColor(0.0f);
+    std::vector<std::ifstream> streams;
+    std::vector<PartialHeader> headers;
+    size_t nSampleSettings = getSampleSettings(config).size();
+    for (const std::string& path : paths)
+    {
+        std::ifstream& stream = streams.emplace_back(std::filesystem::path(path), std::ios::binary);
+        char magic[4]{};
+        uint32_t version = 0;
+        stream.read(magic, 4);
+        readBinaryValue(stream, version);
+        if (!stream || std::string_view(magic, 4) != "TRPR" || version != partialVersion)
+            throw std::runtime_error(fmt::format("{} is not a partial render", path));
+        PartialHeader& header = headers.emplace_back();
+        header.sampleSettings.resize(nSampleSettings);
+        for (uint32_t& setting : header.sampleSettings)
+            readBinaryValue(stream, setting);
+        readBinaryValue(stream, header.cropOrigin);
+        readBinaryValue(stream, header.cropSize);
+        readBinaryValue(stream, header.firstSample);
+        readBinaryValue(stream, header.nSamples);
+        if (!stream)
+            throw std::runtime_error(fmt::format("{} is truncated", path));
+
+        if (header.sampleSettings != headers.front().sampleSettings)
+            throw std::runtime_error(fmt::format("{} was rendered with other settings than {}", path, paths.front()));
+        u32vec2 dim(header.sampleSettings[0], header.sampleSettings[1]);
+        if (any(greaterThan(header.cropOrigin + header.cropSize, dim)))
+            throw std::runtime_error(fmt::format("crop window of {} is outside of the image", path));
+        // the same sample of a pixel must not be counted twice
+        for (size_t k = 0; k + 1 < headers.size(); k++)
+        {
+            const PartialHeader& other = headers[k];
+            bool pixelsOverlap = all(lessThan(header.cropOrigin, other.cropOrigin + other.cropSize)) &&
+                all(lessThan(other.cropOrigin, header.cropOrigin + header.cropSize));
+            bool samplesOverlap = header.firstSample < other.firstSample + other.nSamples &&
+                other.firstSample < header.firstSample + header.nSamples;
+            if (pixelsOverlap && samplesOverlap)
+                throw std::runtime_error(fmt::format("{} and {} both hold samples of the same pixels", paths[k], path));
+        }
+    }
 
-            vec3 axis1, axis2;
-            createCoordSystemWithUpVec(camLookVec, axis1, axis2); // coord system of the defocus disk
-            vec3 focusPoint = toFustumPlane * camera.lens.focalPointDistance; // get the focus point on the focal plane by pushing the frustum plane out
+    config.width = headers.front().sampleSettings[0];
+    config.height = headers.front().sampleSettings[1];
+    u32vec2 dim(config.width, config.height);
+    uint64_t nPixels = static_cast<uint64_t>(dim.x) * dim.y;
+    accumBuffer.assign(nPixels, vec3(0.0f));
+    sampleCounts.assign(nPixels, 0u);
+    luminanceMoments.assign(nPixels, vec2(0.0f));
+    aovBuffer.assign(nPixels, SampleAovs{});
+    statistics = RenderStatistics{};
 
-            for (uint32_t _ = 0; _ < config.nSamplesPerPixel; _++)
+    for (size_t k = 0; k < paths.size(); k++)
+    {
+        const PartialHeader& header = headers[k];
+        for (uint32_t j = header.cropOrigin.y; j < header.cropOrigin.y + header.cropSize.y; j++)
+            for (uint32_t i = header.cropOrigin.x; i < header.cropOrigin.x + header.cropSize.x; i++)
             {
-                float r1 = rng.Uniform();
-                float r2 = rng.Uniform();
-                vec2 diskSample = samplePointOnDisk(r1, r2);
-                vec3 defocused = (diskSample.x * axis1 + diskSample.y * axis2) * camera.lens.defocusDiskRadius;
-                
-                vec3 rayColor = castRay(camera.pos + defocused, normalize(focusPoint - defocused), scene, config, rng, emissionProfiles);
-                if (!std::isnan(rayColor.x) &&
-                    !std::isnan(rayColor.y) &&
-                    !std::isnan(rayColor.z))
-                    accumColor += rayColor;
+                uint64_t p = static_cast<uint64_t>(j) * dim.x + i;
+                vec3 prevColor = accumBuffer[p];
+                uint32_t nPrevSamples = sampleCounts[p];
+                vec2 prevMoments = luminanceMoments[p];
+                SampleAovs prevAovs = aovBuffer[p];
+                readPixelState(streams[k], p);
+
+                accumBuffer[p] += prevColor;
+                aovBuffer[p].albedo += prevAovs.albedo;
+                aovBuffer[p].normal += prevAovs.normal;
+                aovBuffer[p].emission += prevAovs.emission;
+                aovBuffer[p].depth += prevAovs.depth;
+                // luminance mean and variance of the union of both sets of samples (chan et al.)
+                uint32_t nPartialSamples = sampleCounts[p];
+                sampleCounts[p] += nPrevSamples;
+                if (nPrevSamples > 0 && nPartialSamples > 0)
+                {
+                    float n = static_cast<float>(sampleCounts[p]);
+                    float delta = luminanceMoments[p].x - prevMoments.x;
+                    luminanceMoments[p] = vec2(
+                        prevMoments.x + delta * static_cast<float>(nPartialSamples) / n,
+                        prevMoments.y + luminanceMoments[p].y + delta * delta * static_cast<float>(nPrevSamples) * static_cast<float>(nPartialSamples) / n);
+                }
+                else if (nPrevSamples > 0)
+                    luminanceMoments[p] = prevMoments;
             }
+        if (!streams[k])
+            throw std::runtime_error(fmt::format("{} is truncated", paths[k]));
+    }
+
+    canvas.SetBuffer(config.width, config.height, 3u);
+    resolveFramebuffer(dim);
+    resolveCanvas(canvas);
+}
+
+// the protocol: a worker connection greets with "TRDW", the version and the checkpoint settings, the coordinator then sends
+// tile indices one at a time and the worker answers each with the index, the rays it traced and the state of the tile's pixels
+void Tracer::RenderAsCoordinator(Canvas& canvas, uint16_t port)
+{
+    using namespace glm;
+
+    canvas.SetBuffer(config.width, config.height, 3u);
+    u32vec2 dim(config.width, config.height);
+    uint64_t nPixels = static_cast<uint64_t>(dim.x) * dim.y;
+    accumBuffer.assign(nPixels, vec3(0.0f));
+    sampleCounts.assign(nPixels, 0u);
+    luminanceMoments.assign(nPixels, vec2(0.0f));
+    aovBuffer.assign(nPixels, SampleAovs{});
 
-            accumColor /= config.nSamplesPerPixel;
+    statistics = RenderStatistics{};
+    auto startTime = std::chrono::steady_clock::now();
 
-            color = accumColor;
+    std::vector<Tile> tiles = generateImageTiles();
+    statistics.tiles.assign(tiles.size(), TileStatistics{});
+    for (const std::shared_ptr<TileOutput>& output : config.tileOutputs)
+        output->Begin(dim.x, dim.y);
 
-            for (uint32_t k = 0; k < 3; k++)
-                canvas.Store(i, j, k, color[k]);
+    std::deque<uint32_t> pendingTiles(tiles.size());
+    std::iota(pendingTiles.begin(), pendingTiles.end(), 0u);
+    std::vector<uint8_t> isTileFinished(tiles.size(), 0u);
+    std::vector<std::chrono::steady_clock::time_point> handOutTimes(tiles.size()); // of the latest hand out
+    uint64_t nTilesFinished = 0;
+
+    struct Connection
+    {
+        Socket socket;
+        uint32_t id;
+        bool isGreeted = false;
+        std::optional<uint32_t> tile;
+        std::vector<uint8_t> message; // sized to the message expected next
+        size_t nReceived = 0;
+        bool isClosed = false;
+    };
+    std::vector<Connection> connections;
+    uint32_t nConnections = 0;
+
+    std::vector<uint32_t> settings = getCheckpointSettings(config);
+    size_t greetingSize = 4 + sizeof(uint32_t) + settings.size() * sizeof(uint32_t);
+    Socket listener = Socket::Listen(port);
+    listener.SetNonBlocking();
+    fmt::println("Waiting for workers on port {}", port);
+
+    // a tile nobody has, otherwise the one handed out longest ago if that was more than stragglerTimeout ago
+    auto getNextTile = [&]() -> std::optional<uint32_t>
+    {
+        while (!pendingTiles.empty())
+        {
+            uint32_t tileIndex = pendingTiles.front();
+            pendingTiles.pop_front();
+            if (!isTileFinished[tileIndex])
+                return tileIndex;
+        }
+        auto now = std::chrono::steady_clock::now();
+        std::optional<uint32_t> straggler;
+        for (const Connection& connection : connections)
+        {
+            if (!connection.tile || isTileFinished[*connection.tile] || now - handOutTimes[*connection.tile] < config.stragglerTimeout)
+                continue;
+            if (!straggler || handOutTimes[*connection.tile] < handOutTimes[*straggler])
+                straggler = connection.tile;
+        }
+        return straggler;
+    };
+
+    auto closeConnection = [&](Connection& connection)
+    {
+        // the tile goes to the next idle worker
+        if (connection.tile && !isTileFinished[*connection.tile])
+            pendingTiles.push_front(*connection.tile);
+        connection.isClosed = true;
+    };
+
+    auto handleMessage = [&](Connection& connection)
+    {
+        std::ispanstream stream(std::span(reinterpret_cast<const char*>(connection.message.data()), connection.message.size()));
+        if (!connection.isGreeted)
+        {
+            char magic[4]{};
+            uint32_t version = 0;
+            std::vector<uint32_t> workerSettings(settings.size());
+            stream.read(magic, 4);
+            readBinaryValue(stream, version);
+            for (uint32_t& setting : workerSettings)
+                readBinaryValue(stream, setting);
+            if (std::string_view(magic, 4) != "TRDW" || version != distributedVersion || workerSettings != settings)
+            {
+                fmt::println("Turned down worker {}, its configuration differs", connection.id);
+                closeConnection(connection);
+                return;
+            }
+            connection.isGreeted = true;
+            return;
+        }
+
+        uint32_t tileIndex = 0;
+        uint64_t nRaysTraced = 0;
+        readBinaryValue(stream, tileIndex);
+        readBinaryValue(stream, nRaysTraced);
+        if (tileIndex != connection.tile)
+        {
+            closeConnection(connection);
+            return;
         }
+        connection.tile.reset();
+        statistics.nRaysTraced += nRaysTraced;
+        // a straggler's copy that comes in second is dropped
+        if (isTileFinished[tileIndex])
+            return;
+
+        const Tile& tile = tiles[tileIndex];
+        uint64_t nTileSamples = 0;
+        for (uint32_t j = tile.origin.y; j < tile.origin.y + tile.size.y; j++)
+            for (uint32_t i = tile.origin.x; i < tile.origin.x + tile.size.x; i++)
+            {
+                uint64_t p = static_cast<uint64_t>(j) * dim.x + i;
+                readPixelState(stream, p);
+                nTileSamples += sampleCounts[p];
+            }
+        isTileFinished[tileIndex] = 1u;
+        nTilesFinished++;
+        statistics.tiles[tileIndex] = TileStatistics{tile.origin, tile.size, connection.id, nTileSamples, nRaysTraced,
+            std::chrono::steady_clock::now() - handOutTimes[tileIndex]};
+        streamTile(tile.origin, tile.size, static_cast<uint64_t>(tile.origin.y) * dim.x + tile.origin.x, dim.x);
     };
 
-    for (auto& t : threadPool)
-        t = std::thread(callable);
+    auto lastProgressTime = std::chrono::steady_clock::now();
+    auto lastWorkerTime = std::chrono::steady_clock::now(); // a worker connected or sent something
+    while (nTilesFinished < tiles.size())
+    {
+        // a cancelled render leaves the remaining tiles black
+        if (isCancelled())
+            break;
+        if (std::chrono::steady_clock::now() - lastWorkerTime > config.workerTimeout)
+        {
+            if (connections.empty())
+                throw std::runtime_error(fmt::format("no worker connected on port {} for {} ms", port, config.workerTimeout.count()));
+            throw std::runtime_error(fmt::format("no worker on port {} sent anything for {} ms", port, config.workerTimeout.count()));
+        }
+
+        for (Socket socket = listener.Accept(); socket.IsValid(); socket = listener.Accept())
+        {
+            lastWorkerTime = std::chrono::steady_clock::now();
+            socket.SetNonBlocking();
+            Connection& connection = connections.emplace_back(Connection{std::move(socket), nConnections++});
+            connection.message.resize(greetingSize);
+        }
+
+        for (Connection& connection : connections)
+        {
+            if (!connection.isGreeted || connection.tile || connection.isClosed)
+                continue;
+            std::optional<uint32_t> tileIndex = getNextTile();
+            if (!tileIndex)
+                break;
+            if (!connection.socket.SendAll(std::span(reinterpret_cast<const uint8_t*>(&*tileIndex), sizeof(uint32_t))))
+            {
+                pendingTiles.push_front(*tileIndex);
+                closeConnection(connection);
+                continue;
+            }
+            connection.tile = tileIndex;
+            handOutTimes[*tileIndex] = std::chrono::steady_clock::now();
+            const Tile& tile = tiles[*tileIndex];
+            connection.message.resize(sizeof(uint32_t) + sizeof(uint64_t) + static_cast<size_t>(tile.size.x) * tile.size.y * pixelStateSize);
+            connection.nReceived = 0;
+        }
+
+        std::vector<const Socket*> sockets{&listener};
+        for (const Connection& connection : connections)
+            sockets.push_back(&connection.socket);
+        std::vector<uint8_t> isReadable(sockets.size(), 0u);
+        Socket::WaitReadable(sockets, 100, isReadable);
+        for (size_t k = 0; k < connections.size(); k++)
+        {
+            Connection& connection = connections[k];
+            if (!isReadable[k + 1] || connection.isClosed)
+                continue;
+            // only greetings and the results of handed out tiles are expected
+            bool isExpected = !connection.isGreeted || connection.tile;
+            int64_t n = isExpected ?
+                connection.socket.ReceiveSome(std::span(connection.message).subspan(connection.nReceived)) :
+                -1;
+            if (n < 0)
+            {
+                closeConnection(connection);
+                continue;
+            }
+            if (n > 0)
+                lastWorkerTime = std::chrono::steady_clock::now();
+            connection.nReceived += static_cast<size_t>(n);
+            if (connection.nReceived == connection.message.size())
+            {
+                connection.nReceived = 0;
+                handleMessage(connection);
+            }
+        }
+        std::erase_if(connections, [](const Connection& connection) { return connection.isClosed; });
+
+        if (std::chrono::steady_clock::now() - lastProgressTime >= std::chrono::seconds(1))
+        {
+            reportProgress(startTime, nTilesFinished, tiles.size(), "tiles");
+            lastProgressTime = std::chrono::steady_clock::now();
+        }
+    }
+    // workers still connected wait for a tile or are busy with a straggler's copy
+    for (Connection& connection : connections)
+        connection.socket.SendAll(std::span(reinterpret_cast<const uint8_t*>(&noMoreTiles), sizeof(noMoreTiles)));
+    connections.clear();
+    reportProgress(startTime, nTilesFinished, tiles.size(), "tiles");
+
+    for (const std::shared_ptr<TileOutput>& output : config.tileOutputs)
+        output->End();
+    resolveFramebuffer(dim);
+    resolveCanvas(canvas);
+
+    statistics.duration = std::chrono::steady_clock::now() - startTime;
+    if (config.logProgress)
+        fmt::println("Traced {} rays on {} worker connections in {:.2f}s",
+        statistics.nRaysTraced,
+        nConnections,
+        statistics.duration.count());
+}
+
+void Tracer::RenderAsWorker(const Scene& scene, std::string_view host, uint16_t port)
+{
+    using namespace glm;
 
+    CameraRayGenerator cameraRays(scene.GetCamera(), u32vec2(config.width, config.height));
+    std::vector<Tile> tiles = generateImageTiles();
+    // every connection reuses its own stretch of the buffers for each of its tiles, as out of core
+    uint64_t nTilePixels = static_cast<uint64_t>(config.tileSize) * config.tileSize;
+    uint64_t nBufferPixels = config.nThreads * nTilePixels;
+    accumBuffer.assign(nBufferPixels, vec3(0.0f));
+    sampleCounts.assign(nBufferPixels, 0u);
+    luminanceMoments.assign(nBufferPixels, vec2(0.0f));
+    aovBuffer.assign(nBufferPixels, SampleAovs{});
+
+    statistics = RenderStatistics{};
     auto startTime = std::chrono::steady_clock::now();
 
-    using namespace std::chrono_literals;
-    std::this_thread::sleep_for(1s);
-
-    uint64_t nPixelsCompleted;
-    while ((nPixelsCompleted = pixel.load(std::memory_order_relaxed)) < nPixels)
-    {
-        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - startTime;
-        auto timeRemaining = static_cast<double>(nPixels - nPixelsCompleted) / static_cast<double>(nPixelsCompleted) * duration;
-        std::chrono::seconds remainingDuration = std::chrono::duration_cast<std::chrono::seconds>(timeRemaining);
-        int64_t remainingSeconds = remainingDuration.count();
-        int64_t remainingMinutes = remainingSeconds / 60;
-        int64_t remainingHours = remainingMinutes / 60;
-        uint64_t secondsDisp = remainingSeconds % 60;
-        uint64_t minutesDisp = remainingMinutes % 60;
-        uint64_t hoursDisp = remainingHours;
-
-        auto time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-        std::tm local{};
-        localtime_s(&local, &time);
-        std::chrono::hh_mm_ss formatter(std::chrono::hours(local.tm_hour) + std::chrono::minutes(local.tm_min) + std::chrono::seconds(local.tm_sec));
-        fmt::println("[{:%T}]: {} out of {} pixels completed ({:.2f}%); Estimated time remaining: {:02}:{:02}:{:02}",
-            fmt::localtime(time),
-            nPixelsCompleted,
-            nPixels,
-            static_cast<double>(nPixelsCompleted) / static_cast<double>(nPixels) * 100.0,
-            hoursDisp, minutesDisp, secondsDisp);
-
-        std::this_thread::sleep_for(1s);
-    }
-
-    for (auto& t : threadPool)
-        if (t.joinable())
-            t.join();
+    std::vector<uint8_t> greeting;
+    {
+        std::vector<uint32_t> settings = getCheckpointSettings(config);
+        greeting.resize(4 + sizeof(uint32_t) + settings.size() * sizeof(uint32_t));
+        std::ospanstream stream(std::span(reinterpret_cast<char*>(greeting.data()), greeting.size()));
+        stream.write("TRDW", 4);
+        writeBinaryValue(stream, distributedVersion);
+        for (uint32_t setting : settings)
+            writeBinaryValue(stream, setting);
+    }
+
+    std::atomic_uint64_t nTilesRendered{};
+    std::atomic_uint64_t nRaysTraced{};
+    ThreadPool::GetShared().Run(config.nThreads, [&, this](uint32_t thread)
+    {
+        takeThreadRayCount();
+        Socket socket = Socket::Connect(host, port);
+        if (!socket.SendAll(greeting))
+            throw std::runtime_error(fmt::format("lost the connection to {}:{}", host, port));
+
+        std::array<std::unique_ptr<Sampler>, rayPacketSize> samplers;
+        for (std::unique_ptr<Sampler>& sampler : samplers)
+            sampler = createSampler(config);
+        uint64_t firstBuffer = thread * nTilePixels;
+        std::vector<uint8_t> result;
+        bool isAccepted = false;
+        while (true)
+        {
+            uint32_t tileIndex = 0;
+            if (!socket.ReceiveAll(std::span(reinterpret_cast<uint8_t*>(&tileIndex), sizeof(tileIndex))))
+            {
+                // the coordinator closes the connection right away when it turns a worker down
+                if (!isAccepted)
+                    throw std::runtime_error(fmt::format("the coordinator at {}:{} turned the worker down, the configurations differ", host, port));
+                break;
+            }
+            isAccepted = true;
+            if (tileIndex == noMoreTiles)
+                break;
+            if (tileIndex >= tiles.size())
+                throw std::runtime_error(fmt::format("the coordinator sent tile {} of {}", tileIndex, tiles.size()));
+
+            const Tile& tile = tiles[tileIndex];
+            uint64_t nPixels = static_cast<uint64_t>(tile.size.x) * tile.size.y;
+            clearPixels(firstBuffer, nTilePixels);
+            renderTile(tile, firstBuffer, tile.size.x, cameraRays, scene, samplers);
+            uint64_t nTileRays = takeThreadRayCount();
+
+            result.resize(sizeof(uint32_t) + sizeof(uint64_t) + nPixels * pixelStateSize);
+            std::ospanstream stream(std::span(reinterpret_cast<char*>(result.data()), result.size()));
+            writeBinaryValue(stream, tileIndex);
+            writeBinaryValue(stream, nTileRays);
+            for (uint64_t p = firstBuffer; p < firstBuffer + nPixels; p++)
+                writePixelState(stream, p);
+            // a coordinator that finished without this straggler's copy has hung up
+            if (!socket.SendAll(result))
+                break;
+            nTilesRendered.fetch_add(1, std::memory_order_relaxed);
+            nRaysTraced.fetch_add(nTileRays, std::memory_order_relaxed);
+        }
+    });
+
+    statistics.nRaysTraced = nRaysTraced.load();
+    statistics.duration = std::chrono::steady_clock::now() - startTime;
+    fmt::println("Rendered {} tiles for {}:{} in {:.2f}s ({:.2f} Mrays/s)",
+        nTilesRendered.load(),
+        host,
+        port,
+        statistics.duration.count(),
+        static_cast<double>(statistics.nRaysTraced) / statistics.duration.count() * 1e-6);
+}
+
+void Tracer::GetSampleCountMap(Canvas& canvas) const
+{
+    canvas.SetBuffer(config.width, config.height, 3u);
+    if (sampleCounts.size() != static_cast<size_t>(config.width) * config.height)
+        return;
+
+    uint32_t nMaxSamples = std::ranges::max(sampleCounts);
+    for (uint32_t j = 0; j < config.height; j++)
+        for (uint32_t i = 0; i < config.width; i++)
+        {
+            float v = static_cast<float>(sampleCounts[static_cast<size_t>(j) * config.width + i]) / static_cast<float>(std::max(nMaxSamples, 1u));
+            for (uint32_t k = 0; k < 3; k++)
+                canvas.Store(i, j, k, v);
+        }
 }
 
 }
\ No newline at end of file
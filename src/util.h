@@ -8,7 +8,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
 
-#include <tracer/rng.h>
+#include <tracer/sampler.h>
 
 namespace tracer
 {
@@ -24,6 +24,11 @@ inline void createCoordSystemWithUpVec(const glm::vec3& up, glm::vec3& axis1, gl
     axis1 = cross(up, axis2);
 }
 
+inline float luminance(const glm::vec3& color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
 inline glm::vec2 samplePointOnDisk(float r1, float r2)
 {
     using namespace glm;
@@ -201,24 +206,33 @@ inline std::optional<float> intersectTriangleCounterClockwiseMT(const glm::vec3&
     return dot(ac, qVec) * invDet;
 }
 
-inline void sampleBarycentricUniform(RNG& rng, glm::vec2& coords)
+// mis weight of a sample drawn with pdfA against another strategy with pdfB (veach's power heuristic, beta = 2)
+inline float powerHeuristic(float pdfA, float pdfB)
+{
+    float a = pdfA * pdfA;
+    float b = pdfB * pdfB;
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+inline void sampleBarycentricUniform(Sampler& sampler, glm::vec2& coords)
 {
     using namespace glm;
 
-    float r1 = rng.Uniform();
-    float r2 = rng.Uniform();
+    vec2 u = sampler.Get2D();
+    float r1 = u.x;
+    float r2 = u.y;
 
     float sqrtR1 = sqrt(r1);
     coords.x = 1.0f - sqrtR1;
     coords.y = r2 * sqrtR1;
 }
 
-inline void sampleTriangleUniform(RNG& rng, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, glm::vec3& sample, float& pdf)
+inline void sampleTriangleUniform(Sampler& sampler, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, glm::vec3& sample, float& pdf)
 {
     using namespace glm;
 
     vec2 coords;
-    sampleBarycentricUniform(rng, coords);
+    sampleBarycentricUniform(sampler, coords);
     
     vec3 ab = p1 - p0;
     vec3 ac = p2 - p0;
@@ -237,4 +251,12 @@ inline std::string readTextFile(const std::string& path)
     return oss.str();
 }
 
+inline std::string readBinaryFile(const std::string& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    std::ostringstream oss;
+    oss << stream.rdbuf();
+    return oss.str();
+}
+
 }
\ No newline at end of file
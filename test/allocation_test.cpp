@@ -0,0 +1,164 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <thread>
+#include <fmt/core.h>
+
+#include <tracer/canvas.h>
+#include <tracer/scene.h>
+#include <tracer/tracer.h>
+
+// every allocation of the process goes through these, the test only looks at the ones made while a render runs; those
+// of the pool's workers, which trace every sample, are counted apart from those of the thread that set up the render
+static std::atomic_uint64_t nAllocations{};
+static std::atomic_uint64_t nWorkerAllocations{};
+static std::thread::id mainThread = std::this_thread::get_id();
+
+static void countAllocation()
+{
+    nAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (std::this_thread::get_id() != mainThread)
+        nWorkerAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+    countAllocation();
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    countAllocation();
+    std::size_t align = static_cast<std::size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+// a closed box lit by a quad under its ceiling, with diffuse walls and a coated block, so paths bounce many times
+// and take every kind of shading the default mode does: emission, next event estimation and material sampling
+static const char* sceneJson = R"({
+    "camera": {
+        "position": [0, 0, -0.9],
+        "direction": {"type": "look-at", "content": {"value": [0, 0, 0]}},
+        "lens": {"type": "raw-params", "content": {"fov": 1.2, "defocus-disk-radius": 0.0, "focal-point-distance": 1.0}}
+    },
+    "objects": [{"transformations": [], "object": {"type": "mesh", "content": {"type": "inline", "content": {
+        "textures": [
+            {"type": "gradient", "content": {"top-left": [0.7, 0.7, 0.7], "top-right": [0.7, 0.7, 0.7], "bottom-right": [0.7, 0.7, 0.7], "bottom-left": [0.7, 0.7, 0.7]}},
+            {"type": "gradient", "content": {"top-left": [1, 1, 1], "top-right": [1, 1, 1], "bottom-right": [1, 1, 1], "bottom-left": [1, 1, 1]}},
+            {"type": "gradient", "content": {"top-left": [0.2, 0.2, 0.2], "top-right": [0.2, 0.2, 0.2], "bottom-right": [0.2, 0.2, 0.2], "bottom-left": [0.2, 0.2, 0.2]}}
+        ],
+        "vertices": [
+            {"pos": [-1, -1, -1], "tex": [0, 0]}, {"pos": [1, -1, -1], "tex": [1, 0]}, {"pos": [1, -1, 1], "tex": [1, 1]}, {"pos": [-1, -1, 1], "tex": [0, 1]},
+            {"pos": [-1, 1, -1], "tex": [0, 0]}, {"pos": [1, 1, -1], "tex": [1, 0]}, {"pos": [1, 1, 1], "tex": [1, 1]}, {"pos": [-1, 1, 1], "tex": [0, 1]},
+            {"pos": [-0.3, 0.99, -0.3], "tex": [0, 0]}, {"pos": [0.3, 0.99, -0.3], "tex": [1, 0]}, {"pos": [0.3, 0.99, 0.3], "tex": [1, 1]}, {"pos": [-0.3, 0.99, 0.3], "tex": [0, 1]},
+            {"pos": [-0.4, -0.4, -0.2], "tex": [0, 0]}, {"pos": [0.2, -0.4, -0.2], "tex": [1, 0]}, {"pos": [0.2, -0.4, 0.4], "tex": [1, 1]}, {"pos": [-0.4, -0.4, 0.4], "tex": [0, 1]}
+        ],
+        "primitives": [{"type": "reflective", "content": {
+            "surface-materials": [
+                {"type": "SimpleDiffuse", "content": {"diffuse-texture": 0}},
+                {"type": "SimpleEmissive", "content": {"emissive-texture": 1, "multiplier": 15}},
+                {"type": "SpecularCoated", "content": {"diffuse-texture": 0, "roughness-texture": 2, "ior": 1.5}}
+            ],
+            "indices": [
+                {"material-index": 0, "0": 0, "1": 1, "2": 2}, {"material-index": 0, "0": 0, "1": 2, "2": 3},
+                {"material-index": 0, "0": 4, "1": 5, "2": 6}, {"material-index": 0, "0": 4, "1": 6, "2": 7},
+                {"material-index": 0, "0": 3, "1": 2, "2": 6}, {"material-index": 0, "0": 3, "1": 6, "2": 7},
+                {"material-index": 0, "0": 0, "1": 3, "2": 7}, {"material-index": 0, "0": 0, "1": 7, "2": 4},
+                {"material-index": 0, "0": 1, "1": 2, "2": 6}, {"material-index": 0, "0": 1, "1": 6, "2": 5},
+                {"material-index": 0, "0": 0, "1": 1, "2": 5}, {"material-index": 0, "0": 0, "1": 5, "2": 4},
+                {"material-index": 1, "0": 8, "1": 9, "2": 10}, {"material-index": 1, "0": 8, "1": 10, "2": 11},
+                {"material-index": 2, "0": 12, "1": 13, "2": 14}, {"material-index": 2, "0": 12, "1": 14, "2": 15}
+            ]
+        }}],
+        "cull-mode": "none"
+    }}}}],
+    "ambient-color": [0, 0, 0]
+})";
+
+struct RenderAllocations
+{
+    uint64_t nTotal;
+    uint64_t nWorkers;
+};
+
+// allocations made by a render of the scene, after a render of the same size has warmed up the pool and the tracer's buffers
+static RenderAllocations countRenderAllocations(const tracer::Scene& scene, uint32_t width, uint32_t height, uint32_t nSamplesPerPixel)
+{
+    using namespace tracer;
+
+    TracerConfiguration config{};
+    config.nThreads = 2u;
+    config.width = width;
+    config.height = height;
+    config.nSamplesPerPixel = nSamplesPerPixel;
+    config.tileSize = 16u;
+    config.logProgress = false;
+    Tracer tracer(config);
+    Canvas canvas;
+
+    tracer.Render(canvas, scene);
+    nAllocations.store(0);
+    nWorkerAllocations.store(0);
+    tracer.Render(canvas, scene);
+    return RenderAllocations{nAllocations.load(), nWorkerAllocations.load()};
+}
+
+int main()
+{
+    using namespace tracer;
+
+    const char* scenePath = "allocation_test_scene.json";
+    std::ofstream(scenePath) << sceneJson;
+    std::unique_ptr<Scene> scene = Scene::Create(scenePath);
+
+    // a render allocates its buffers and bookkeeping once, so its allocations may depend on the number of tiles but not
+    // on how many samples, and so bounces, the pixels of the tiles take
+    constexpr uint32_t size = 32u;
+    constexpr uint32_t nFewSamplesPerPixel = 4u;
+    constexpr uint32_t nManySamplesPerPixel = 64u;
+    RenderAllocations few = countRenderAllocations(*scene, size, size, nFewSamplesPerPixel);
+    RenderAllocations many = countRenderAllocations(*scene, size, size, nManySamplesPerPixel);
+    fmt::println("allocations per render: {} ({} on workers) at {} spp, {} ({} on workers) at {} spp",
+        few.nTotal, few.nWorkers, nFewSamplesPerPixel, many.nTotal, many.nWorkers, nManySamplesPerPixel);
+
+    // only the workers' count is compared: the setting up thread creates the threads the pool grows by for the render,
+    // and how many it needs depends on whether the previous render's workers have become idle yet
+    uint64_t nExtraSamples = static_cast<uint64_t>(size) * size * (nManySamplesPerPixel - nFewSamplesPerPixel);
+    int64_t nExtraAllocations = static_cast<int64_t>(many.nWorkers - few.nWorkers);
+    fmt::println("worker allocations per extra pixel sample: {}", static_cast<double>(nExtraAllocations) / static_cast<double>(nExtraSamples));
+    if (nExtraAllocations != 0)
+    {
+        fmt::println("failed: {} worker allocations for {} more samples", nExtraAllocations, nExtraSamples);
+        return 1;
+    }
+
+    fmt::println("passed: no allocations per pixel sample");
+    return 0;
+}
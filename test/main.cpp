@@ -38,6 +38,7 @@ int main()
     fmt::println("Time elapsed: {}ms", duration.count());
 
     canvas.SaveToPNG("out.png");
+    tracer.GetFramebuffer().SaveToEXR("out.exr");
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fmt/core.h>
+
+#include <tracer/canvas.h>
+#include <tracer/tracer.h>
+
+// combines the partial renders of sharded renders (see TracerConfiguration::firstSample) into a single image
+int main(int argc, char** argv)
+{
+    using namespace tracer;
+
+    if (argc < 3)
+    {
+        fmt::println("usage: {} <output .exr or .png> <partial>...", argv[0]);
+        return 1;
+    }
+
+    std::string_view output = argv[1];
+    std::vector<std::string> partials(argv + 2, argv + argc);
+    try
+    {
+        Canvas canvas;
+        Tracer tracer;
+        tracer.MergePartials(canvas, partials);
+        if (output.ends_with(".png"))
+            canvas.SaveToPNG(output);
+        else
+            tracer.GetFramebuffer().SaveToEXR(output);
+    }
+    catch (const std::exception& e)
+    {
+        fmt::println("{}", e.what());
+        return 1;
+    }
+    fmt::println("Merged {} partial renders into {}", partials.size(), output);
+
+    return 0;
+}